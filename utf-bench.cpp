@@ -0,0 +1,1076 @@
+/* UTF --- UTF-8, UTF-16, UTF-32 conversion library
+ * Copyright (C) 2019-2025 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+ */
+/* utf-bench --- throughput benchmark of the conversion library */
+#define _CRT_SECURE_NO_WARNINGS
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <chrono>
+#include <ctime>
+#include "utf.hpp"
+#include "utf_intern.hpp"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <intrin.h>
+	#define UTF_BENCH_HAVE_TSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+	#include <x86intrin.h>
+	#define UTF_BENCH_HAVE_TSC 1
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// timing
+
+static inline uint64_t bench_cycles(void)
+{
+#ifdef UTF_BENCH_HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static inline double bench_seconds(void)
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time of this process (user + system), not disturbed by preemption
+static inline double bench_cpu_seconds(void)
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+	{
+		ULARGE_INTEGER k, u;
+		k.LowPart = kernel.dwLowDateTime;
+		k.HighPart = kernel.dwHighDateTime;
+		u.LowPart = user.dwLowDateTime;
+		u.HighPart = user.dwHighDateTime;
+		return double(k.QuadPart + u.QuadPart) * 1e-7;
+	}
+	return double(std::clock()) / CLOCKS_PER_SEC;
+#elif defined(CLOCK_PROCESS_CPUTIME_ID)
+	struct timespec ts;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0)
+		return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+	return double(std::clock()) / CLOCKS_PER_SEC;
+#else
+	return double(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+struct BENCH_SAMPLE
+{
+	double seconds;
+	uint64_t cycles;
+};
+
+struct BENCH_RESULT
+{
+	std::string name;
+	std::string group;
+	std::string corpus;
+	size_t bytes;           // input bytes per call
+	size_t code_points;     // input code points per call
+	size_t runs;
+	double best_seconds;
+	double median_seconds;
+	uint64_t best_cycles;
+};
+
+static volatile size_t s_sink = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+// corpora
+
+struct BENCH_RNG
+{
+	uint64_t state;
+
+	explicit BENCH_RNG(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL)
+	{
+	}
+
+	uint32_t next()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return uint32_t((state * 0x2545F4914F6CDD1DULL) >> 32);
+	}
+
+	uint32_t range(uint32_t lo, uint32_t hi) // [lo, hi]
+	{
+		return lo + next() % (hi - lo + 1);
+	}
+
+	bool chance(uint32_t percent)
+	{
+		return next() % 100 < percent;
+	}
+};
+
+enum CORPUS_KIND
+{
+	CORPUS_ASCII,
+	CORPUS_LATIN1,
+	CORPUS_CJK,
+	CORPUS_EMOJI,
+	CORPUS_MIXED,
+	CORPUS_MALFORMED
+};
+
+struct BENCH_CORPUS
+{
+	std::string name;
+	UTF_US8 s8;
+	UTF_US16 s16;
+	UTF_US32 s32;
+	size_t cp8, cp16, cp32;   // code points as decoded from each form
+};
+
+static UTF_UC32 corpus_ascii(BENCH_RNG& rng)
+{
+	if (rng.chance(15))
+		return ' ';
+	return rng.range(0x21, 0x7E);
+}
+
+static UTF_UC32 corpus_latin1(BENCH_RNG& rng)
+{
+	if (rng.chance(50))
+		return corpus_ascii(rng);
+	return rng.range(0xA0, 0xFF);
+}
+
+static UTF_UC32 corpus_cjk(BENCH_RNG& rng)
+{
+	if (rng.chance(5))
+		return rng.range(0x3001, 0x3002);   // ideographic comma/full stop
+	if (rng.chance(20))
+		return rng.range(0x3041, 0x30FF);   // kana
+	return rng.range(0x4E00, 0x9FFF);
+}
+
+static UTF_UC32 corpus_emoji(BENCH_RNG& rng)
+{
+	if (rng.chance(25))
+		return corpus_ascii(rng);
+	return rng.range(0x1F300, 0x1FAFF);
+}
+
+static UTF_UC32 corpus_mixed(BENCH_RNG& rng)
+{
+	switch (rng.next() % 4)
+	{
+	case 0: return corpus_ascii(rng);
+	case 1: return corpus_latin1(rng);
+	case 2: return corpus_cjk(rng);
+	default: return corpus_emoji(rng);
+	}
+}
+
+static void corpus_generate(BENCH_CORPUS& corpus, CORPUS_KIND kind, size_t bytes)
+{
+	static const char *s_names[] =
+	{
+		"ascii", "latin1", "cjk", "emoji", "mixed", "malformed"
+	};
+	BENCH_RNG rng(0x5EED0000 + kind);
+	UTF_UC8 uc8[4];
+
+	corpus.name = s_names[kind];
+	corpus.s8.clear();
+	corpus.s32.clear();
+
+	// generate code points in lines of 40 to 120 characters
+	size_t column = 0, line = rng.range(40, 120);
+	while (corpus.s8.size() < bytes)
+	{
+		UTF_UC32 uc32;
+		if (column++ == line)
+		{
+			uc32 = '\n';
+			column = 0;
+			line = rng.range(40, 120);
+		}
+		else
+		{
+			switch (kind)
+			{
+			case CORPUS_ASCII: uc32 = corpus_ascii(rng); break;
+			case CORPUS_LATIN1: uc32 = corpus_latin1(rng); break;
+			case CORPUS_CJK: uc32 = corpus_cjk(rng); break;
+			case CORPUS_EMOJI: uc32 = corpus_emoji(rng); break;
+			default: uc32 = corpus_mixed(rng); break;
+			}
+		}
+
+		corpus.s32.push_back(uc32);
+		UTF_uc32_to_uc8(uc32, uc8);
+		for (int i = 0; i < 4 && uc8[i]; ++i)
+			corpus.s8.push_back(uc8[i]);
+	}
+
+	corpus.s16.clear();
+	UTF_U_to_u<'?'>(corpus.s32, corpus.s16);
+
+	if (kind == CORPUS_MALFORMED)
+	{
+		// about 0.5% damaged units in every form
+		for (size_t i = 0; i < corpus.s8.size(); ++i)
+		{
+			if (rng.next() % 200 == 0 && corpus.s8[i] != '\n')
+				corpus.s8[i] = UTF_UC8(rng.range(0x80, 0xFF));
+		}
+		for (size_t i = 0; i < corpus.s16.size(); ++i)
+		{
+			if (rng.next() % 200 == 0 && corpus.s16[i] != '\n')
+				corpus.s16[i] = UTF_UC16(rng.range(0xD800, 0xDFFF));
+		}
+		for (size_t i = 0; i < corpus.s32.size(); ++i)
+		{
+			if (rng.next() % 200 == 0 && corpus.s32[i] != '\n')
+				corpus.s32[i] = rng.range(0x110000, 0x7FFFFFFF);
+		}
+	}
+
+	UTF_US32 tmp;
+	UTF_u8_to_U<'?'>(corpus.s8, tmp);
+	corpus.cp8 = tmp.size();
+	tmp.clear();
+	UTF_u_to_U<'?'>(corpus.s16, tmp);
+	corpus.cp16 = tmp.size();
+	corpus.cp32 = corpus.s32.size();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// runner
+
+struct BENCH_OPTIONS
+{
+	size_t bytes;
+	double min_time;
+	size_t min_runs;
+	double min_sample;      // calibrate repetitions so a sample lasts this long
+	bool cpu_time;          // measure CPU time instead of wall-clock time
+	const char *groups;     // comma-separated groups to run, or NULL for all
+	const char *filter;
+	const char *output;
+};
+
+class BENCH_RUNNER
+{
+public:
+	explicit BENCH_RUNNER(const BENCH_OPTIONS& options) : m_options(options)
+	{
+	}
+
+	void run(const char *group, const char *name, const BENCH_CORPUS& corpus,
+			 size_t bytes, size_t code_points, const std::function<void()>& fn)
+	{
+		std::string full = std::string(group) + "/" + name + "/" + corpus.name;
+		if (m_options.filter && full.find(m_options.filter) == std::string::npos)
+			return;
+		if (m_options.groups && !has_group(group))
+			return;
+
+		// warm up and calibrate the number of calls per sample
+		size_t reps = 1;
+		for (;;)
+		{
+			double t0 = now();
+			for (size_t i = 0; i < reps; ++i)
+				fn();
+			double elapsed = now() - t0;
+			if (elapsed >= m_options.min_sample || reps >= (1 << 20))
+				break;
+			reps *= 2;
+		}
+
+		std::vector<BENCH_SAMPLE> samples;
+		double total = 0;
+		while (total < m_options.min_time || samples.size() < m_options.min_runs)
+		{
+			BENCH_SAMPLE sample;
+			uint64_t c0 = bench_cycles();
+			double t0 = now();
+			for (size_t i = 0; i < reps; ++i)
+				fn();
+			sample.seconds = (now() - t0) / reps;
+			sample.cycles = (bench_cycles() - c0) / reps;
+			samples.push_back(sample);
+			total += sample.seconds * reps;
+		}
+
+		std::vector<double> seconds;
+		BENCH_RESULT result;
+		result.name = name;
+		result.group = group;
+		result.corpus = corpus.name;
+		result.bytes = bytes;
+		result.code_points = code_points;
+		result.runs = samples.size();
+		result.best_seconds = samples[0].seconds;
+		result.best_cycles = samples[0].cycles;
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			seconds.push_back(samples[i].seconds);
+			result.best_seconds = std::min(result.best_seconds, samples[i].seconds);
+			result.best_cycles = std::min(result.best_cycles, samples[i].cycles);
+		}
+		std::sort(seconds.begin(), seconds.end());
+		result.median_seconds = seconds[seconds.size() / 2];
+		m_results.push_back(result);
+
+		fprintf(stderr, "%-40s %8.3f GB/s\n", full.c_str(),
+				result.best_seconds > 0 ? bytes / result.best_seconds / 1e9 : 0.0);
+	}
+
+	const std::vector<BENCH_RESULT>& results() const
+	{
+		return m_results;
+	}
+
+	bool write_json() const
+	{
+		FILE *fp = stdout;
+		if (m_options.output && !(fp = fopen(m_options.output, "w")))
+		{
+			fprintf(stderr, "utf-bench: cannot open '%s'\n", m_options.output);
+			return false;
+		}
+
+		fprintf(fp, "{\n");
+		fprintf(fp, "  \"utf_h_version\": %d,\n", UTF_H_);
+		fprintf(fp, "  \"utf_hpp_version\": %d,\n", UTF_HPP_);
+		fprintf(fp, "  \"corpus_bytes\": %lu,\n", (unsigned long)m_options.bytes);
+#ifdef UTF_BENCH_HAVE_TSC
+		fprintf(fp, "  \"cycle_counter\": \"tsc\",\n");
+#else
+		fprintf(fp, "  \"cycle_counter\": null,\n");
+#endif
+		fprintf(fp, "  \"results\": [\n");
+		for (size_t i = 0; i < m_results.size(); ++i)
+		{
+			const BENCH_RESULT& r = m_results[i];
+			fprintf(fp, "    {\"group\": \"%s\", \"name\": \"%s\", \"corpus\": \"%s\", ",
+					r.group.c_str(), r.name.c_str(), r.corpus.c_str());
+			fprintf(fp, "\"bytes\": %lu, \"code_points\": %lu, \"runs\": %lu, ",
+					(unsigned long)r.bytes, (unsigned long)r.code_points, (unsigned long)r.runs);
+			fprintf(fp, "\"best_seconds\": %.9f, \"median_seconds\": %.9f, ",
+					r.best_seconds, r.median_seconds);
+			fprintf(fp, "\"gbps\": %.4f, ", r.best_seconds > 0 ? r.bytes / r.best_seconds / 1e9 : 0.0);
+#ifdef UTF_BENCH_HAVE_TSC
+			fprintf(fp, "\"cp_per_cycle\": %.4f}", r.best_cycles ? double(r.code_points) / r.best_cycles : 0.0);
+#else
+			fprintf(fp, "\"cp_per_cycle\": null}");
+#endif
+			fprintf(fp, "%s\n", (i + 1 < m_results.size()) ? "," : "");
+		}
+		fprintf(fp, "  ]\n");
+		fprintf(fp, "}\n");
+
+		if (fp != stdout)
+			fclose(fp);
+		return true;
+	}
+
+private:
+	BENCH_OPTIONS m_options;
+	std::vector<BENCH_RESULT> m_results;
+
+	double now() const
+	{
+		return m_options.cpu_time ? bench_cpu_seconds() : bench_seconds();
+	}
+
+	bool has_group(const char *group) const
+	{
+		std::string groups = std::string(",") + m_options.groups + ",";
+		return groups.find(std::string(",") + group + ",") != std::string::npos;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// benchmarks
+
+static void bench_c_convert(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	static std::vector<UTF_UC8> buf8;
+	static std::vector<UTF_UC16> buf16;
+	static std::vector<UTF_UC32> buf32;
+	buf8.resize(c.s16.size() * 3 + c.s32.size() * 4 + 1);
+	buf16.resize(c.s8.size() + c.s32.size() * 2 + 1);
+	buf32.resize(c.s8.size() + c.s16.size() + 1);
+
+	runner.run("c", "UTF_uj8_to_uj16", c, c.s8.size(), c.cp8, [&]() {
+		s_sink += UTF_uj8_to_uj16(c.s8.data(), c.s8.size(), &buf16[0], buf16.size());
+	});
+	runner.run("c", "UTF_uj8_to_uj32", c, c.s8.size(), c.cp8, [&]() {
+		s_sink += UTF_uj8_to_uj32(c.s8.data(), c.s8.size(), &buf32[0], buf32.size());
+	});
+	runner.run("c", "UTF_uj16_to_uj8", c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		s_sink += UTF_uj16_to_uj8(c.s16.data(), c.s16.size(), &buf8[0], buf8.size());
+	});
+	runner.run("c", "UTF_uj16_to_uj32", c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		s_sink += UTF_uj16_to_uj32(c.s16.data(), c.s16.size(), &buf32[0], buf32.size());
+	});
+	runner.run("c", "UTF_uj32_to_uj8", c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		s_sink += UTF_uj32_to_uj8(c.s32.data(), c.s32.size(), &buf8[0], buf8.size());
+	});
+	runner.run("c", "UTF_uj32_to_uj16", c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		s_sink += UTF_uj32_to_uj16(c.s32.data(), c.s32.size(), &buf16[0], buf16.size());
+	});
+
+	// the size queries, to compare with the converters above
+	runner.run("size", "UTF_uj8_to_uj16_size", c, c.s8.size(), c.cp8, [&]() {
+		s_sink += UTF_uj8_to_uj16_size(c.s8.data(), c.s8.size());
+	});
+	runner.run("size", "UTF_uj16_to_uj8_size", c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		s_sink += UTF_uj16_to_uj8_size(c.s16.data(), c.s16.size());
+	});
+	runner.run("size", "UTF_uj32_to_uj16_size", c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		s_sink += UTF_uj32_to_uj16_size(c.s32.data(), c.s32.size());
+	});
+}
+
+template <typename T_POLICY>
+static void bench_policy(BENCH_RUNNER& runner, const BENCH_CORPUS& c, const char *policy)
+{
+	const std::string u8_to_u = std::string("UTF_u8_to_u/") + policy;
+	const std::string u_to_u8 = std::string("UTF_u_to_u8/") + policy;
+	const std::string U_to_u8 = std::string("UTF_U_to_u8/") + policy;
+	runner.run("policy", u8_to_u.c_str(), c, c.s8.size(), c.cp8, [&]() {
+		UTF_US16 out;
+		UTF_u8_to_u<T_POLICY>(c.s8, out);
+		s_sink += out.size();
+	});
+	runner.run("policy", u_to_u8.c_str(), c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		UTF_US8 out;
+		UTF_u_to_u8<T_POLICY>(c.s16, out);
+		s_sink += out.size();
+	});
+	runner.run("policy", U_to_u8.c_str(), c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		UTF_US8 out;
+		UTF_U_to_u8<T_POLICY>(c.s32, out);
+		s_sink += out.size();
+	});
+}
+
+static void bench_cxx_convert(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	runner.run("cxx", "UTF_u8_to_u", c, c.s8.size(), c.cp8, [&]() {
+		UTF_US16 out;
+		UTF_u8_to_u<'?'>(c.s8, out);
+		s_sink += out.size();
+	});
+	runner.run("cxx", "UTF_u8_to_U", c, c.s8.size(), c.cp8, [&]() {
+		UTF_US32 out;
+		UTF_u8_to_U<'?'>(c.s8, out);
+		s_sink += out.size();
+	});
+	runner.run("cxx", "UTF_u_to_u8", c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		UTF_US8 out;
+		UTF_u_to_u8<'?'>(c.s16, out);
+		s_sink += out.size();
+	});
+	runner.run("cxx", "UTF_u_to_U", c, c.s16.size() * sizeof(UTF_UC16), c.cp16, [&]() {
+		UTF_US32 out;
+		UTF_u_to_U<'?'>(c.s16, out);
+		s_sink += out.size();
+	});
+	runner.run("cxx", "UTF_U_to_u8", c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		UTF_US8 out;
+		UTF_U_to_u8<'?'>(c.s32, out);
+		s_sink += out.size();
+	});
+	runner.run("cxx", "UTF_U_to_u", c, c.s32.size() * sizeof(UTF_UC32), c.cp32, [&]() {
+		UTF_US16 out;
+		UTF_U_to_u<'?'>(c.s32, out);
+		s_sink += out.size();
+	});
+	bench_policy<UTF_policy_replace>(runner, c, "replace");
+	bench_policy<UTF_policy_trusted>(runner, c, "trusted");
+}
+
+static void bench_intern(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	// the corpus cut at spaces into at most 4096 tokens, like field names
+	std::vector<UTF_S8> tokens;
+	size_t bytes = 0, cps = 0;
+	const char *s8 = reinterpret_cast<const char *>(c.s8.data());
+	for (size_t i = 0; i < c.s8.size() && tokens.size() < 4096; )
+	{
+		size_t j = i;
+		while (j < c.s8.size() && j - i < 64 && s8[j] != ' ')
+			++j;
+		if (j == i)
+			++j;
+		tokens.push_back(UTF_S8(s8 + i, j - i));
+		bytes += j - i;
+		cps += UTF_uj8_count_cp(c.s8.data() + i, j - i);
+		i = j;
+	}
+
+	runner.run("intern", "UTF_u8_to_u", c, bytes, cps, [&]() {
+		for (size_t i = 0; i < tokens.size(); ++i)
+		{
+			UTF_US16 out;
+			UTF_u8_to_u<'?'>(tokens[i], out);
+			s_sink += out.size();
+		}
+	});
+	UTF_intern_cache<UTF_ENC_16, '?'> cache;
+	runner.run("intern", "UTF_intern_cache", c, bytes, cps, [&]() {
+		for (size_t i = 0; i < tokens.size(); ++i)
+			s_sink += cache.get(tokens[i]).size();
+	});
+}
+
+static void bench_len_cmp(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	// NUL-terminated copies without embedded NULs
+	static UTF_US8 a8, b8;
+	static UTF_US16 a16, b16;
+	static UTF_US32 a32, b32;
+	a8 = c.s8;
+	std::replace(a8.begin(), a8.end(), UTF_UC8(0), UTF_UC8(' '));
+	a16 = c.s16;
+	std::replace(a16.begin(), a16.end(), UTF_UC16(0), UTF_UC16(' '));
+	a32 = c.s32;
+	std::replace(a32.begin(), a32.end(), UTF_UC32(0), UTF_UC32(' '));
+	b8 = a8;
+	b16 = a16;
+	b32 = a32;
+
+	const size_t bytes8 = a8.size(), bytes16 = a16.size() * sizeof(UTF_UC16);
+	const size_t bytes32 = a32.size() * sizeof(UTF_UC32);
+
+	runner.run("len", "UTF_uj8_len", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_len(a8.c_str());
+	});
+	runner.run("len", "UTF_j8_len", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_j8_len(reinterpret_cast<const UTF_C8 *>(a8.c_str()));
+	});
+	runner.run("len", "UTF_uj16_len", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_len(a16.c_str());
+	});
+	runner.run("len", "UTF_uj32_len", c, bytes32, c.cp32, [&]() {
+		s_sink += UTF_uj32_len(a32.c_str());
+	});
+	runner.run("len", "UTF_uj8_count_cp", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_count_cp(a8.c_str(), a8.size());
+	});
+	runner.run("len", "UTF_uj16_count_cp", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_count_cp(a16.c_str(), a16.size());
+	});
+	runner.run("len", "UTF_uj8_cp_offset", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_cp_offset(a8.c_str(), a8.size(), c.cp8 - 1);
+	});
+
+	runner.run("cmp", "UTF_uj8_cmp", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_cmp(a8.c_str(), b8.c_str());
+	});
+	runner.run("cmp", "UTF_j8_cmp", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_j8_cmp(reinterpret_cast<const UTF_C8 *>(a8.c_str()),
+							 reinterpret_cast<const UTF_C8 *>(b8.c_str()));
+	});
+	runner.run("cmp", "UTF_uj16_cmp", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_cmp(a16.c_str(), b16.c_str());
+	});
+	runner.run("cmp", "UTF_uj32_cmp", c, bytes32, c.cp32, [&]() {
+		s_sink += UTF_uj32_cmp(a32.c_str(), b32.c_str());
+	});
+	runner.run("cmp", "UTF_uj8_cmpn", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_cmpn(a8.c_str(), b8.c_str(), a8.size());
+	});
+	runner.run("cmp", "UTF_uj16_cmpn", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_cmpn(a16.c_str(), b16.c_str(), a16.size());
+	});
+	runner.run("cmp", "UTF_uj32_cmpn", c, bytes32, c.cp32, [&]() {
+		s_sink += UTF_uj32_cmpn(a32.c_str(), b32.c_str(), a32.size());
+	});
+	runner.run("cmp", "UTF_uj8_cmp_len", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_cmp_len(a8.data(), a8.size(), b8.data(), b8.size(), NULL);
+	});
+	runner.run("cmp", "UTF_uj16_cmp_len", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_cmp_len(a16.data(), a16.size(), b16.data(), b16.size(), NULL);
+	});
+	runner.run("cmp", "UTF_uj16_equal", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_equal(a16.data(), a16.size(), b16.data(), b16.size());
+	});
+	runner.run("cmp", "UTF_uj8_cmp_uj16", c, bytes8 + bytes16, c.cp8, [&]() {
+		s_sink += UTF_uj8_cmp_uj16(a8.data(), a8.size(), a16.data(), a16.size());
+	});
+	runner.run("cmp", "UTF_uj8_cmp_uj32", c, bytes8 + bytes32, c.cp8, [&]() {
+		s_sink += UTF_uj8_cmp_uj32(a8.data(), a8.size(), a32.data(), a32.size());
+	});
+	runner.run("cmp", "UTF_uj16_cmp_uj32", c, bytes16 + bytes32, c.cp16, [&]() {
+		s_sink += UTF_uj16_cmp_uj32(a16.data(), a16.size(), a32.data(), a32.size());
+	});
+	runner.run("hash", "UTF_uj8_hash", c, bytes8, c.cp8, [&]() {
+		s_sink += UTF_uj8_hash(a8.data(), a8.size(), 0);
+	});
+	runner.run("hash", "UTF_uj16_hash", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_uj16_hash(a16.data(), a16.size(), 0);
+	});
+	runner.run("hash", "UTF_uj32_hash", c, bytes32, c.cp32, [&]() {
+		s_sink += UTF_uj32_hash(a32.data(), a32.size(), 0);
+	});
+	runner.run("iter", "UTF_u8_cps", c, bytes8, c.cp8, [&]() {
+		UTF_UC32 sum = 0;
+		for (UTF_UC32 uc32 : UTF_u8_cps(a8))
+			sum += uc32;
+		s_sink += sum;
+	});
+	runner.run("iter", "UTF_u_cps", c, bytes16, c.cp16, [&]() {
+		UTF_UC32 sum = 0;
+		for (UTF_UC32 uc32 : UTF_u_cps(a16))
+			sum += uc32;
+		s_sink += sum;
+	});
+	runner.run("iter", "UTF_u8_cps/reverse", c, bytes8, c.cp8, [&]() {
+		UTF_UC32 sum = 0;
+		UTF_cp_view<UTF_UC8> view = UTF_u8_cps(a8);
+		for (UTF_cp_view<UTF_UC8>::reverse_iterator it = view.rbegin(); it != view.rend(); ++it)
+			sum += *it;
+		s_sink += sum;
+	});
+	runner.run("iter", "UTF_u8_to_U", c, bytes8, c.cp8, [&]() {
+		UTF_US32 us32;
+		UTF_u8_to_U(a8, us32);
+		UTF_UC32 sum = 0;
+		for (UTF_UC32 uc32 : us32)
+			sum += uc32;
+		s_sink += sum;
+	});
+	runner.run("iter", "UTF_u8_cps>UTF_u_inserter", c, bytes8, c.cp8, [&]() {
+		UTF_US16 us16;
+		us16.reserve(a8.size());
+		UTF_cp_view<UTF_UC8> view = UTF_u8_cps(a8);
+		std::copy(view.begin(), view.end(), UTF_u_inserter(us16));
+		s_sink += us16.size();
+	});
+	runner.run("iter", "UTF_u_cps>UTF_u8_encoder", c, bytes16, c.cp16, [&]() {
+		static std::vector<UTF_UC8> buf;
+		buf.resize(a16.size() * 3);
+		UTF_cp_view<UTF_US16::value_type> view = UTF_u_cps(a16);
+		s_sink += std::copy(view.begin(), view.end(), UTF_u8_encoder(buf.data())).base() - buf.data();
+	});
+	runner.run("cmp", "UTF_cmp<UTF_UC16>", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_cmp(a16.c_str(), b16.c_str());
+	});
+	runner.run("cmp", "UTF_cmpn<UTF_UC16>", c, bytes16, c.cp16, [&]() {
+		s_sink += UTF_cmpn(a16.c_str(), b16.c_str(), a16.size());
+	});
+}
+
+template <typename T_CHAR>
+static FILE *bench_tmpfile(const std::basic_string<T_CHAR>& str, bool swap)
+{
+	FILE *fp = tmpfile();
+	if (!fp)
+		return NULL;
+
+	std::basic_string<T_CHAR> data = str;
+	if (swap)
+	{
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			T_CHAR ch = data[i], swapped = 0;
+			for (size_t k = 0; k < sizeof(T_CHAR); ++k)
+			{
+				swapped = T_CHAR((swapped << 8) | (ch & 0xFF));
+				ch = T_CHAR(ch >> 8);
+			}
+			data[i] = swapped;
+		}
+	}
+	fwrite(data.data(), sizeof(T_CHAR), data.size(), fp);
+	fflush(fp);
+	return fp;
+}
+
+static void bench_readers(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	const int count = 1024;
+	const size_t bytes8 = c.s8.size(), bytes16 = c.s16.size() * sizeof(UTF_UC16);
+	const size_t bytes32 = c.s32.size() * sizeof(UTF_UC32);
+	FILE *fp8 = bench_tmpfile(c.s8, false);
+	FILE *fp16 = bench_tmpfile(c.s16, false);
+	FILE *fp16xe = bench_tmpfile(c.s16, true);
+	FILE *fp32 = bench_tmpfile(c.s32, false);
+	FILE *fp32xe = bench_tmpfile(c.s32, true);
+	if (!fp8 || !fp16 || !fp16xe || !fp32 || !fp32xe)
+	{
+		fprintf(stderr, "utf-bench: tmpfile failed; skipping readers\n");
+		if (fp8) fclose(fp8);
+		if (fp16) fclose(fp16);
+		if (fp16xe) fclose(fp16xe);
+		if (fp32) fclose(fp32);
+		if (fp32xe) fclose(fp32xe);
+		return;
+	}
+
+	static UTF_UC8 line8[count];
+	static UTF_UC16 line16[count];
+	static UTF_UC32 line32[count];
+
+	runner.run("fgets", "UTF8_fgets", c, bytes8, c.cp8, [&]() {
+		rewind(fp8);
+		while (UTF8_fgets(line8, count, fp8))
+			++s_sink;
+	});
+	runner.run("fgets", "UTF16_fgets", c, bytes16, c.cp16, [&]() {
+		rewind(fp16);
+		while (UTF16_fgets(line16, count, fp16))
+			++s_sink;
+	});
+	runner.run("fgets", "UTF16XE_fgets", c, bytes16, c.cp16, [&]() {
+		rewind(fp16xe);
+		while (UTF16XE_fgets(line16, count, fp16xe))
+			++s_sink;
+	});
+	runner.run("fgets", "UTF32_fgets", c, bytes32, c.cp32, [&]() {
+		rewind(fp32);
+		while (UTF32_fgets(line32, count, fp32))
+			++s_sink;
+	});
+	runner.run("fgets", "UTF32XE_fgets", c, bytes32, c.cp32, [&]() {
+		rewind(fp32xe);
+		while (UTF32XE_fgets(line32, count, fp32xe))
+			++s_sink;
+	});
+	runner.run("fgets", "UTF_fgets<UTF_UC16>", c, bytes16, c.cp16, [&]() {
+		rewind(fp16);
+		while (UTF_fgets(line16, count, fp16))
+			++s_sink;
+	});
+
+	runner.run("getline", "UTF16_getline", c, bytes16, c.cp16, [&]() {
+		rewind(fp16);
+		while (UTF_UC16 *line = UTF16_getline(fp16))
+			free(line);
+	});
+	runner.run("getline", "UTF16XE_getline", c, bytes16, c.cp16, [&]() {
+		rewind(fp16xe);
+		while (UTF_UC16 *line = UTF16XE_getline(fp16xe))
+			free(line);
+	});
+	runner.run("getline", "UTF32_getline", c, bytes32, c.cp32, [&]() {
+		rewind(fp32);
+		while (UTF_UC32 *line = UTF32_getline(fp32))
+			free(line);
+	});
+	runner.run("getline", "UTF32XE_getline", c, bytes32, c.cp32, [&]() {
+		rewind(fp32xe);
+		while (UTF_UC32 *line = UTF32XE_getline(fp32xe))
+			free(line);
+	});
+
+	fclose(fp8);
+	fclose(fp16);
+	fclose(fp16xe);
+	fclose(fp32);
+	fclose(fp32xe);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// performance gate
+
+static const char *const s_gate_groups = "c,getline,reference";
+static const size_t s_gate_bytes = 256 * 1024;
+static const size_t s_gate_runs = 11;
+
+// The gate compares throughputs relative to this kernel, timed in the same
+// run, so that the baseline holds on a faster or slower machine. FNV-1a is a
+// serial chain of byte operations that no compiler vectorizes, so it tracks
+// the scalar speed of the core as the converters do.
+static const char *const s_gate_reference = "reference/fnv1a/mixed";
+
+static void bench_reference(BENCH_RUNNER& runner, const BENCH_CORPUS& c)
+{
+	runner.run("reference", "fnv1a", c, c.s8.size(), c.cp8, [&]() {
+		uint32_t hash = 2166136261U;
+		for (size_t i = 0; i < c.s8.size(); ++i)
+			hash = (hash ^ c.s8[i]) * 16777619U;
+		s_sink += hash;
+	});
+}
+
+static std::string gate_key(const BENCH_RESULT& r)
+{
+	return r.group + "/" + r.name + "/" + r.corpus;
+}
+
+static double gate_gbps(const BENCH_RESULT& r)
+{
+	return r.median_seconds > 0 ? r.bytes / r.median_seconds / 1e9 : 0.0;
+}
+
+// the throughputs divided by that of s_gate_reference, which is left out
+static bool gate_relative(const std::vector<BENCH_RESULT>& results,
+						  std::vector<std::pair<std::string, double> >& relative)
+{
+	double reference = 0;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (gate_key(results[i]) == s_gate_reference)
+			reference = gate_gbps(results[i]);
+	}
+	if (reference <= 0)
+		return false;
+
+	relative.clear();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (gate_key(results[i]) != s_gate_reference)
+			relative.push_back(std::make_pair(gate_key(results[i]), gate_gbps(results[i]) / reference));
+	}
+	return true;
+}
+
+// reads the "baseline" object of a baseline file written by --write-baseline
+static bool gate_load_baseline(const char *fname, std::map<std::string, double>& baseline)
+{
+	FILE *fp = fopen(fname, "rb");
+	if (!fp)
+		return false;
+
+	std::string text;
+	char buf[4096];
+	size_t cb;
+	while ((cb = fread(buf, 1, sizeof(buf), fp)) != 0)
+		text.append(buf, cb);
+	fclose(fp);
+
+	size_t pos = text.find("\"baseline\"");
+	if (pos == std::string::npos || (pos = text.find('{', pos)) == std::string::npos)
+		return false;
+
+	for (;;)
+	{
+		size_t begin = text.find_first_of("\"}", pos + 1);
+		if (begin == std::string::npos || text[begin] == '}')
+			break;
+		size_t end = text.find('"', begin + 1);
+		size_t colon = (end == std::string::npos) ? end : text.find(':', end);
+		if (colon == std::string::npos)
+			return false;
+
+		char *stop;
+		double value = strtod(text.c_str() + colon + 1, &stop);
+		if (stop == text.c_str() + colon + 1)
+			return false;
+
+		baseline[text.substr(begin + 1, end - begin - 1)] = value;
+		pos = stop - text.c_str();
+	}
+	return !baseline.empty();
+}
+
+static bool gate_write_baseline(const char *fname, const std::vector<BENCH_RESULT>& results)
+{
+	std::vector<std::pair<std::string, double> > relative;
+	if (!gate_relative(results, relative))
+		return false;
+	FILE *fp = fopen(fname, "w");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"corpus_bytes\": %lu,\n", (unsigned long)s_gate_bytes);
+	fprintf(fp, "  \"runs\": %lu,\n", (unsigned long)s_gate_runs);
+	fprintf(fp, "  \"unit\": \"throughput / throughput of %s (CPU time, median)\",\n", s_gate_reference);
+	fprintf(fp, "  \"baseline\": {\n");
+	for (size_t i = 0; i < relative.size(); ++i)
+	{
+		fprintf(fp, "    \"%s\": %.4f%s\n", relative[i].first.c_str(), relative[i].second,
+				(i + 1 < relative.size()) ? "," : "");
+	}
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+	fclose(fp);
+	return true;
+}
+
+static bool gate_check(const std::map<std::string, double>& baseline,
+					   const std::vector<BENCH_RESULT>& results, double tolerance)
+{
+	std::vector<std::pair<std::string, double> > relative;
+	if (!gate_relative(results, relative))
+	{
+		printf("%s did not run\nFAILED\n", s_gate_reference);
+		return false;
+	}
+
+	bool ok = true;
+	printf("relative to %s\n", s_gate_reference);
+	printf("%-40s %10s %10s %7s\n", "benchmark", "baseline", "measured", "ratio");
+	for (size_t i = 0; i < relative.size(); ++i)
+	{
+		const std::string& key = relative[i].first;
+		double measured = relative[i].second;
+		std::map<std::string, double>::const_iterator it = baseline.find(key);
+		if (it == baseline.end())
+		{
+			printf("%-40s %10s %10.4f %7s  (no baseline)\n", key.c_str(), "-", measured, "-");
+			continue;
+		}
+
+		double ratio = it->second > 0 ? measured / it->second : 1.0;
+		bool pass = (ratio >= 1.0 - tolerance);
+		printf("%-40s %10.4f %10.4f %7.2f  %s\n", key.c_str(), it->second, measured, ratio,
+			   pass ? "ok" : "REGRESSION");
+		if (!pass)
+			ok = false;
+	}
+	printf("tolerance: %.0f%%\n", tolerance * 100);
+	puts(ok ? "ok" : "FAILED");
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static void usage(void)
+{
+	puts("Usage: utf-bench [OPTIONS]\n"
+		 "\n"
+		 "Options:\n"
+		 "  --bytes N              size of each generated corpus in bytes (default: 1048576)\n"
+		 "  --min-time SEC         minimum measuring time per benchmark (default: 0.05)\n"
+		 "  --min-runs N           minimum number of runs per benchmark (default: 5)\n"
+		 "  --cpu-time             measure CPU time instead of wall-clock time\n"
+		 "  --filter TEXT          run only benchmarks whose group/name/corpus contains TEXT\n"
+		 "  --output FILE          write JSON results to FILE instead of stdout\n"
+		 "  --gate FILE            run the fixed-size regression set and compare with FILE\n"
+		 "  --tolerance RATIO      allowed throughput drop for --gate (default: 0.5)\n"
+		 "  --write-baseline FILE  run the fixed-size regression set and write FILE\n"
+		 "  --help                 show this message");
+}
+
+int main(int argc, char **argv)
+{
+	BENCH_OPTIONS options;
+	options.bytes = 1024 * 1024;
+	options.min_time = 0.05;
+	options.min_runs = 5;
+	options.min_sample = 0;
+	options.cpu_time = false;
+	options.groups = NULL;
+	options.filter = NULL;
+	options.output = NULL;
+
+	const char *gate = NULL, *write_baseline = NULL;
+	double tolerance = 0.5;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+		{
+			usage();
+			return EXIT_SUCCESS;
+		}
+		if (arg == "--cpu-time")
+		{
+			options.cpu_time = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "utf-bench: invalid argument '%s'\n", argv[i]);
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		if (arg == "--bytes")
+			options.bytes = strtoul(argv[++i], NULL, 0);
+		else if (arg == "--min-time")
+			options.min_time = atof(argv[++i]);
+		else if (arg == "--min-runs")
+			options.min_runs = strtoul(argv[++i], NULL, 0);
+		else if (arg == "--filter")
+			options.filter = argv[++i];
+		else if (arg == "--output")
+			options.output = argv[++i];
+		else if (arg == "--gate")
+			gate = argv[++i];
+		else if (arg == "--tolerance")
+			tolerance = atof(argv[++i]);
+		else if (arg == "--write-baseline")
+			write_baseline = argv[++i];
+		else
+		{
+			fprintf(stderr, "utf-bench: invalid argument '%s'\n", argv[i]);
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.min_runs == 0)
+		options.min_runs = 1;
+
+	if (gate || write_baseline)
+	{
+		// short, fixed-size and noise-resistant: CPU time, median of N
+		options.bytes = s_gate_bytes;
+		options.min_time = 0;
+		options.min_runs = s_gate_runs;
+		options.min_sample = 0.005;
+		options.cpu_time = true;
+		options.groups = s_gate_groups;
+
+		std::map<std::string, double> baseline;
+		if (gate && !gate_load_baseline(gate, baseline))
+		{
+			fprintf(stderr, "utf-bench: cannot load baseline '%s'\n", gate);
+			return EXIT_FAILURE;
+		}
+
+		BENCH_RUNNER runner(options);
+		BENCH_CORPUS corpus;
+		corpus_generate(corpus, CORPUS_MIXED, options.bytes);
+		bench_reference(runner, corpus);
+		bench_c_convert(runner, corpus);
+		bench_readers(runner, corpus);
+
+		if (write_baseline && !gate_write_baseline(write_baseline, runner.results()))
+		{
+			fprintf(stderr, "utf-bench: cannot write '%s'\n", write_baseline);
+			return EXIT_FAILURE;
+		}
+		if (gate && !gate_check(baseline, runner.results(), tolerance))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	BENCH_RUNNER runner(options);
+	for (int kind = CORPUS_ASCII; kind <= CORPUS_MALFORMED; ++kind)
+	{
+		BENCH_CORPUS corpus;
+		corpus_generate(corpus, CORPUS_KIND(kind), options.bytes);
+
+		bench_c_convert(runner, corpus);
+		bench_cxx_convert(runner, corpus);
+		bench_intern(runner, corpus);
+		bench_len_cmp(runner, corpus);
+		bench_readers(runner, corpus);
+	}
+
+	return runner.write_json() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
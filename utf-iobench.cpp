@@ -0,0 +1,832 @@
+/* UTF --- UTF-8, UTF-16, UTF-32 conversion library
+ * Copyright (C) 2019-2025 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+ */
+/* utf-iobench --- end-to-end I/O benchmark of the line readers */
+#define _CRT_SECURE_NO_WARNINGS
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "utf.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <sys/time.h>
+	#include <sys/resource.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#define UTF_IOBENCH_POSIX 1
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// malloc counters (glibc: replace the allocator entry points)
+
+static size_t s_malloc_calls = 0;
+static size_t s_realloc_calls = 0;
+static size_t s_free_calls = 0;
+
+#if defined(__GLIBC__) && !defined(UTF_IOBENCH_NO_MALLOC_COUNT)
+	#define UTF_IOBENCH_MALLOC_COUNT 1
+
+extern "C"
+{
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void __libc_free(void *ptr);
+
+	void *malloc(size_t size)
+	{
+		++s_malloc_calls;
+		return __libc_malloc(size);
+	}
+
+	void *calloc(size_t count, size_t size)
+	{
+		++s_malloc_calls;
+		return __libc_calloc(count, size);
+	}
+
+	void *realloc(void *ptr, size_t size)
+	{
+		++s_realloc_calls;
+		return __libc_realloc(ptr, size);
+	}
+
+	void free(void *ptr)
+	{
+		if (ptr)
+			++s_free_calls;
+		__libc_free(ptr);
+	}
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// syscall counters (glibc: FILE on top of counting read/lseek callbacks)
+
+struct IO_COUNTERS
+{
+	size_t reads;
+	size_t seeks;
+};
+
+static IO_COUNTERS s_io = { 0, 0 };
+
+#if defined(__GLIBC__) && defined(UTF_IOBENCH_POSIX)
+	#define UTF_IOBENCH_SYSCALL_COUNT 1
+
+static ssize_t io_cookie_read(void *cookie, char *buf, size_t size)
+{
+	++s_io.reads;
+	return read(static_cast<int>(reinterpret_cast<intptr_t>(cookie)), buf, size);
+}
+
+static int io_cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+	++s_io.seeks;
+	off64_t pos = lseek64(static_cast<int>(reinterpret_cast<intptr_t>(cookie)), *offset, whence);
+	if (pos == -1)
+		return -1;
+	*offset = pos;
+	return 0;
+}
+
+static int io_cookie_close(void *cookie)
+{
+	return close(static_cast<int>(reinterpret_cast<intptr_t>(cookie)));
+}
+#endif
+
+// opens a file for reading with the same buffering as fopen(fname, "rb")
+static FILE *io_open(const char *fname)
+{
+#ifdef UTF_IOBENCH_SYSCALL_COUNT
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	size_t bufsize = BUFSIZ;
+	if (fstat(fd, &st) == 0 && st.st_blksize > 0)
+		bufsize = st.st_blksize;
+
+	cookie_io_functions_t funcs;
+	funcs.read = io_cookie_read;
+	funcs.write = NULL;
+	funcs.seek = io_cookie_seek;
+	funcs.close = io_cookie_close;
+	FILE *fp = fopencookie(reinterpret_cast<void *>(static_cast<intptr_t>(fd)), "rb", funcs);
+	if (!fp)
+	{
+		close(fd);
+		return NULL;
+	}
+	setvbuf(fp, NULL, _IOFBF, bufsize);
+	return fp;
+#else
+	return fopen(fname, "rb");
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// workloads
+
+enum WORKLOAD
+{
+	WORKLOAD_LOG,       // short log lines
+	WORKLOAD_JSON,      // long JSON lines
+	WORKLOAD_GIANT      // a single giant line
+};
+
+static const char *const s_workload_names[] = { "log", "json", "giant" };
+
+enum FILE_FORMAT
+{
+	FORMAT_UTF8,
+	FORMAT_UTF16,       // host endian
+	FORMAT_UTF16XE,     // byte-swapped
+	FORMAT_UTF32,       // host endian
+	FORMAT_UTF32XE      // byte-swapped
+};
+
+static const char *const s_format_names[] = { "utf8", "utf16", "utf16xe", "utf32", "utf32xe" };
+
+struct IO_RNG
+{
+	uint64_t state;
+
+	explicit IO_RNG(uint64_t seed) : state(seed)
+	{
+	}
+
+	uint32_t range(uint32_t lo, uint32_t hi) // [lo, hi]
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return lo + uint32_t((state * 0x2545F4914F6CDD1DULL) >> 32) % (hi - lo + 1);
+	}
+};
+
+// mostly ASCII with some Latin-1 and CJK, like real logs and documents
+static UTF_UC32 workload_char(IO_RNG& rng)
+{
+	uint32_t dice = rng.range(0, 99);
+	if (dice < 80)
+		return rng.range(0x20, 0x7E);
+	if (dice < 90)
+		return rng.range(0xA0, 0xFF);
+	return rng.range(0x4E00, 0x9FFF);
+}
+
+static size_t workload_line_length(WORKLOAD workload, IO_RNG& rng)
+{
+	switch (workload)
+	{
+	case WORKLOAD_LOG: return rng.range(40, 160);
+	case WORKLOAD_JSON: return rng.range(2048, 16384);
+	default: return size_t(-1);
+	}
+}
+
+// returns the number of bytes written
+static size_t write_units(FILE *fp, FILE_FORMAT format, const UTF_US32& chunk)
+{
+	if (format == FORMAT_UTF8)
+	{
+		UTF_US8 out;
+		UTF_U_to_u8<'?'>(chunk, out);
+		return fwrite(out.data(), 1, out.size(), fp);
+	}
+	else if (format == FORMAT_UTF16 || format == FORMAT_UTF16XE)
+	{
+		UTF_US16 out;
+		UTF_U_to_u<'?'>(chunk, out);
+		if (format == FORMAT_UTF16XE)
+		{
+			for (size_t i = 0; i < out.size(); ++i)
+				out[i] = UTF16_XE(out[i]);
+		}
+		return fwrite(out.data(), sizeof(UTF_UC16), out.size(), fp) * sizeof(UTF_UC16);
+	}
+	else
+	{
+		UTF_US32 out = chunk;
+		if (format == FORMAT_UTF32XE)
+		{
+			for (size_t i = 0; i < out.size(); ++i)
+				out[i] = UTF32_XE(out[i]);
+		}
+		return fwrite(out.data(), sizeof(UTF_UC32), out.size(), fp) * sizeof(UTF_UC32);
+	}
+}
+
+static size_t unit_size(FILE_FORMAT format)
+{
+	switch (format)
+	{
+	case FORMAT_UTF8: return sizeof(UTF_UC8);
+	case FORMAT_UTF16: case FORMAT_UTF16XE: return sizeof(UTF_UC16);
+	default: return sizeof(UTF_UC32);
+	}
+}
+
+// workload_char() yields BMP characters only
+static size_t encoded_size(FILE_FORMAT format, UTF_UC32 uc32)
+{
+	if (format == FORMAT_UTF8)
+		return (uc32 < 0x80) ? 1 : (uc32 < 0x800) ? 2 : 3;
+	return unit_size(format);
+}
+
+// streams the file in chunks so that multi-gigabyte files need no memory
+static bool generate_file(const std::string& fname, WORKLOAD workload, FILE_FORMAT format,
+						  unsigned long long bytes)
+{
+	FILE *fp = fopen(fname.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	IO_RNG rng(0x10BE7C40ULL + workload);
+	UTF_US32 chunk;
+	unsigned long long written = 0;
+	size_t column = 0, line = workload_line_length(workload, rng);
+	const size_t unit = unit_size(format);
+	while (written < bytes)
+	{
+		// fill exactly up to the size, ending with a newline
+		unsigned long long remaining = bytes - written, chunk_bytes = 0;
+		chunk.clear();
+		while (chunk.size() < 65536 && chunk_bytes < remaining)
+		{
+			UTF_UC32 uc32;
+			if (remaining - chunk_bytes <= unit)
+			{
+				uc32 = '\n';
+			}
+			else if (column++ == line)
+			{
+				uc32 = '\n';
+				column = 0;
+				line = workload_line_length(workload, rng);
+			}
+			else
+			{
+				uc32 = workload_char(rng);
+				if (encoded_size(format, uc32) + unit > remaining - chunk_bytes)
+					uc32 = 'x';
+			}
+			chunk.push_back(uc32);
+			chunk_bytes += encoded_size(format, uc32);
+		}
+
+		written += write_units(fp, format, chunk);
+		if (ferror(fp))
+			break;
+	}
+
+	bool ok = !ferror(fp);
+	fclose(fp);
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// readers
+
+struct READ_RESULT
+{
+	unsigned long long lines;
+	unsigned long long bytes;
+};
+
+static READ_RESULT read_utf8_fgets(FILE *fp)
+{
+	static UTF_UC8 buf[4096];
+	READ_RESULT result = { 0, 0 };
+	while (UTF8_fgets(buf, 4096, fp))
+	{
+		++result.lines;
+		result.bytes += UTF_uj8_len(buf);
+	}
+	return result;
+}
+
+static READ_RESULT read_libc_fgets(FILE *fp)
+{
+	static char buf[4096];
+	READ_RESULT result = { 0, 0 };
+	while (fgets(buf, 4096, fp))
+	{
+		++result.lines;
+		result.bytes += strlen(buf);
+	}
+	return result;
+}
+
+static READ_RESULT read_utf16_fgets(FILE *fp)
+{
+	static UTF_UC16 buf[4096];
+	READ_RESULT result = { 0, 0 };
+	while (UTF16_fgets(buf, 4096, fp))
+	{
+		++result.lines;
+		result.bytes += UTF_uj16_len(buf) * sizeof(UTF_UC16);
+	}
+	return result;
+}
+
+static READ_RESULT read_template_fgets(FILE *fp)
+{
+	static UTF_UC16 buf[4096];
+	READ_RESULT result = { 0, 0 };
+	while (UTF_fgets(buf, 4096, fp))
+	{
+		++result.lines;
+		result.bytes += UTF_uj16_len(buf) * sizeof(UTF_UC16);
+	}
+	return result;
+}
+
+static READ_RESULT read_utf16_getline(FILE *fp)
+{
+	READ_RESULT result = { 0, 0 };
+	while (UTF_UC16 *line = UTF16_getline(fp))
+	{
+		++result.lines;
+		result.bytes += UTF_uj16_len(line) * sizeof(UTF_UC16);
+		free(line);
+	}
+	return result;
+}
+
+static READ_RESULT read_utf32xe_getline(FILE *fp)
+{
+	READ_RESULT result = { 0, 0 };
+	while (UTF_UC32 *line = UTF32XE_getline(fp))
+	{
+		++result.lines;
+		result.bytes += UTF_uj32_len(line) * sizeof(UTF_UC32);
+		free(line);
+	}
+	return result;
+}
+
+// a bump arena for the *_getline_ex readers, reset after each line: once its
+// block has grown to the longest line, reading takes no more mallocs
+struct IO_ARENA
+{
+	char *block;
+	size_t capacity;
+	size_t top;
+	size_t last;        // offset of the newest allocation
+	std::vector<char *> retired;   // outgrown blocks, freed by reset()
+
+	IO_ARENA() : block(NULL), capacity(0), top(0), last(0)
+	{
+	}
+	~IO_ARENA()
+	{
+		reset();
+		free(block);
+	}
+
+	void reset()
+	{
+		for (size_t i = 0; i < retired.size(); ++i)
+			free(retired[i]);
+		retired.clear();
+		top = last = 0;
+	}
+
+	static size_t align(size_t size)
+	{
+		return (size + 15) & ~size_t(15);
+	}
+
+	static void *allocate(void *user, size_t size)
+	{
+		IO_ARENA *arena = static_cast<IO_ARENA *>(user);
+		size = align(size);
+		if (size > arena->capacity - arena->top)
+		{
+			// the old block still holds live allocations until the reset
+			size_t capacity = arena->capacity * 2;
+			if (capacity < 65536)
+				capacity = 65536;
+			while (capacity < size)
+				capacity *= 2;
+			char *block = static_cast<char *>(malloc(capacity));
+			if (!block)
+				return NULL;
+			if (arena->block)
+				arena->retired.push_back(arena->block);
+			arena->block = block;
+			arena->capacity = capacity;
+			arena->top = 0;
+		}
+		arena->last = arena->top;
+		arena->top += size;
+		return arena->block + arena->last;
+	}
+
+	static void *reallocate(void *user, void *ptr, size_t old_size, size_t new_size)
+	{
+		IO_ARENA *arena = static_cast<IO_ARENA *>(user);
+		// the newest allocation grows in place
+		if (ptr == arena->block + arena->last && align(new_size) <= arena->capacity - arena->last)
+		{
+			arena->top = arena->last + align(new_size);
+			return ptr;
+		}
+		void *fresh = allocate(user, new_size);
+		if (fresh && ptr)
+			memcpy(fresh, ptr, old_size < new_size ? old_size : new_size);
+		return fresh;
+	}
+
+	static void release(void *, void *)
+	{
+	}
+};
+
+template <typename T_CHAR, T_CHAR *(*t_getline)(FILE *, const UTF_ALLOCATOR *, const UTF_ALLOCATOR *)>
+static READ_RESULT read_getline_ex(FILE *fp)
+{
+	IO_ARENA arena;
+	UTF_ALLOCATOR alloc = { IO_ARENA::allocate, IO_ARENA::reallocate, IO_ARENA::release, &arena };
+	READ_RESULT result = { 0, 0 };
+	while (T_CHAR *line = t_getline(fp, &alloc, &alloc))
+	{
+		size_t len = 0;
+		while (line[len])
+			++len;
+		++result.lines;
+		result.bytes += len * sizeof(T_CHAR);
+		arena.reset();
+	}
+	return result;
+}
+
+// reference: large fread() blocks scanned in memory, no seeking back
+template <typename T_CHAR>
+static READ_RESULT read_buffered(FILE *fp)
+{
+	static T_CHAR buf[65536];
+	READ_RESULT result = { 0, 0 };
+	bool pending = false;
+	size_t count;
+	while ((count = fread(buf, sizeof(T_CHAR), 65536, fp)) != 0)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			pending = true;
+			if (buf[i] == T_CHAR('\n'))
+			{
+				++result.lines;
+				pending = false;
+			}
+		}
+		result.bytes += count * sizeof(T_CHAR);
+	}
+	if (pending)
+		++result.lines;
+	return result;
+}
+
+#ifdef UTF_IOBENCH_POSIX
+// reference: the whole file mapped into memory
+template <typename T_CHAR>
+static READ_RESULT read_mmap(const char *fname)
+{
+	READ_RESULT result = { 0, 0 };
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return result;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return result;
+	}
+
+	size_t size = size_t(st.st_size);
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return result;
+
+	const T_CHAR *str = static_cast<const T_CHAR *>(map);
+	size_t count = size / sizeof(T_CHAR);
+	bool pending = false;
+	for (size_t i = 0; i < count; ++i)
+	{
+		pending = true;
+		if (str[i] == T_CHAR('\n'))
+		{
+			++result.lines;
+			pending = false;
+		}
+	}
+	if (pending)
+		++result.lines;
+	result.bytes = count * sizeof(T_CHAR);
+
+	munmap(map, size);
+	return result;
+}
+#endif
+
+struct READER
+{
+	const char *name;
+	FILE_FORMAT format;
+	READ_RESULT (*read_fp)(FILE *fp);
+	READ_RESULT (*read_file)(const char *fname);
+};
+
+static const READER s_readers[] =
+{
+	{ "UTF8_fgets", FORMAT_UTF8, read_utf8_fgets, NULL },
+	{ "UTF16_fgets", FORMAT_UTF16, read_utf16_fgets, NULL },
+	{ "UTF_fgets<UTF_UC16>", FORMAT_UTF16, read_template_fgets, NULL },
+	{ "UTF16_getline", FORMAT_UTF16, read_utf16_getline, NULL },
+	{ "UTF32XE_getline", FORMAT_UTF32XE, read_utf32xe_getline, NULL },
+	{ "UTF16_getline_ex", FORMAT_UTF16, read_getline_ex<UTF_UC16, UTF16_getline_ex>, NULL },
+	{ "UTF16XE_getline_ex", FORMAT_UTF16XE, read_getline_ex<UTF_UC16, UTF16XE_getline_ex>, NULL },
+	{ "UTF32_getline_ex", FORMAT_UTF32, read_getline_ex<UTF_UC32, UTF32_getline_ex>, NULL },
+	{ "UTF32XE_getline_ex", FORMAT_UTF32XE, read_getline_ex<UTF_UC32, UTF32XE_getline_ex>, NULL },
+	{ "libc_fgets", FORMAT_UTF8, read_libc_fgets, NULL },
+	{ "buffered<UTF_UC8>", FORMAT_UTF8, read_buffered<UTF_UC8>, NULL },
+	{ "buffered<UTF_UC16>", FORMAT_UTF16, read_buffered<UTF_UC16>, NULL },
+#ifdef UTF_IOBENCH_POSIX
+	{ "mmap<UTF_UC8>", FORMAT_UTF8, NULL, read_mmap<UTF_UC8> },
+	{ "mmap<UTF_UC16>", FORMAT_UTF16, NULL, read_mmap<UTF_UC16> },
+#endif
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// measurement
+
+struct IO_SNAPSHOT
+{
+	double seconds;
+	double user_seconds;
+	double system_seconds;
+	long inblock;
+	long voluntary_switches;
+	long involuntary_switches;
+	size_t mallocs;
+	size_t reallocs;
+	size_t frees;
+	IO_COUNTERS io;
+};
+
+static void io_snapshot(IO_SNAPSHOT& snap)
+{
+	using namespace std::chrono;
+	snap.seconds = duration<double>(steady_clock::now().time_since_epoch()).count();
+	snap.user_seconds = snap.system_seconds = 0;
+	snap.inblock = snap.voluntary_switches = snap.involuntary_switches = 0;
+#ifdef UTF_IOBENCH_POSIX
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		snap.user_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+		snap.system_seconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+		snap.inblock = usage.ru_inblock;
+		snap.voluntary_switches = usage.ru_nvcsw;
+		snap.involuntary_switches = usage.ru_nivcsw;
+	}
+#endif
+	snap.mallocs = s_malloc_calls;
+	snap.reallocs = s_realloc_calls;
+	snap.frees = s_free_calls;
+	snap.io = s_io;
+}
+
+struct IO_OPTIONS
+{
+	std::vector<unsigned long long> sizes;
+	std::string dir;
+	const char *filter;
+	const char *output;
+	bool keep;
+};
+
+static bool parse_sizes(const char *text, std::vector<unsigned long long>& sizes)
+{
+	sizes.clear();
+	while (*text)
+	{
+		char *end;
+		unsigned long long value = strtoull(text, &end, 10);
+		if (end == text)
+			return false;
+		switch (*end)
+		{
+		case 'k': case 'K': value <<= 10; ++end; break;
+		case 'm': case 'M': value <<= 20; ++end; break;
+		case 'g': case 'G': value <<= 30; ++end; break;
+		}
+		if (*end == ',')
+			++end;
+		else if (*end)
+			return false;
+		sizes.push_back(value);
+		text = end;
+	}
+	return !sizes.empty();
+}
+
+static void usage(void)
+{
+	puts("Usage: utf-iobench [OPTIONS]\n"
+		 "\n"
+		 "Options:\n"
+		 "  --sizes LIST   comma-separated file sizes with K/M/G suffix (default: 1M)\n"
+		 "                 e.g. --sizes 1M,64M,1G,4G\n"
+		 "  --dir DIR      directory of the generated files (default: .)\n"
+		 "  --filter TEXT  run only readers/workloads whose name contains TEXT\n"
+		 "  --output FILE  write JSON results to FILE instead of stdout\n"
+		 "  --keep         keep the generated files\n"
+		 "  --help         show this message");
+}
+
+int main(int argc, char **argv)
+{
+	IO_OPTIONS options;
+	options.sizes.push_back(1024 * 1024);
+	options.dir = ".";
+	options.filter = NULL;
+	options.output = NULL;
+	options.keep = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+		{
+			usage();
+			return EXIT_SUCCESS;
+		}
+		if (arg == "--keep")
+		{
+			options.keep = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "utf-iobench: invalid argument '%s'\n", argv[i]);
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		if (arg == "--sizes")
+		{
+			if (!parse_sizes(argv[++i], options.sizes))
+			{
+				fprintf(stderr, "utf-iobench: invalid sizes '%s'\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--dir")
+			options.dir = argv[++i];
+		else if (arg == "--filter")
+			options.filter = argv[++i];
+		else if (arg == "--output")
+			options.output = argv[++i];
+		else
+		{
+			fprintf(stderr, "utf-iobench: invalid argument '%s'\n", argv[i]);
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	FILE *out = stdout;
+	if (options.output && !(out = fopen(options.output, "w")))
+	{
+		fprintf(stderr, "utf-iobench: cannot open '%s'\n", options.output);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "{\n");
+#ifdef UTF_IOBENCH_SYSCALL_COUNT
+	fprintf(out, "  \"syscall_counters\": true,\n");
+#else
+	fprintf(out, "  \"syscall_counters\": false,\n");
+#endif
+#ifdef UTF_IOBENCH_MALLOC_COUNT
+	fprintf(out, "  \"malloc_counters\": true,\n");
+#else
+	fprintf(out, "  \"malloc_counters\": false,\n");
+#endif
+	fprintf(out, "  \"results\": [");
+
+	bool first = true, ok = true;
+	const size_t num_readers = sizeof(s_readers) / sizeof(s_readers[0]);
+	for (size_t isize = 0; isize < options.sizes.size() && ok; ++isize)
+	{
+		for (int workload = WORKLOAD_LOG; workload <= WORKLOAD_GIANT && ok; ++workload)
+		{
+			std::string fnames[FORMAT_UTF32XE + 1];
+			for (int format = FORMAT_UTF8; format <= FORMAT_UTF32XE; ++format)
+			{
+				char name[128];
+				sprintf(name, "/utf-iobench-%s-%llu.%s", s_workload_names[workload],
+						options.sizes[isize], s_format_names[format]);
+				fnames[format] = options.dir + name;
+			}
+
+			for (size_t ireader = 0; ireader < num_readers; ++ireader)
+			{
+				const READER& reader = s_readers[ireader];
+				std::string full = std::string(reader.name) + "/" + s_workload_names[workload];
+				if (options.filter && full.find(options.filter) == std::string::npos)
+					continue;
+
+				const std::string& fname = fnames[reader.format];
+				FILE *check = fopen(fname.c_str(), "rb");
+				if (check)
+					fclose(check);
+				else if (!generate_file(fname, WORKLOAD(workload), reader.format, options.sizes[isize]))
+				{
+					fprintf(stderr, "utf-iobench: cannot write '%s'\n", fname.c_str());
+					ok = false;
+					break;
+				}
+
+				IO_SNAPSHOT before, after;
+				READ_RESULT result = { 0, 0 };
+				if (reader.read_fp)
+				{
+					FILE *fp = io_open(fname.c_str());
+					if (!fp)
+					{
+						fprintf(stderr, "utf-iobench: cannot open '%s'\n", fname.c_str());
+						ok = false;
+						break;
+					}
+					io_snapshot(before);
+					result = reader.read_fp(fp);
+					io_snapshot(after);
+					fclose(fp);
+				}
+				else
+				{
+					io_snapshot(before);
+					result = reader.read_file(fname.c_str());
+					io_snapshot(after);
+				}
+
+				double seconds = after.seconds - before.seconds;
+				if (seconds <= 0)
+					seconds = 1e-9;
+
+				fprintf(stderr, "%-32s %10llu bytes %10.1f MB/s %12.0f lines/s\n", full.c_str(),
+						result.bytes, result.bytes / seconds / 1e6, result.lines / seconds);
+
+				fprintf(out, "%s\n    {\"reader\": \"%s\", \"workload\": \"%s\", ",
+						first ? "" : ",", reader.name, s_workload_names[workload]);
+				fprintf(out, "\"file_bytes\": %llu, \"lines\": %llu, \"bytes\": %llu, ",
+						options.sizes[isize], result.lines, result.bytes);
+				fprintf(out, "\"seconds\": %.6f, \"user_seconds\": %.6f, \"system_seconds\": %.6f, ",
+						seconds, after.user_seconds - before.user_seconds,
+						after.system_seconds - before.system_seconds);
+				fprintf(out, "\"lines_per_second\": %.1f, \"bytes_per_second\": %.1f, ",
+						result.lines / seconds, result.bytes / seconds);
+				fprintf(out, "\"read_calls\": %lu, \"seek_calls\": %lu, ",
+						(unsigned long)(after.io.reads - before.io.reads),
+						(unsigned long)(after.io.seeks - before.io.seeks));
+				fprintf(out, "\"inblock\": %ld, \"voluntary_switches\": %ld, \"involuntary_switches\": %ld, ",
+						after.inblock - before.inblock,
+						after.voluntary_switches - before.voluntary_switches,
+						after.involuntary_switches - before.involuntary_switches);
+				fprintf(out, "\"malloc_calls\": %lu, \"realloc_calls\": %lu, \"free_calls\": %lu}",
+						(unsigned long)(after.mallocs - before.mallocs),
+						(unsigned long)(after.reallocs - before.reallocs),
+						(unsigned long)(after.frees - before.frees));
+				first = false;
+			}
+
+			if (!options.keep)
+			{
+				for (int format = FORMAT_UTF8; format <= FORMAT_UTF32XE; ++format)
+					remove(fnames[format].c_str());
+			}
+		}
+	}
+
+	fprintf(out, "\n  ]\n");
+	fprintf(out, "}\n");
+	if (out != stdout)
+		fclose(out);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,8 +2,17 @@
  * Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
  */
 #define _CRT_SECURE_NO_WARNINGS
+#define UTF_TRACE_HISTOGRAM
+#define UTF_TRACE_DEFINE_HISTOGRAM
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
 #include "utf.hpp"
+#include "utf_compact.hpp"
+#include "utf_cached.hpp"
+#include "utf_intern.hpp"
+#include "utf_offsets.hpp"
 
 int g_failures = 0;
 
@@ -141,6 +150,1161 @@ void UTF_fgets_test2(const char *fname)
 	fclose(fp);
 }
 
+void UTF_stats_test(void)
+{
+	UTF_STATS stats;
+	UTF_UC16 buf16[64];
+	UTF_UC8 buf8[64];
+	UTF_UC32 buf32[64];
+
+	// "zß水𝄋" and "A\xC3(B" fed into the same statistics
+	const UTF_S8 s8 = UTF_u8("z\u00df\u6c34\U0001d10b");
+	UTF_stats_init(&stats);
+	UTF_test(__LINE__, UTF_uj8_to_uj16_ex(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(),
+										  buf16, 64, &stats) == UTF_SUCCESS);
+	UTF_test(__LINE__, UTF_uj8_to_uj16_ex(reinterpret_cast<const UTF_UC8 *>("A\xC3(B"), 4,
+										  buf16, 64, &stats) == UTF_SUCCESS);
+	UTF_test(__LINE__, UTF_uj16_cmp(buf16, UTF_u("A?B")) == 0);
+	UTF_test(__LINE__, stats.units == 14 && stats.bytes == 14);
+	UTF_test(__LINE__, stats.code_points == 6);
+	UTF_test(__LINE__, stats.sequences[0] == 3 && stats.sequences[1] == 1);
+	UTF_test(__LINE__, stats.sequences[2] == 1 && stats.sequences[3] == 1);
+	UTF_test(__LINE__, stats.surrogate_pairs == 1);
+	UTF_test(__LINE__, stats.errors == 1 && stats.replacements == 1);
+	UTF_test(__LINE__, stats.first_error == 11 && stats.last_error == 11);
+	UTF_test(__LINE__, UTF_stats_ascii_ratio(&stats) == 0.5);
+
+	// a lone high surrogate and an out-of-range code point
+	const UTF_UC16 s16[] = { 'a', 0xD800, 'b', 0xD834, 0xDD0B };
+	UTF_stats_init(&stats);
+	UTF_test(__LINE__, UTF_uj16_to_uj8_ex(s16, 5, buf8, 64, &stats) == UTF_SUCCESS);
+	UTF_test(__LINE__, UTF_uj8_cmp(buf8, reinterpret_cast<const UTF_UC8 *>("a?\xF0\x9D\x84\x8B")) == 0);
+	UTF_test(__LINE__, stats.units == 5 && stats.bytes == 5 * sizeof(UTF_UC16));
+	UTF_test(__LINE__, stats.errors == 1 && stats.first_error == 1);
+	UTF_test(__LINE__, stats.surrogate_pairs == 1);
+
+	const UTF_UC32 s32[] = { 0x110000, 'x', 0x10FFFF, 0xFFFFFFFF };
+	UTF_stats_init(&stats);
+	UTF_test(__LINE__, UTF_uj32_to_uj16_ex(s32, 4, buf16, 64, &stats) == UTF_SUCCESS);
+	UTF_test(__LINE__, stats.errors == 2 && stats.replacements == 2);
+	UTF_test(__LINE__, stats.first_error == 0 && stats.last_error == 3);
+	UTF_test(__LINE__, stats.code_points == 2 && stats.surrogate_pairs == 1);
+
+	// no error
+	UTF_stats_init(&stats);
+	UTF_test(__LINE__, UTF_uj16_to_uj32_ex(s16 + 3, 2, buf32, 64, &stats) == UTF_SUCCESS);
+	UTF_test(__LINE__, buf32[0] == 0x1D10B && buf32[1] == 0);
+	UTF_test(__LINE__, stats.errors == 0 && stats.first_error == UTF_STATS_NO_ERROR);
+
+	// aggregation
+	UTF_atomic_stats total;
+	UTF_STATS other;
+	UTF_stats_init(&other);
+	other.units = 7;
+	other.errors = 1;
+	other.first_error = other.last_error = 5;
+	total.add(stats);
+	total.add(other);
+	total.load(stats);
+	UTF_test(__LINE__, stats.units == 9 && stats.errors == 1);
+	UTF_test(__LINE__, stats.first_error == 5 && stats.last_error == 5);
+}
+
+template <typename UT>
+void UTF_getline_test_one(int line, UT *(*getline_fn)(FILE *), bool swap)
+{
+	// a line longer than UTF_GETLINE_CHUNK_BYTES, a CRLF line and an unterminated line
+	std::basic_string<UT> long_line(UTF_GETLINE_CHUNK_BYTES * 3 / sizeof(UT) + 7, UT('x'));
+	std::basic_string<UT> data = long_line;
+	data += UT('\n');
+	data += UT('a');
+	data += UT('\r');
+	data += UT('\n');
+	data += UT('b');
+
+	FILE *fp = tmpfile();
+	if (!fp)
+	{
+		UTF_test(line, fp != NULL);
+		return;
+	}
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		UT ch = data[i];
+		if (swap)
+		{
+			UT swapped = 0;
+			for (size_t k = 0; k < sizeof(UT); ++k)
+			{
+				swapped = UT((swapped << 8) | (ch & 0xFF));
+				ch = UT(ch >> 8);
+			}
+			ch = swapped;
+		}
+		fwrite(&ch, sizeof(ch), 1, fp);
+	}
+	rewind(fp);
+
+	UT *str = getline_fn(fp);
+	UTF_test(line, str && str == long_line + UT('\n'));
+	free(str);
+	str = getline_fn(fp);
+	UTF_test(line, str && str[0] == 'a' && str[1] == '\n' && str[2] == 0);
+	free(str);
+	str = getline_fn(fp);
+	UTF_test(line, str && str[0] == 'b' && str[1] == 0);
+	free(str);
+	UTF_test(line, getline_fn(fp) == NULL);
+
+	fclose(fp);
+}
+
+void UTF_getline_test(void)
+{
+	UTF_getline_test_one<UTF_UC16>(__LINE__, UTF16_getline, false);
+	UTF_getline_test_one<UTF_UC16>(__LINE__, UTF16XE_getline, true);
+	UTF_getline_test_one<UTF_UC32>(__LINE__, UTF32_getline, false);
+	UTF_getline_test_one<UTF_UC32>(__LINE__, UTF32XE_getline, true);
+}
+
+// a bump allocator that counts its calls
+struct UTF_test_arena
+{
+	std::vector<char> buf;
+	size_t used;
+	int allocs, reallocs, releases;
+};
+
+static void *UTF_test_arena_allocate(void *user, size_t size)
+{
+	UTF_test_arena *arena = static_cast<UTF_test_arena *>(user);
+	size = (size + 7) & ~size_t(7);
+	if (arena->buf.size() - arena->used < size)
+		return NULL;
+	++arena->allocs;
+	arena->used += size;
+	return &arena->buf[arena->used - size];
+}
+
+static void *UTF_test_arena_reallocate(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+	void *p = UTF_test_arena_allocate(user, new_size);
+	if (p)
+	{
+		memcpy(p, ptr, old_size);
+		++static_cast<UTF_test_arena *>(user)->reallocs;
+	}
+	return p;
+}
+
+static void UTF_test_arena_release(void *user, void *)
+{
+	++static_cast<UTF_test_arena *>(user)->releases;
+}
+
+void UTF_getline_ex_test(void)
+{
+	UTF_test_arena lines, chunks;
+	lines.buf.resize(1 << 16);
+	chunks.buf.resize(1 << 16);
+	lines.used = chunks.used = 0;
+	lines.allocs = lines.reallocs = lines.releases = 0;
+	chunks.allocs = chunks.reallocs = chunks.releases = 0;
+	UTF_ALLOCATOR out = { UTF_test_arena_allocate, UTF_test_arena_reallocate, UTF_test_arena_release, &lines };
+	UTF_ALLOCATOR scratch = { UTF_test_arena_allocate, UTF_test_arena_reallocate, UTF_test_arena_release, &chunks };
+
+	FILE *fp = tmpfile();
+	if (!fp)
+	{
+		UTF_test(__LINE__, fp != NULL);
+		return;
+	}
+	const UTF_US32 data(5000, UTF_UC32('x'));  // three chunks
+	fwrite(data.data(), sizeof(UTF_UC32), data.size(), fp);
+	fwrite(UTF_U("\nab"), sizeof(UTF_UC32), 3, fp);
+	rewind(fp);
+
+	UTF_UC32 *str = UTF32_getline_ex(fp, &out, &scratch);
+	UTF_test(__LINE__, str && str == data + UTF_U("\n"));
+	str = UTF32_getline_ex(fp, &out, NULL);
+	UTF_test(__LINE__, str && str == UTF_US32(UTF_U("ab")));
+	UTF_test(__LINE__, UTF32_getline_ex(fp, &out, &scratch) == NULL);
+	fclose(fp);
+
+	// the lines never touched the heap, and each chunk went back to scratch
+	UTF_test(__LINE__, lines.allocs == 3 && lines.reallocs == 1 && lines.releases == 0);
+	UTF_test(__LINE__, chunks.allocs == 1 && chunks.releases == 1);
+}
+
+void UTF_trace_test(void)
+{
+	UTF_UC16 buf16[64];
+
+	UTF_test(__LINE__, UTF_trace_size_bucket(0) == 0 && UTF_trace_size_bucket(3) == 1);
+	UTF_test(__LINE__, UTF_trace_size_bucket(4) == 2 && UTF_trace_size_bucket(~0ULL) == UTF_TRACE_SIZE_BUCKETS - 1);
+	for (int bucket = 1; bucket < UTF_TRACE_LATENCY_BUCKETS; ++bucket)
+	{
+		uint64_t lower = UTF_trace_latency_lower(bucket);
+		if (!UTF_test(__LINE__, UTF_trace_latency_bucket(lower) == bucket &&
+								UTF_trace_latency_bucket(lower - 1) == bucket - 1))
+			break;
+	}
+
+	UTF_trace_reset();
+	UTF_test(__LINE__, UTF_trace_percentile(UTF_TRACE_ID_uj8_to_uj16, -1, 0.5) == 0);
+	for (int i = 0; i < 10; ++i)
+		UTF_uj8_to_uj16(reinterpret_cast<const UTF_UC8 *>("TEST"), 4, buf16, 64);
+
+	uint64_t total = 0;
+	for (int l = 0; l < UTF_TRACE_LATENCY_BUCKETS; ++l)
+		total += UTF_trace_count(UTF_TRACE_ID_uj8_to_uj16, UTF_trace_size_bucket(4), l);
+	UTF_test(__LINE__, total == 10);
+	UTF_test(__LINE__, UTF_trace_percentile(UTF_TRACE_ID_uj8_to_uj16, -1, 0.5) > 0);
+	UTF_test(__LINE__, UTF_trace_percentile(UTF_TRACE_ID_uj8_to_uj16, -1, 0.5) <=
+					   UTF_trace_percentile(UTF_TRACE_ID_uj8_to_uj16, -1, 0.99));
+	UTF_test(__LINE__, UTF_trace_percentile(UTF_TRACE_ID_uj16_to_uj8, -1, 0.5) == 0);
+	UTF_test(__LINE__, strcmp(UTF_trace_name(UTF_TRACE_ID_UTF32XE_getline), "UTF32XE_getline") == 0);
+}
+
+void UTF_count_cp_test(void)
+{
+	const UTF_S8 s8 = UTF_u8("z\u00df\u6c34\U0001d10b");
+	const UTF_US16 us16 = UTF_u("z\u00df\u6c34\U0001d10b");
+	UTF_test(__LINE__, UTF_count_cp(s8) == 4 && UTF_count_cp(us16) == 4);
+	UTF_test(__LINE__, UTF_uj8_count_cp_z(reinterpret_cast<const UTF_UC8 *>(s8.c_str())) == 4);
+	UTF_test(__LINE__, UTF_uj16_count_cp_z(us16.c_str()) == 4);
+	UTF_test(__LINE__, UTF_uj8_cp_offset(reinterpret_cast<const UTF_UC8 *>(s8.c_str()), s8.size(), 3) == 6);
+	UTF_test(__LINE__, UTF_uj8_cp_offset(reinterpret_cast<const UTF_UC8 *>(s8.c_str()), s8.size(), 4) == s8.size());
+	UTF_test(__LINE__, UTF_uj16_cp_offset(us16.c_str(), us16.size(), 3) == 3);
+	UTF_test(__LINE__, UTF_uj16_cp_offset(us16.c_str(), us16.size(), 4) == us16.size());
+
+	// the vector and word paths against a plain loop, at every alignment
+	UTF_UC8 buf8[600];
+	UTF_UC16 buf16[600];
+	uint32_t seed = 12345;
+	for (size_t i = 0; i < 600; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		buf8[i] = UTF_UC8(seed >> 24);
+		buf16[i] = UTF_UC16((seed >> 8) & 0xFFFF);
+		if (i % 3 == 0)
+			buf16[i] = UTF_UC16(0xDC00 | (seed >> 22));
+	}
+	for (size_t start = 0; start < 16; ++start)
+	{
+		for (size_t size = 0; start + size <= 600; size += 1 + size / 4)
+		{
+			size_t count8 = 0, count16 = 0;
+			for (size_t i = start; i < start + size; ++i)
+			{
+				count8 += (buf8[i] & 0xC0) != 0x80;
+				count16 += (buf16[i] & 0xFC00) != 0xDC00;
+			}
+			if (!UTF_test(__LINE__, UTF_uj8_count_cp(buf8 + start, size) == count8) ||
+				!UTF_test(__LINE__, UTF_uj16_count_cp(buf16 + start, size) == count16))
+			{
+				return;
+			}
+
+			size_t offset8 = UTF_uj8_cp_offset(buf8 + start, size, count8 / 2);
+			size_t offset16 = UTF_uj16_cp_offset(buf16 + start, size, count16 / 2);
+			if (!UTF_test(__LINE__, UTF_uj8_count_cp(buf8 + start, offset8) == count8 / 2) ||
+				!UTF_test(__LINE__, offset8 == size || (buf8[start + offset8] & 0xC0) != 0x80) ||
+				!UTF_test(__LINE__, UTF_uj16_count_cp(buf16 + start, offset16) == count16 / 2) ||
+				!UTF_test(__LINE__, offset16 == size || (buf16[start + offset16] & 0xFC00) != 0xDC00))
+			{
+				return;
+			}
+		}
+	}
+}
+
+void UTF_len_test(void)
+{
+	// every start and length around the 16-byte blocks of the vector scan
+	UTF_UC8 buf8[80];
+	UTF_UC16 buf16[80];
+	UTF_UC32 buf32[80];
+	for (size_t start = 0; start < 16; ++start)
+	{
+		for (size_t len = 0; start + len < 80; ++len)
+		{
+			for (size_t i = 0; i < 80; ++i)
+			{
+				buf8[i] = UTF_UC8(0x80 | i);
+				buf16[i] = UTF_UC16(0xFF00 | i);
+				buf32[i] = UTF_UC32(0x10000 | i);
+			}
+			buf8[start + len] = 0;
+			buf16[start + len] = 0;
+			buf32[start + len] = 0;
+			if (!UTF_test(__LINE__, UTF_uj8_len(buf8 + start) == len) ||
+				!UTF_test(__LINE__, UTF_j8_len(reinterpret_cast<const UTF_C8 *>(buf8 + start)) == len) ||
+				!UTF_test(__LINE__, UTF_uj16_len(buf16 + start) == len) ||
+				!UTF_test(__LINE__, UTF_uj32_len(buf32 + start) == len))
+			{
+				return;
+			}
+		}
+	}
+}
+
+template <typename T>
+int UTF_cmp_reference(const T *a, const T *b, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		if (a[i] != b[i])
+			return (a[i] < b[i]) ? -1 : 1;
+		if (!a[i])
+			break;
+	}
+	return 0;
+}
+
+void UTF_cmp_test(void)
+{
+	UTF_test(__LINE__, UTF_j8_cmp("\x80", "a") < 0 || char(0x80) > 0);
+	UTF_test(__LINE__, UTF_uj8_cmp(reinterpret_cast<const UTF_UC8 *>("\x80"),
+								   reinterpret_cast<const UTF_UC8 *>("a")) > 0);
+	UTF_test(__LINE__, UTF_uj16_cmpn(UTF_u("ab"), UTF_u("abc"), 2) == 0);
+	UTF_test(__LINE__, UTF_uj16_cmpn(UTF_u("ab"), UTF_u("abc"), 3) < 0);
+	UTF_test(__LINE__, UTF_cmpn(UTF_U("abd"), UTF_U("abc"), 3) > 0);
+
+	// U+FF61 sorts before U+1D10B by code point but after it by code unit
+	UTF_test(__LINE__, UTF_uj16_cmp(UTF_u("a\uff61"), UTF_u("a\U0001d10b")) > 0);
+	UTF_test(__LINE__, UTF_uj16_cmp_cp(UTF_u("a\uff61"), UTF_u("a\U0001d10b")) < 0);
+	UTF_test(__LINE__, UTF_uj16_cmpn_cp(UTF_u("a\uff61"), UTF_u("a\U0001d10b"), 2) < 0);
+	UTF_test(__LINE__, UTF_uj16_cmp_cp(UTF_u("\ud7ff"), UTF_u("\U00010000")) < 0);
+	UTF_test(__LINE__, UTF_uj16_cmp_cp(UTF_u("\U0010ffff"), UTF_u("\U00010000")) > 0);
+	UTF_test(__LINE__, UTF_uj8_cmp(reinterpret_cast<const UTF_UC8 *>(UTF_u8("a\uff61")),
+								   reinterpret_cast<const UTF_UC8 *>(UTF_u8("a\U0001d10b"))) < 0);
+
+	// strings differing at every position around the vector blocks
+	UTF_UC8 a8[72], b8[72];
+	UTF_UC16 a16[72], b16[72];
+	UTF_UC32 a32[72], b32[72];
+	for (size_t len = 0; len < 64; ++len)
+	{
+		for (size_t diff = 0; diff <= len + 1 && diff < 70; ++diff)
+		{
+			for (size_t i = 0; i < 72; ++i)
+			{
+				a8[i] = b8[i] = UTF_UC8(i < len ? 'A' + i % 26 : 0);
+				a16[i] = b16[i] = UTF_UC16(i < len ? 0xD800 + i : 0);
+				a32[i] = b32[i] = UTF_UC32(i < len ? 0x10000 + i : 0);
+			}
+			b8[diff] = UTF_UC8(b8[diff] + 0x81);
+			b16[diff] = UTF_UC16(b16[diff] + 0x8001);
+			b32[diff] = UTF_UC32(b32[diff] + 0x80000001);
+			for (size_t n = 0; n < 70; n += 1 + n / 8)
+			{
+				if (!UTF_test(__LINE__, UTF_uj8_cmpn(a8, b8, n) == UTF_cmp_reference(a8, b8, n)) ||
+					!UTF_test(__LINE__, UTF_j8_cmpn(reinterpret_cast<const UTF_C8 *>(a8),
+													reinterpret_cast<const UTF_C8 *>(b8), n) ==
+										UTF_cmp_reference(reinterpret_cast<const UTF_C8 *>(a8),
+														  reinterpret_cast<const UTF_C8 *>(b8), n)) ||
+					!UTF_test(__LINE__, UTF_uj16_cmpn(a16, b16, n) == UTF_cmp_reference(a16, b16, n)) ||
+					!UTF_test(__LINE__, UTF_uj32_cmpn(a32 + 1, b32 + 1, n) == UTF_cmp_reference(a32 + 1, b32 + 1, n)))
+				{
+					return;
+				}
+			}
+			if (!UTF_test(__LINE__, UTF_uj8_cmp(a8, b8) == UTF_cmp_reference(a8, b8, 72)) ||
+				!UTF_test(__LINE__, UTF_uj16_cmp(a16 + 1, b16 + 1) == UTF_cmp_reference(a16 + 1, b16 + 1, 71)) ||
+				!UTF_test(__LINE__, UTF_uj32_cmp(b32, a32) == UTF_cmp_reference(b32, a32, 72)) ||
+				!UTF_test(__LINE__, UTF_cmp(a16, b16) == UTF_cmp_reference(a16, b16, 72)))
+			{
+				return;
+			}
+		}
+	}
+}
+
+void UTF_cmp_len_test(void)
+{
+	UTF_SIZE_T mismatch = 99;
+	const UTF_UC16 a16[] = { 'a', 0, 'b', 'c' };
+	const UTF_UC16 b16[] = { 'a', 0, 'b', 'd' };
+	UTF_test(__LINE__, UTF_uj16_cmp_len(a16, 4, b16, 4, &mismatch) < 0 && mismatch == 3);
+	UTF_test(__LINE__, UTF_uj16_cmp_len(a16, 3, b16, 4, &mismatch) < 0 && mismatch == 3);
+	UTF_test(__LINE__, UTF_uj16_cmp_len(a16, 3, b16, 3, &mismatch) == 0 && mismatch == 3);
+	UTF_test(__LINE__, UTF_uj16_cmp_len(b16, 4, a16, 2, NULL) > 0);
+	UTF_test(__LINE__, UTF_uj16_equal(a16, 3, b16, 3) && !UTF_uj16_equal(a16, 4, b16, 4));
+	UTF_test(__LINE__, !UTF_uj16_equal(a16, 2, b16, 3));
+	UTF_test(__LINE__, UTF_uj16_has_prefix(a16, 4, b16, 3) && !UTF_uj16_has_prefix(a16, 2, b16, 3));
+	UTF_test(__LINE__, UTF_j8_cmp_len("\x80", 1, "a", 1, NULL) < 0 || char(0x80) > 0);
+	UTF_test(__LINE__, UTF_uj8_cmp_len(reinterpret_cast<const UTF_UC8 *>("\x80"), 1,
+									   reinterpret_cast<const UTF_UC8 *>("a"), 1, NULL) > 0);
+
+	// a difference at every position, for every width
+	UTF_UC8 a8[80], b8[80];
+	UTF_UC32 a32[80], b32[80];
+	for (size_t diff = 0; diff < 80; ++diff)
+	{
+		for (size_t i = 0; i < 80; ++i)
+		{
+			a8[i] = b8[i] = UTF_UC8(i % 3);
+			a32[i] = b32[i] = UTF_UC32(i % 5);
+		}
+		b8[diff] = 0xFF;
+		a32[diff] = 0xFFFFFFFF;
+		if (!UTF_test(__LINE__, UTF_uj8_cmp_len(a8, 80, b8, 80, &mismatch) < 0 && mismatch == diff) ||
+			!UTF_test(__LINE__, UTF_uj32_cmp_len(a32, 80, b32, 80, &mismatch) > 0 && mismatch == diff) ||
+			!UTF_test(__LINE__, UTF_cmp_len(a32 + 1, 79, b32 + 1, 79) == (diff ? 1 : 0)) ||
+			!UTF_test(__LINE__, UTF_uj8_has_prefix(a8, 80, b8, diff) && !UTF_uj8_has_prefix(a8, 80, b8, diff + 1)))
+		{
+			return;
+		}
+	}
+	UTF_test(__LINE__, UTF_cmp_len(UTF_S8("ab\0c", 4), UTF_S8("ab\0d", 4), &mismatch) < 0 && mismatch == 3);
+	UTF_test(__LINE__, UTF_has_prefix(UTF_US16(UTF_u("prefix")), UTF_US16(UTF_u("pre"))));
+	UTF_test(__LINE__, UTF_equal(UTF_u("ab"), 2, UTF_u("ab"), 2));
+}
+
+void UTF_cmp_cross_test(void)
+{
+	const UTF_S8 s8 = UTF_u8("The quick brown fox: z\u00df\u6c34\U0001d10b and \uff61 then more ASCII text");
+	UTF_US16 us16;
+	UTF_US32 us32;
+	UTF_u8_to_u(s8, us16);
+	UTF_u8_to_U(s8, us32);
+	UTF_test(__LINE__, UTF_cmp_u8_u16(s8, us16) == 0 && UTF_equal_u8_u16(s8, us16));
+	UTF_test(__LINE__, UTF_cmp_u8_u32(s8, us32) == 0 && UTF_equal_u8_u32(s8, us32));
+	UTF_test(__LINE__, UTF_cmp_u16_u32(us16, us32) == 0 && UTF_equal_u16_u32(us16, us32));
+
+	// change each code point up and down; the order must follow UTF-32
+	for (size_t i = 0; i < us32.size(); ++i)
+	{
+		for (int delta = -1; delta <= 1; delta += 2)
+		{
+			UTF_US32 other32 = us32;
+			other32[i] = UTF_UC32(other32[i] + delta);
+			if (other32[i] >= 0xD800 && other32[i] < 0xE000)
+				continue;
+			UTF_US16 other16;
+			UTF_S8 other8;
+			UTF_U_to_u(other32, other16);
+			UTF_U_to_u8(other32, other8);
+			int expected = -delta;
+			if (!UTF_test(__LINE__, UTF_cmp_u8_u16(s8, other16) == expected) ||
+				!UTF_test(__LINE__, UTF_cmp_u8_u16(other8, us16) == -expected) ||
+				!UTF_test(__LINE__, UTF_cmp_u8_u32(s8, other32) == expected) ||
+				!UTF_test(__LINE__, UTF_cmp_u16_u32(us16, other32) == expected) ||
+				!UTF_test(__LINE__, UTF_cmp_u16_u32(other16, us32) == -expected))
+			{
+				return;
+			}
+		}
+	}
+
+	// prefixes
+	UTF_test(__LINE__, UTF_cmp_u8_u16(s8.substr(0, 20), us16) < 0);
+	UTF_test(__LINE__, UTF_cmp_u8_u32(s8, us32.substr(0, 30)) > 0);
+	UTF_test(__LINE__, UTF_cmp_u16_u32(us16.substr(0, 0), us32.substr(0, 0)) == 0);
+
+	// ill-formed input compares as the replacement character
+	UTF_test(__LINE__, UTF_cmp_u8_u16(UTF_S8("A\xC3(B"), UTF_US16(UTF_u("A?B"))) == 0);
+	UTF_test(__LINE__, UTF_cmp_u8_u32(UTF_S8("\xE2\x28\xA1"), UTF_US32(UTF_U("?"))) == 0);
+	UTF_test(__LINE__, UTF_cmp_u16_u32(UTF_US16(1, 0xD800) + UTF_u("A"), UTF_US32(UTF_U("?"))) == 0);
+	UTF_test(__LINE__, UTF_cmp_u8_u32(UTF_S8("x"), UTF_US32(1, 0x110000)) == UTF_cmp_u8_u32(UTF_S8("x"), UTF_US32(UTF_U("?"))));
+}
+
+void UTF_hash_test(void)
+{
+	const UTF_S8 s8 = UTF_u8("Hash me: z\u00df\u6c34\U0001d10b, then some more ASCII text to reach the fast path");
+	UTF_US16 us16;
+	UTF_US32 us32;
+	UTF_u8_to_u(s8, us16);
+	UTF_u8_to_U(s8, us32);
+	UTF_hash hash;
+	UTF_equal_to equal_to;
+	UTF_test(__LINE__, hash(s8) == hash(us16) && hash(s8) == hash(us32));
+	UTF_test(__LINE__, hash(UTF_US8(s8.begin(), s8.end())) == hash(us32));
+	UTF_test(__LINE__, equal_to(s8, us16) && equal_to(us32, s8) && equal_to(us16, us32));
+	UTF_test(__LINE__, !equal_to(s8, us16.substr(1)) && equal_to(s8, s8));
+	UTF_test(__LINE__, hash(UTF_S8("A\xC3(B")) == hash(UTF_US16(UTF_u("A?B"))));
+
+	// every prefix, in pieces, with another seed
+	for (size_t n = 0; n <= us32.size(); ++n)
+	{
+		UTF_US32 part32 = us32.substr(0, n);
+		UTF_US16 part16;
+		UTF_S8 part8;
+		UTF_U_to_u(part32, part16);
+		UTF_U_to_u8(part32, part8);
+		UTF_HASH state;
+		UTF_hash_init(&state, 42);
+		size_t half = UTF_uj16_cp_offset(part16.data(), part16.size(), n / 2);
+		UTF_hash_uj16(&state, part16.data(), half);
+		UTF_hash_uj16(&state, part16.data() + half, part16.size() - half);
+		uint64_t h32 = UTF_uj32_hash(part32.data(), part32.size(), 42);
+		if (!UTF_test(__LINE__, UTF_uj8_hash(reinterpret_cast<const UTF_UC8 *>(part8.data()), part8.size(), 42) == h32) ||
+			!UTF_test(__LINE__, UTF_hash_final(&state) == h32) ||
+			!UTF_test(__LINE__, n == 0 || h32 != UTF_uj32_hash(part32.data(), n - 1, 42)) ||
+			!UTF_test(__LINE__, h32 != UTF_uj32_hash(part32.data(), part32.size(), 43)))
+		{
+			return;
+		}
+	}
+
+	std::unordered_map<UTF_S8, int, UTF_hash, UTF_equal_to> map;
+	map[s8] = 1;
+	map["x"] = 2;
+	UTF_test(__LINE__, map.count(s8) == 1 && map.size() == 2);
+#if defined(__cpp_lib_generic_unordered_lookup)
+	UTF_test(__LINE__, map.find(us16) != map.end() && map.find(us16)->second == 1);
+	UTF_test(__LINE__, map.find(UTF_US32(UTF_U("x")))->second == 2);
+#endif
+}
+
+template <typename T_VIEW>
+bool UTF_cp_iterator_check(int line, const T_VIEW& view)
+{
+	// stepping backward must visit the positions stepping forward did
+	std::vector<typename T_VIEW::iterator> forward;
+	for (typename T_VIEW::iterator it = view.begin(); it != view.end(); ++it)
+		forward.push_back(it);
+	typename T_VIEW::iterator it = view.end();
+	for (size_t i = forward.size(); i-- > 0; )
+	{
+		--it;
+		if (!UTF_test(line, it == forward[i] && *it == *forward[i]))
+			return false;
+	}
+	return UTF_test(line, it == view.begin());
+}
+
+void UTF_cp_iterator_test(void)
+{
+	const UTF_S8 s8 = UTF_u8("Walk z\u00df\u6c34\U0001d10b and \uff61 too");
+	UTF_US16 us16;
+	UTF_US32 us32;
+	UTF_u8_to_u(s8, us16);
+	UTF_u8_to_U(s8, us32);
+
+	UTF_cp_view<char> view8 = UTF_u8_cps(s8);
+	UTF_cp_view<UTF_US16::value_type> view16 = UTF_u_cps(us16);
+	UTF_test(__LINE__, UTF_US32(view8.begin(), view8.end()) == us32);
+	UTF_test(__LINE__, UTF_US32(view16.begin(), view16.end()) == us32);
+	UTF_test(__LINE__, UTF_US32(view8.rbegin(), view8.rend()) == UTF_US32(us32.rbegin(), us32.rend()));
+	UTF_test(__LINE__, UTF_US32(view16.rbegin(), view16.rend()) == UTF_US32(us32.rbegin(), us32.rend()));
+	UTF_test(__LINE__, size_t(std::distance(view8.begin(), view8.end())) == us32.size());
+	UTF_test(__LINE__, std::find(view8.begin(), view8.end(), 0x6c34).base() == s8.data() + 8);
+	UTF_test(__LINE__, std::find(view16.begin(), view16.end(), 0x1d10b).base() == us16.data() + 8);
+	const UTF_S8 empty8;
+	UTF_test(__LINE__, UTF_u8_cps(empty8).empty() && UTF_u8_cps(empty8).begin() == UTF_u8_cps(empty8).end());
+
+	// an ill-formed sequence ends before the first unit that cannot continue it
+	const UTF_S8 str_bad8("A\xC3(\xE2\x82\xE0\x80\x80\x80\xF4\x90\x80\x80" "B");
+	UTF_cp_view<char> bad8 = UTF_u8_cps(str_bad8);
+	UTF_test(__LINE__, UTF_US32(bad8.begin(), bad8.end()) == UTF_U("A?(??" "?" "?B"));
+	UTF_test(__LINE__, bad8.begin().valid() && !(++bad8.begin()).valid());
+	const UTF_S8 str_star8("\x80\xC0\xAF");
+	UTF_cp_view<char, '*'> star8 = UTF_u8_cps<'*'>(str_star8);
+	UTF_test(__LINE__, UTF_US32(star8.begin(), star8.end()) == UTF_U("***"));
+	UTF_US16 bad16 = UTF_US16(1, 0xD800) + UTF_u("A") + UTF_US16(1, 0xDC00) + UTF_US16(1, 0xD800);
+	UTF_cp_view<UTF_US16::value_type> view_bad16 = UTF_u_cps(bad16);
+	UTF_test(__LINE__, UTF_US32(view_bad16.begin(), view_bad16.end()) == UTF_U("?A\xDC00?"));
+	UTF_test(__LINE__, UTF_cp_iterator_check(__LINE__, view8) && UTF_cp_iterator_check(__LINE__, view16));
+
+	// random strings of interesting units
+	static const unsigned char s_bytes[] = { 'a', 0x80, 0xBF, 0xC2, 0xC0, 0xDF, 0xE0, 0xED, 0xF0, 0xF4, 0xF5, 0xFF };
+	static const UTF_UC16 s_units[] = { 'a', 0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0xE000 };
+	unsigned seed = 1;
+	for (int round = 0; round < 500; ++round)
+	{
+		UTF_S8 str8;
+		UTF_US16 str16;
+		for (int i = 0; i < 12; ++i)
+		{
+			seed = seed * 1103515245 + 12345;
+			str8 += char(s_bytes[(seed >> 16) % sizeof(s_bytes)]);
+			str16 += s_units[(seed >> 8) % (sizeof(s_units) / sizeof(s_units[0]))];
+		}
+		if (!UTF_cp_iterator_check(__LINE__, UTF_u8_cps(str8)) ||
+			!UTF_cp_iterator_check(__LINE__, UTF_u_cps(str16)))
+		{
+			return;
+		}
+	}
+
+#ifdef __cpp_lib_ranges
+	static_assert(std::ranges::bidirectional_range<UTF_cp_view<char> >, "");
+	static_assert(std::ranges::view<UTF_cp_view<UTF_UC16> >, "");
+	UTF_test(__LINE__, std::ranges::distance(view16) == std::ranges::distance(view8));
+#endif
+}
+
+void UTF_cp_inserter_test(void)
+{
+	const UTF_S8 s8 = UTF_u8("Encode z\u00df\u6c34\U0001d10b and \uff61");
+	UTF_US16 us16;
+	UTF_US32 us32;
+	UTF_u8_to_u(s8, us16);
+	UTF_u8_to_U(s8, us32);
+	UTF_cp_view<char> view8 = UTF_u8_cps(s8);
+	UTF_cp_view<UTF_US16::value_type> view16 = UTF_u_cps(us16);
+
+	UTF_US16 out16;
+	UTF_S8 out8;
+	std::vector<UTF_UC32> out32;
+	std::copy(view8.begin(), view8.end(), UTF_u_inserter(out16));
+	std::copy(view16.begin(), view16.end(), UTF_u8_inserter(out8));
+	std::copy(view8.begin(), view8.end(), UTF_U_inserter(out32));
+	UTF_test(__LINE__, out16 == us16 && out8 == s8);
+	UTF_test(__LINE__, UTF_US32(out32.begin(), out32.end()) == us32);
+
+	// raw buffers
+	UTF_UC8 buf8[64];
+	UTF_UC16 buf16[64];
+	UTF_UC8 *end8 = std::copy(us32.begin(), us32.end(), UTF_u8_encoder(buf8)).base();
+	UTF_UC16 *end16 = std::copy(us32.begin(), us32.end(), UTF_u_encoder(buf16)).base();
+	UTF_test(__LINE__, UTF_S8(buf8, end8) == s8);
+	UTF_test(__LINE__, UTF_US16(buf16, end16) == us16);
+
+	// code points that cannot be encoded
+	const UTF_UC32 bad[] = { 'a', 0x110000, 0xFFFFFFFF, 'b' };
+	UTF_S8 bad8;
+	UTF_test(__LINE__, !std::copy(bad, bad + 4, UTF_u8_inserter(bad8)).failed() && bad8 == "a??b");
+	UTF_US16 bad16;
+	UTF_test(__LINE__, std::copy(bad, bad + 4, UTF_u_inserter<0>(bad16)).failed() && bad16 == UTF_u("ab"));
+	UTF_US32 bad32;
+	std::copy(bad, bad + 4, UTF_U_inserter<'*'>(bad32));
+	UTF_test(__LINE__, bad32 == UTF_U("a**b"));
+
+	for (UTF_UC32 uc32 = 0; uc32 < 0x110000; uc32 += 0x3F)
+	{
+		UTF_S8 enc8;
+		UTF_US16 enc16;
+		UTF_U_to_u8(UTF_US32(1, uc32), enc8);
+		UTF_U_to_u(UTF_US32(1, uc32), enc16);
+		if (!UTF_test(__LINE__, UTF_uc32_count8(uc32) == int(enc8.size())) ||
+			!UTF_test(__LINE__, UTF_uc32_count16(uc32) == int(enc16.size())))
+		{
+			return;
+		}
+	}
+	UTF_test(__LINE__, UTF_uc32_count8(0x110000) == 0 && UTF_uc32_count16(0x110000) == 0);
+
+#ifdef __cpp_lib_ranges
+	static_assert(std::output_iterator<UTF_cp_inserter<UTF_UC8 *, 8>, UTF_UC32>, "");
+#endif
+}
+
+void UTF_constexpr_test(void)
+{
+#if __cplusplus >= 201402L
+	static_assert(UTF_uc8_count(0xE6) == 3 && UTF_uc8_is_trail(0xB0), "");
+	static_assert(UTF_uc32_count8(0x1d10b) == 4 && UTF_uc32_count16(0x1d10b) == 2, "");
+#endif
+#ifdef UTF_LITERALS
+	static constexpr auto us16 = UTF_u_literal("z\u00df\u6c34\U0001d10b");
+	static constexpr auto us32 = UTF_U_literal("z\u00df\u6c34\U0001d10b");
+	static_assert(us16.size() == 6 && us16[2] == 0x6c34 && us16[3] == 0xD834 && us16[5] == 0, "");
+	static_assert(us32.size() == 5 && us32[3] == 0x1d10b && us32[4] == 0, "");
+	static_assert(UTF_u_literal("").size() == 1, "");
+	static_assert(UTF_literal_is_valid(u8"\u6c34") && !UTF_literal_is_valid(u8"\xC3("), "");
+	static_assert(!UTF_literal_is_valid(u8"\xED\xA0\x80") && !UTF_literal_is_valid(u8"\xF4\x90\x80\x80"), "");
+	UTF_test(__LINE__, UTF_US16(us16.data(), us16.size() - 1) == UTF_u("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, UTF_US32(us32.data()) == UTF_U("z\u00df\u6c34\U0001d10b"));
+#endif
+}
+
+void UTF_policy_test(void)
+{
+	// Table 3-8 of the Unicode Standard: U+FFFD for each maximal subpart
+	const UTF_S8 bad8("\x61\xF1\x80\x80\xE1\x80\xC2\x62\x80\x63\x80\xBF\x64");
+	const UTF_US16 fffd16 = UTF_u("a\uFFFD\uFFFD\uFFFDb\uFFFDc\uFFFD\uFFFDd");
+	UTF_US16 us16;
+	UTF_US32 us32;
+	UTF_S8 s8;
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_replace>(bad8, us16) && us16 == fffd16);
+	UTF_test(__LINE__, UTF_u8_to_U<UTF_policy_replace>(bad8, us32) && us32 == UTF_U("a\uFFFD\uFFFD\uFFFDb\uFFFDc\uFFFD\uFFFDd"));
+	us16.clear();
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_skip>(bad8, us16) && us16 == UTF_u("abcd"));
+	us16.clear();
+	UTF_test(__LINE__, !UTF_u8_to_u<UTF_policy_fail>(bad8, us16) && us16 == UTF_u("a"));
+	UTF_US8 us8;
+	UTF_test(__LINE__, UTF_u8_to_u8<UTF_policy_replace>(UTF_US8(bad8.begin(), bad8.end()), us8));
+	UTF_test(__LINE__, UTF_S8(us8.begin(), us8.end()) == UTF_u8("a\uFFFD\uFFFD\uFFFDb\uFFFDc\uFFFD\uFFFDd"));
+	us16.clear();
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_replace>(UTF_S8("\xE0\x80\x80\xED\xA0\x80\xF4\x90\x80\x80\xC0\xAF"), us16));
+	UTF_test(__LINE__, us16 == UTF_US16(12, 0xFFFD));
+
+	// lone surrogates and values out of range
+	const UTF_US16 lone16 = UTF_u("x") + UTF_US16(1, 0xDC00) + UTF_US16(1, 0xD800);
+	const UTF_US32 lone32 = UTF_U("x") + UTF_US32(1, 0xDC00) + UTF_US32(1, 0xD800);
+	s8.clear();
+	UTF_test(__LINE__, UTF_u_to_u8<UTF_policy_replace>(lone16, s8) && s8 == UTF_u8("x\uFFFD\uFFFD"));
+	s8.clear();
+	UTF_test(__LINE__, UTF_u_to_u8<UTF_policy_skip>(lone16, s8) && s8 == "x");
+	us32.clear();
+	UTF_test(__LINE__, !UTF_u_to_U<UTF_policy_fail>(lone16, us32) && us32 == UTF_U("x"));
+	us16.clear();
+	UTF_test(__LINE__, UTF_U_to_u<UTF_policy_replace>(UTF_U("x") + UTF_US32(1, 0x110000), us16) && us16 == UTF_u("x\uFFFD"));
+
+	// WTF-8 round trip of lone surrogates
+	s8.clear();
+	UTF_test(__LINE__, UTF_u_to_u8<UTF_policy_pass>(lone16, s8) && s8 == "x\xED\xB0\x80\xED\xA0\x80");
+	us16.clear();
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_pass>(s8, us16) && us16 == lone16);
+	us32.clear();
+	UTF_test(__LINE__, UTF_u8_to_U<UTF_policy_pass>(s8, us32) && us32 == lone32);
+	us16.clear();
+	UTF_test(__LINE__, UTF_U_to_u<UTF_policy_pass>(lone32, us16) && us16 == lone16);
+
+	// all policies agree on well-formed text
+	const UTF_S8 good8 = UTF_u8("z\u00df\u6c34\U0001d10b \uff61\U0010FFFF\u0800\u07FF\U00010000");
+	UTF_US16 good16;
+	UTF_US32 good32;
+	UTF_u8_to_u(good8, good16);
+	UTF_u8_to_U(good8, good32);
+	UTF_US16 t16;
+	UTF_US32 t32;
+	UTF_S8 t8;
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_trusted>(good8, t16) && t16 == good16);
+	UTF_test(__LINE__, UTF_u8_to_U<UTF_policy_trusted>(good8, t32) && t32 == good32);
+	UTF_test(__LINE__, UTF_u_to_u8<UTF_policy_trusted>(good16, t8) && t8 == good8);
+	t32.clear();
+	UTF_test(__LINE__, UTF_u_to_U<UTF_policy_trusted>(good16, t32) && t32 == good32);
+	t8.clear();
+	UTF_test(__LINE__, UTF_U_to_u8<UTF_policy_fail>(good32, t8) && t8 == good8);
+	t16.clear();
+	UTF_test(__LINE__, UTF_U_to_u<UTF_policy_skip>(good32, t16) && t16 == good16);
+	UTF_test(__LINE__, UTF_u_to_u<UTF_policy_fail>(good16, t16) && t16 == good16);
+	UTF_test(__LINE__, UTF_U_to_U<UTF_policy_fail>(good32, t32) && t32 == good32);
+	UTF_test(__LINE__, !UTF_U_to_U<UTF_policy_fail>(lone32, t32) && t32 == UTF_U("x"));
+
+	// truncated trusted input stays in bounds
+	t16.clear();
+	UTF_test(__LINE__, UTF_u8_to_u<UTF_policy_trusted>(UTF_S8("a\xE6\xB0"), t16) && t16.size() == 2);
+}
+
+void UTF_decode_test(void)
+{
+	// the table-driven decoder against UTF_uc8_count and UTF_uc8_to_uc32
+	static const UTF_UC8 s_trails[] = { 0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC2, 0xE0, 0xF0, 0xFF };
+	const int n = sizeof(s_trails) / sizeof(s_trails[0]);
+	int failures = 0;
+	for (int lead = 0; lead < 256; ++lead)
+	{
+		for (int t = 0; t < n * n * n; ++t)
+		{
+			UTF_UC8 uj8[4] = { UTF_STATIC_CAST(UTF_UC8, lead), s_trails[t % n], s_trails[t / n % n], s_trails[t / n / n] };
+			for (int size = 1; size <= 4; ++size)
+			{
+				int count = UTF_uc8_count(uj8[0]);
+				UTF_UC32 expected = 0, uc32 = 0;
+				bool expected_bad, bad;
+				if (!count)
+				{
+					count = 1;
+					expected_bad = true;
+				}
+				else if (count > size)
+				{
+					count = size;
+					expected_bad = true;
+				}
+				else
+				{
+					expected_bad = !UTF_uc8_to_uc32(uj8, &expected);
+				}
+				if (UTF_uj8_decode(uj8, uj8 + size, &uc32, &bad) != count || bad != expected_bad ||
+					(!bad && uc32 != expected))
+				{
+					++failures;
+				}
+			}
+		}
+	}
+	UTF_test(__LINE__, failures == 0);
+}
+
+void UTF_transcode_test(void)
+{
+	// byte orders: "a\u00e9\U0001F600" in UTF-16BE and UTF-32LE
+	const UTF_S8 s8 = UTF_u8("a\u00e9\U0001F600");
+	static const unsigned char s_be16[] = { 0x00, 0x61, 0x00, 0xE9, 0xD8, 0x3D, 0xDE, 0x00, 0, 0 };
+	static const unsigned char s_le32[] = { 0x61, 0, 0, 0, 0xE9, 0, 0, 0, 0x00, 0xF6, 0x01, 0, 0, 0, 0, 0 };
+	UTF_UC16 uj16[8];
+	UTF_UC32 uj32[8];
+	UTF_UC8 uj8[16];
+	UTF_SIZE_T used = 0, written = 0;
+	UTF_test(__LINE__, UTF_transcode(UTF_ENC_8, s8.data(), s8.size(), &used, UTF_ENC_16BE, uj16, 8, &written, '?', NULL) == UTF_SUCCESS);
+	UTF_test(__LINE__, used == s8.size() && written == 4 && memcmp(uj16, s_be16, sizeof(s_be16)) == 0);
+	UTF_test(__LINE__, UTF_transcode(UTF_ENC_16BE, uj16, 4, NULL, UTF_ENC_32LE, uj32, 8, &written, '?', NULL) == UTF_SUCCESS);
+	UTF_test(__LINE__, written == 3 && memcmp(uj32, s_le32, sizeof(s_le32)) == 0);
+	UTF_test(__LINE__, UTF_transcode(UTF_ENC_32LE, uj32, 3, NULL, UTF_ENC_8, uj8, 16, &written, '?', NULL) == UTF_SUCCESS);
+	UTF_test(__LINE__, UTF_S8(reinterpret_cast<char *>(uj8), written) == s8);
+
+	// the swapped encodings give the same statistics
+	UTF_STATS stats;
+	UTF_stats_init(&stats);
+	UTF_transcode(UTF_ENC_16XE, uj16, 4, NULL, UTF_ENC_8, uj8, 16, NULL, '?', &stats);
+	UTF_test(__LINE__, stats.units == 4 && stats.bytes == 8 && stats.surrogate_pairs == 1 && stats.errors == 0);
+
+	// no default character: stop at the ill-formed sequence
+	const UTF_S8 bad8("ab\xFFz"), abcd("abcd");
+	UTF_test(__LINE__, UTF_transcode(UTF_ENC_8, bad8.data(), bad8.size(), &used, UTF_ENC_32, uj32, 8, &written, 0, NULL) == UTF_INVALID);
+	UTF_test(__LINE__, used == 2 && written == 2 && uj32[2] == 0);
+	UTF_test(__LINE__, UTF_transcode(UTF_ENC_8, abcd.data(), abcd.size(), &used, UTF_ENC_16, uj16, 3, &written, '?', NULL) == UTF_INSUFFICIENT_BUFFER);
+	UTF_test(__LINE__, used == 2 && written == 2 && uj16[2] == 0);
+
+	// the policy template on swapped input
+	UTF_US16 be16;
+	be16.push_back(UTF16_XE(0x78));
+	be16.push_back(UTF16_XE(0xD800));
+	be16.push_back(UTF16_XE(0x79));
+	UTF_S8 t8;
+	UTF_test(__LINE__, UTF_transcode<UTF_ENC_16XE, UTF_ENC_8, UTF_policy_replace>(be16.data(), be16.size(), t8));
+	UTF_test(__LINE__, t8 == UTF_u8("x\uFFFDy"));
+	UTF_US32 t32;
+	UTF_test(__LINE__, UTF_transcode<UTF_ENC_8, UTF_ENC_32XE, UTF_policy_fail>(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), t32));
+	UTF_test(__LINE__, t32.size() == 3 && UTF32_XE(t32[2]) == 0x1F600);
+}
+
+void UTF_inplace_test(void)
+{
+	// in place gives what the copying converters give, NUL included
+	static const UTF_UC32 s_src[] = { 0x61, 0xE9, 0x6C34, 0x1F600, 0x110000, 0x7A };
+	const UTF_SIZE_T n = sizeof(s_src) / sizeof(s_src[0]);
+	UTF_UC32 buf[8];
+	UTF_UC16 uj16[16];
+	UTF_UC8 uj8[32];
+	UTF_SIZE_T len;
+
+	memcpy(buf, s_src, sizeof(s_src));
+	len = UTF_uj32_to_uj16_inplace(buf, n);
+	UTF_uj32_to_uj16(s_src, n, uj16, 16);
+	UTF_test(__LINE__, len == 7 && memcmp(buf, uj16, (len + 1) * sizeof(UTF_UC16)) == 0);
+
+	memcpy(buf, s_src, sizeof(s_src));
+	len = UTF_uj32_to_uj8_inplace(buf, n);
+	UTF_uj32_to_uj8(s_src, n, uj8, 32);
+	UTF_test(__LINE__, len == 12 && memcmp(buf, uj8, len + 1) == 0);
+
+	// all supplementary: the same size, so no room for the NUL
+	buf[0] = 0x10000;
+	buf[1] = 0x10FFFF;
+	buf[2] = 0x12345678;
+	UTF_test(__LINE__, UTF_uj32_to_uj16_inplace(buf, 2) == 4 && buf[2] == 0x12345678);
+	memcpy(uj16, buf, 4 * sizeof(UTF_UC16));
+	UTF_test(__LINE__, uj16[0] == 0xD800 && uj16[1] == 0xDC00 && uj16[2] == 0xDBFF && uj16[3] == 0xDFFF);
+	UTF_test(__LINE__, UTF_uj32_to_uj8_inplace(buf, 0) == 0);
+}
+
+void UTF_size_test(void)
+{
+	// the size query matches what the converters write, for valid and ill-formed input
+	static const char *const s_inputs[] = { "", "abcdefghij", "a\xC3\xA9\xE6\xB0\xB4\xF0\x9F\x98\x80z",
+											"\xFF\x80" "ab\xE6\xB0", "\xF4\x90\x80\x80xyz", "0123456\xED\xA0\x80" };
+	UTF_UC16 uj16[64];
+	UTF_UC32 uj32[64];
+	UTF_UC8 uj8[64];
+	UTF_SIZE_T len16, len32, len8, n;
+	for (size_t k = 0; k < sizeof(s_inputs) / sizeof(s_inputs[0]); ++k)
+	{
+		const UTF_UC8 *src = reinterpret_cast<const UTF_UC8 *>(s_inputs[k]);
+		n = strlen(s_inputs[k]);
+		UTF_uj8_to_uj16(src, n, uj16, 64);
+		len16 = UTF_uj16_len(uj16);
+		UTF_test(__LINE__, UTF_uj8_to_uj16_size(src, n) == len16 + 1);
+		UTF_uj8_to_uj32(src, n, uj32, 64);
+		len32 = UTF_uj32_len(uj32);
+		UTF_test(__LINE__, UTF_uj8_to_uj32_size(src, n) == len32 + 1);
+
+		UTF_uj16_to_uj8(uj16, len16, uj8, 64);
+		len8 = UTF_uj8_len(uj8);
+		UTF_test(__LINE__, UTF_uj16_to_uj8_size(uj16, len16) == len8 + 1);
+		UTF_test(__LINE__, UTF_uj16_to_uj32_size(uj16, len16) == UTF_uj16_count_cp(uj16, len16) + 1);
+		UTF_uj32_to_uj8(uj32, len32, uj8, 64);
+		UTF_test(__LINE__, UTF_uj32_to_uj8_size(uj32, len32) == UTF_uj8_len(uj8) + 1);
+		UTF_test(__LINE__, UTF_uj32_to_uj16_size(uj32, len32) == len16 + 1);
+
+		UTF_UC16 *alloc16 = UTF_uj8_to_uj16_alloc(src, n, &len8);
+		UTF_test(__LINE__, alloc16 && len8 == len16 && memcmp(alloc16, uj16, (len16 + 1) * sizeof(UTF_UC16)) == 0);
+		UTF_FREE(alloc16);
+
+		// exactly that size is enough, one less is not
+		UTF_test(__LINE__, UTF_uj8_to_uj16(src, n, uj16, len16 + 1) == UTF_SUCCESS);
+		UTF_test(__LINE__, UTF_uj8_to_uj16(src, n, uj16, len16) == UTF_INSUFFICIENT_BUFFER || !n);
+	}
+
+	// the unit sizes and bounds follow UTF_UC16, a 32-bit wchar_t under UTF_WIDE_IS_UTF16
+#if __cplusplus >= 201402L
+	static_assert(UTF_enc_unit_size(UTF_ENC_16XE) == sizeof(UTF_UC16) && UTF_enc_unit_size(UTF_ENC_32) == sizeof(UTF_UC32), "");
+#endif
+	UTF_test(__LINE__, UTF_enc_unit_size(UTF_ENC_16) == sizeof(UTF_UC16) && UTF_enc_unit_size(UTF_ENC_32XE) == sizeof(UTF_UC32));
+	UTF_test(__LINE__, UTF_transcode_max(UTF_ENC_32, 10, UTF_ENC_8) == 41 && UTF_transcode_max(UTF_ENC_16, 10, UTF_ENC_8) == 31);
+	UTF_test(__LINE__, UTF_transcode_max(UTF_ENC_32XE, 10, UTF_ENC_16) == 21 && UTF_transcode_max(UTF_ENC_16, 10, UTF_ENC_32) == 11);
+
+	// nothing to write into: no NUL either
+	UTF_test(__LINE__, UTF_uj8_to_uj16(reinterpret_cast<const UTF_UC8 *>("ab"), 2, NULL, 0) == UTF_INSUFFICIENT_BUFFER);
+	UTF_test(__LINE__, UTF_uj8_to_uj16(reinterpret_cast<const UTF_UC8 *>(""), 0, NULL, 0) == UTF_SUCCESS);
+	const UTF_S8 bad8("a\xFF");
+	UTF_test(__LINE__, UTF_transcode_size(UTF_ENC_8, bad8.data(), bad8.size(), UTF_ENC_16, 0) == 0);
+
+	// the string converters size the result exactly, not for the worst case
+	UTF_S8 big8;
+	UTF_test(__LINE__, UTF_U_to_u8(UTF_US32(1000000, 'a'), big8) && big8.size() == 1000000);
+	UTF_test(__LINE__, big8.capacity() < 1000000 + 64);
+	UTF_US16 big16;
+	UTF_test(__LINE__, UTF_u8_to_u(UTF_S8(1000, 'a') + bad8, big16) && big16.size() == 1002);
+	UTF_test(__LINE__, big16.capacity() < 1002 + 64);
+	UTF_test(__LINE__, !UTF_u8_to_u<0>(bad8, big16) && big16.size() == 1003);
+}
+
+void UTF_small_buffer_test(void)
+{
+#if __cplusplus >= 201402L
+	static_assert(UTF_uj8_to_uj16_max(64) == 65 && UTF_uj16_to_uj8_max(10) == 31, "");
+	static_assert(UTF_uj32_to_uj8_max(10) == 41 && UTF_uj32_to_uj16_max(10) == 21, "");
+#endif
+	UTF_test(__LINE__, UTF_uj8_to_uj32_max(7) == 8 && UTF_uj16_to_uj32_max(7) == 8);
+
+	// inline while the worst case fits, appending like the string overloads
+	UTF_small_buffer<UTF_UC16, 64> b16;
+	UTF_test(__LINE__, UTF_u8_to_u(UTF_S8(63, 'a'), b16) && !b16.on_heap() && b16.size() == 63);
+	UTF_test(__LINE__, UTF_u8_to_u(UTF_u8("\u6c34"), b16) && b16.on_heap() && b16.size() == 64);
+	UTF_test(__LINE__, b16[63] == 0x6c34 && b16.c_str()[64] == 0);
+
+	// exactly the inline size: the NUL goes in the buffer's own terminator
+	UTF_small_buffer<UTF_UC16, 64> full16;
+	UTF_test(__LINE__, UTF_u8_to_u(UTF_S8(64, 'a'), full16) && !full16.on_heap() && full16.size() == 64);
+	UTF_test(__LINE__, full16[63] == 'a' && full16.c_str()[64] == 0);
+	const UTF_UC8 s65[65 + 1] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+	UTF_test(__LINE__, UTF_convert_to_stack<UTF_ENC_8, UTF_ENC_16>(s65, 65, full16) && full16.on_heap());
+	UTF_test(__LINE__, full16.size() == 65 && full16[64] == 'a');
+
+	UTF_small_buffer<char, 16> b8;
+	UTF_test(__LINE__, UTF_U_to_u8(UTF_U("z\u00df\u6c34"), b8) && !b8.on_heap());
+	UTF_test(__LINE__, b8.str() == UTF_u8("z\u00df\u6c34"));
+
+	// UTF_convert_to_stack replaces, and takes a pointer and a size
+	const UTF_UC16 s16[] = { 'x', 0xD800, 'y', 0xD834, 0xDD0B };
+	UTF_small_buffer<UTF_UC32, 8> b32;
+	UTF_test(__LINE__, UTF_convert_to_stack<UTF_ENC_16, UTF_ENC_32>(s16, 1, b32) && b32.size() == 1);
+	UTF_test(__LINE__, UTF_convert_to_stack<UTF_ENC_16, UTF_ENC_32>(s16, 5, b32) && !b32.on_heap());
+	UTF_test(__LINE__, b32.str() == UTF_U("x?\U0001d10b"));
+	UTF_test(__LINE__, !UTF_convert_to_stack<UTF_ENC_16, UTF_ENC_32, 0>(s16, 5, b32) && b32.size() == 1);
+}
+
+void UTF_compact_string_test(void)
+{
+	// the SIMD OR over every unit width, across block and word boundaries
+	UTF_S8 s8(37, 'a');
+	UTF_test(__LINE__, UTF_simd_or(s8.data(), s8.size(), 1) == 'a' && UTF_simd_or(s8.data(), 0, 1) == 0);
+	s8[36] = '\x80';
+	UTF_test(__LINE__, UTF_simd_or(s8.data(), s8.size(), 1) == 0xE1);
+	UTF_US16 us16(21, 'b');
+	us16[20] = 0x6c34;
+	UTF_test(__LINE__, UTF_simd_or(us16.data(), us16.size(), 2) == (0x6c34 | 'b'));
+	UTF_US32 us32(11, 'c');
+	us32[9] = 0x1d10b;
+	UTF_test(__LINE__, UTF_simd_or(us32.data(), us32.size(), 4) == (0x1d10b | 'c'));
+
+	// the narrowest width that holds every code point
+	UTF_compact_string ascii(UTF_S8("plain"));
+	UTF_compact_string latin1(UTF_u8("na\u00efve"));
+	UTF_compact_string bmp(UTF_u("z\u00df\u6c34"));
+	UTF_compact_string astral(UTF_u8("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, ascii.kind() == 1 && ascii.size() == 5 && ascii[4] == 'n');
+	UTF_test(__LINE__, latin1.kind() == 1 && latin1.size() == 5 && latin1[2] == 0xEF);
+	UTF_test(__LINE__, bmp.kind() == 2 && bmp.size() == 3 && bmp[2] == 0x6c34);
+	UTF_test(__LINE__, astral.kind() == 4 && astral.size() == 4 && astral[3] == 0x1d10b);
+	UTF_test(__LINE__, UTF_compact_string(UTF_U("z\u00df\u6c34\U0001d10b")) == astral);
+	UTF_test(__LINE__, UTF_compact_string().empty() && UTF_compact_string(UTF_US16()).kind() == 1);
+
+	// substr narrows again; at and substr check their bounds
+	UTF_test(__LINE__, astral.substr(1, 2) == UTF_compact_string(UTF_u("\u00df\u6c34")));
+	UTF_test(__LINE__, astral.substr(1, 2).kind() == 2 && astral.substr(0, 2).kind() == 1);
+	UTF_test(__LINE__, astral.substr(4).empty() && astral.substr(3).size_in_bytes() == 4);
+	bool thrown = false;
+	try { astral.at(4); } catch (const std::out_of_range&) { thrown = true; }
+	UTF_test(__LINE__, thrown);
+	thrown = false;
+	try { astral.substr(5); } catch (const std::out_of_range&) { thrown = true; }
+	UTF_test(__LINE__, thrown);
+
+	// export from every width
+	UTF_test(__LINE__, latin1.to_u8() == UTF_u8("na\u00efve") && ascii.to_u8() == "plain");
+	UTF_test(__LINE__, bmp.to_u8() == UTF_u8("z\u00df\u6c34") && bmp.to_U() == UTF_U("z\u00df\u6c34"));
+	UTF_test(__LINE__, astral.to_u() == UTF_u("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, astral.to_u8() == UTF_u8("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, latin1.to_u() == UTF_u("na\u00efve") && latin1.to_U() == UTF_U("na\u00efve"));
+
+	// ill-formed input becomes UTF_DEFAULT_CHAR as in the converters
+	UTF_US16 lone = UTF_u("x\u6c34") + UTF_US16(1, 0xD800) + UTF_u("yz");
+	UTF_compact_string s;
+	us32.clear();
+	UTF_test(__LINE__, UTF_u_to_U(lone, us32) && s.assign_u(lone.data(), lone.size()) && s.to_U() == us32);
+	UTF_test(__LINE__, us32 == UTF_U("x\u6c34?z"));
+	UTF_US32 huge = UTF_U("ab") + UTF_US32(1, 0x110000);
+	UTF_test(__LINE__, s.assign_U(huge.data(), huge.size()) && s.to_U() == UTF_U("ab?") && s.kind() == 1);
+	s8 = UTF_u8("\u6c34");
+	s8 += '\xFF';
+	UTF_test(__LINE__, s.assign_u8(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size()));
+	UTF_test(__LINE__, s.kind() == 2 && s.size() == 2 && s[1] == '?');
+
+	s.swap(latin1);
+	UTF_test(__LINE__, s.size() == 5 && latin1.kind() == 2 && s != latin1);
+}
+
+void UTF_cached_string_test(void)
+{
+	// the original is kept; the other forms are converted once
+	UTF_cached_string text(UTF_u8("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, text.encoding() == UTF_ENC_8 && text.has_u8() && !text.has_u() && !text.validated());
+	const UTF_US16& us16 = text.u();
+	UTF_test(__LINE__, us16 == UTF_u("z\u00df\u6c34\U0001d10b") && text.has_u() && text.validated());
+	UTF_test(__LINE__, &text.u() == &us16 && text.U() == UTF_U("z\u00df\u6c34\U0001d10b"));
+
+	// copies share the cache; assign() leaves them alone
+	UTF_cached_string copy(text);
+	std::shared_ptr<const UTF_US32> us32 = copy.share_U();
+	UTF_test(__LINE__, us32.get() == &text.U() && copy.validated());
+	text.assign(UTF_u("abc"));
+	UTF_test(__LINE__, text.encoding() == UTF_ENC_16 && !text.has_U() && text.u8() == "abc");
+	UTF_test(__LINE__, &copy.u() == &us16 && *us32 == UTF_U("z\u00df\u6c34\U0001d10b"));
+	copy = UTF_cached_string();
+	UTF_test(__LINE__, copy.u8().empty() && copy.U().empty() && *us32 == UTF_U("z\u00df\u6c34\U0001d10b"));
+
+	// trusted from the start, or found ill-formed and converted as usual
+	UTF_cached_string trusted(UTF_U("\u6c34"), true);
+	UTF_test(__LINE__, trusted.validated() && trusted.u8() == UTF_u8("\u6c34"));
+	UTF_cached_string lone(UTF_u("x") + UTF_US16(1, 0xD800));
+	UTF_test(__LINE__, !lone.well_formed() && !lone.validated() && !lone.has_u8());
+	UTF_test(__LINE__, lone.u8() == "x?" && lone.U() == UTF_U("x?"));
+	UTF_cached_string bad(UTF_S8("a\xFF" "b"));
+	UTF_test(__LINE__, bad.u() == UTF_u("a?b") && !bad.validated() && !bad.well_formed());
+
+	text.swap(trusted);
+	UTF_test(__LINE__, text.encoding() == UTF_ENC_32 && trusted.encoding() == UTF_ENC_16);
+
+	// a moved-from holder is empty and still usable
+	UTF_cached_string moved(std::move(text));
+	UTF_test(__LINE__, moved.u8() == UTF_u8("\u6c34") && text.encoding() == UTF_ENC_8 && text.u().empty());
+	text = std::move(moved);
+	UTF_test(__LINE__, text.U() == UTF_U("\u6c34") && moved.u8().empty() && moved.validated());
+}
+
+void UTF_intern_cache_test(void)
+{
+	// a hit returns the same units as the miss that converted them
+	UTF_intern_cache<UTF_ENC_16> cache(1 << 16, 4);
+	UTF_intern_cache<UTF_ENC_16>::view first = cache.get(UTF_u8("z\u00df\u6c34\U0001d10b"));
+	UTF_intern_cache<UTF_ENC_16>::view again = cache.get(UTF_u8("z\u00df\u6c34\U0001d10b"));
+	UTF_test(__LINE__, first.ok() && first.str() == UTF_u("z\u00df\u6c34\U0001d10b") && first.data()[5] == 0);
+	UTF_test(__LINE__, again.data() == first.data() && again.size() == 5);
+	UTF_test(__LINE__, cache.get("", 0).ok() && cache.get("", 0).empty() && cache.get(UTF_S8("a\xFF")).str() == UTF_u("a?"));
+	UTF_INTERN_STATS stats = cache.statistics();
+	UTF_test(__LINE__, stats.hits == 2 && stats.misses == 3 && stats.entries == 3 && stats.evictions == 0);
+
+	// bounded: old entries go, views of them stay valid
+	UTF_intern_cache<UTF_ENC_32, 0> small(1024, 1);
+	UTF_intern_cache<UTF_ENC_32, 0>::view kept = small.get("tag-0", 5);
+	char key[16];
+	for (int i = 0; i < 100; ++i)
+	{
+		sprintf(key, "tag-%d", i);
+		small.get(key, strlen(key));
+	}
+	stats = small.statistics();
+	UTF_test(__LINE__, stats.misses == 100 && stats.hits == 1 && stats.evictions > 0 && stats.bytes <= 1024);
+	UTF_test(__LINE__, stats.entries + stats.evictions == 100 && kept.str() == UTF_U("tag-0"));
+	UTF_test(__LINE__, small.get("tag-99", 6).data() == small.get("tag-99", 6).data());
+	UTF_test(__LINE__, !small.get(UTF_S8("\xC3")).ok() && !UTF_intern_cache<UTF_ENC_32, 0>::view().ok());
+
+	// too big to cache, and cleared
+	UTF_test(__LINE__, small.get(UTF_S8(2000, 'x')).size() == 2000);
+	small.clear();
+	stats = small.statistics();
+	UTF_test(__LINE__, stats.entries == 0 && stats.bytes == 0 && kept.size() == 5);
+}
+
+// checks every offset of index against a count from the start of text
+static bool UTF_offset_index_check(const UTF_offset_index& index, const UTF_S8& text)
+{
+	size_t cp = 0, u16 = 0;
+	for (size_t i = 0; i <= text.size(); ++i)
+	{
+		unsigned char byte = (i < text.size()) ? text[i] : 0;
+		bool lead = (i == text.size() || (byte & 0xC0) != 0x80);
+		size_t start = i;
+		while (start > 0 && start + 3 > i && (text[start] & 0xC0) == 0x80)
+			--start;
+		if (static_cast<unsigned char>(text[start]) < 0xC0)
+			start = i;
+		if (index.u8_to_cp(i) != index.u8_to_cp(start) || index.u8_to_u16(i) != index.u8_to_u16(start))
+			return false;
+		if (!lead)
+			continue;
+		if (index.u8_to_cp(i) != cp || index.u8_to_u16(i) != u16)
+			return false;
+		if (index.cp_to_u8(cp) != i || index.u16_to_u8(u16) != i || index.cp_to_u16(cp) != u16)
+			return false;
+		if (byte >= 0xF0 && (index.u16_to_u8(u16 + 1) != i || index.u16_to_cp(u16 + 1) != cp))
+			return false;
+		if (i == text.size())
+			break;
+		cp += 1;
+		u16 += (byte >= 0xF0) ? 2 : 1;
+	}
+	return index.size_cp() == cp && index.size_u16() == u16 && index.cp_to_u8(cp + 5) == text.size();
+}
+
+void UTF_offset_index_test(void)
+{
+	static const char *const pieces[] = { "a", "b ", "\xC3\x9F", "\xE6\xB0\xB4", "\xF0\x9D\x84\x8B", "\n" };
+	uint32_t seed = 12345;
+	UTF_S8 text;
+	for (int i = 0; i < 3000; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		text += pieces[(seed >> 16) % 6];
+	}
+
+	UTF_offset_index empty;
+	UTF_test(__LINE__, empty.size() == 0 && empty.u8_to_u16(3) == 0 && empty.u16_to_u8(3) == 0);
+	UTF_offset_index index(text.data(), text.size(), 64);
+	UTF_test(__LINE__, UTF_offset_index_check(index, text));
+	UTF_test(__LINE__, index.u8_to_cp(text.size()) == UTF_uj8_count_cp(reinterpret_cast<const UTF_UC8 *>(text.data()), text.size()));
+
+	// edits anywhere, checked against a rebuilt index as well
+	for (int i = 0; i < 40; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		size_t pos = (seed >> 8) % (text.size() + 1);
+		size_t removed = std::min<size_t>((seed >> 4) % ((i % 4 == 0) ? 300 : 8), text.size() - pos);
+		UTF_S8 inserted;
+		for (size_t k = 0; k < (seed >> 20) % ((i % 5 == 0) ? 200 : 6); ++k)
+			inserted += pieces[(seed + k) % 6];
+		text.replace(pos, removed, inserted);
+		index.update(text.data(), text.size(), pos, removed, inserted.size());
+		if (!UTF_test(__LINE__, UTF_offset_index_check(index, text)))
+			break;
+	}
+	index.update(text.data(), text.size(), 0, text.size(), text.size());
+	UTF_test(__LINE__, UTF_offset_index_check(index, text));
+	text.clear();
+	index.update(text.data(), 0, 0, index.size(), 0);
+	UTF_test(__LINE__, index.size() == 0 && index.size_u16() == 0 && index.u16_to_u8(1) == 0);
+
+	// the SIMD counter agrees with a byte loop at every length
+	UTF_UC8 bytes[70];
+	for (size_t i = 0; i < sizeof(bytes); ++i)
+		bytes[i] = static_cast<UTF_UC8>(0xE8 + i * 7);
+	for (size_t n = 0; n <= sizeof(bytes); ++n)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < n; ++i)
+			count += (bytes[i] >= 0xF0);
+		UTF_test(__LINE__, UTF_simd_count_lead8_4(bytes, n) == count);
+	}
+}
+
 int main(int argc, char **argv)
 {
 	g_failures = 0;
@@ -198,6 +1362,34 @@ int main(int argc, char **argv)
 	u8_to_u_test(__LINE__, "\xF0\x28\x8C\xBC", UTF_u("?"), true);
 	u8_to_u_test(__LINE__, "\xF0\x90\x28\xBC", UTF_u("?"), true);
 	u8_to_u_test(__LINE__, "\xF0\x28\x8C\x28", UTF_u("?"), true);
+	u8_to_U_test(__LINE__, "\xE0\x80\x80", UTF_U("?"), true);
+	u8_to_U_test(__LINE__, "A\xC3\x28", UTF_U("A?"), true);
+	u_to_u8_test(__LINE__, UTF_US16(1, 0xD800) + UTF_u("A"), "?", true);
+	u_to_u8_test(__LINE__, UTF_u("A") + UTF_US16(1, 0xD800), "A?", true);
+
+	UTF_getline_test();
+	UTF_getline_ex_test();
+	UTF_stats_test();
+	UTF_trace_test();
+	UTF_count_cp_test();
+	UTF_len_test();
+	UTF_cmp_test();
+	UTF_cmp_len_test();
+	UTF_cmp_cross_test();
+	UTF_hash_test();
+	UTF_cp_iterator_test();
+	UTF_cp_inserter_test();
+	UTF_constexpr_test();
+	UTF_policy_test();
+	UTF_decode_test();
+	UTF_transcode_test();
+	UTF_inplace_test();
+	UTF_size_test();
+	UTF_small_buffer_test();
+	UTF_compact_string_test();
+	UTF_cached_string_test();
+	UTF_intern_cache_test();
+	UTF_offset_index_test();
 
 	if (argc >= 2)
 		UTF_fgets_test(argv[1]);
@@ -20,12 +20,14 @@
 #endif
 
 #ifdef __cplusplus
+	#include <cstddef>
 	#include <cstdlib>
 	#include <cstdio>
 	#include <cstring>
 	#define UTF_STATIC_CAST(type, value) static_cast<type>(value)
 	#define UTF_REINTERPRET_CAST(type, value) reinterpret_cast<type>(value)
 #else
+	#include <stddef.h>
 	#include <stdlib.h>
 	#include <stdio.h>
 	#include <string.h>
@@ -33,6 +35,23 @@
 	#define UTF_REINTERPRET_CAST(type, value) ((type)(value))
 #endif
 
+/* UTF_CONSTEXPR --- constexpr for the scalar primitives where C++14 relaxed
+ * constexpr is available (not Visual C++ 2015) */
+#if defined(__cplusplus) && (__cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L && _MSC_VER >= 1910))
+	#define UTF_CONSTEXPR constexpr
+#else
+	#define UTF_CONSTEXPR
+#endif
+
+/* UTF_FORCEINLINE --- static inline, and inlined even when large */
+#if defined(__GNUC__) || defined(__clang__)
+	#define UTF_FORCEINLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+	#define UTF_FORCEINLINE static __forceinline
+#else
+	#define UTF_FORCEINLINE static inline
+#endif
+
 /* UTF_C8, UTF_UC8, UTF_UC16, UTF_UC32 --- characters */
 typedef char UTF_C8;
 typedef uint8_t UTF_UC8;
@@ -58,6 +77,15 @@ typedef uint8_t UTF_UC8;
 	/* #define UTF_DEFAULT_CHAR 0 */
 #endif
 
+/* UTF_MALLOC, UTF_REALLOC, UTF_FREE --- the heap behind the *_alloc
+ * converters, UTF_small_buffer and the *_getline readers; define all three
+ * to replace it */
+#ifndef UTF_MALLOC
+	#define UTF_MALLOC(size) malloc(size)
+	#define UTF_REALLOC(ptr, size) realloc(ptr, size)
+	#define UTF_FREE(ptr) free(ptr)
+#endif
+
 #ifndef UTF_u
 	#ifdef UTF_WIDE_IS_UTF16
 		#define UTF_u(str) L##str
@@ -90,7 +118,95 @@ typedef enum UTF_RET
 	UTF_INSUFFICIENT_BUFFER = 2
 } UTF_RET;
 
-static inline int
+/* UTF_STATS --- optional statistics filled in by the UTF_uj*_to_uj*_ex converters */
+#define UTF_STATS_NO_ERROR (~UTF_STATIC_CAST(uint64_t, 0))
+
+typedef struct UTF_STATS
+{
+	uint64_t units;             /* source code units consumed */
+	uint64_t bytes;             /* source bytes consumed */
+	uint64_t code_points;       /* valid code points */
+	uint64_t sequences[4];      /* valid code points by UTF-8 length (1 to 4 bytes) */
+	uint64_t surrogate_pairs;   /* surrogate pairs read or written */
+	uint64_t errors;            /* ill-formed sequences */
+	uint64_t replacements;      /* UTF_DEFAULT_CHAR written */
+	uint64_t first_error;       /* unit offset of the first error, or UTF_STATS_NO_ERROR */
+	uint64_t last_error;        /* unit offset of the last error, or UTF_STATS_NO_ERROR */
+} UTF_STATS;
+
+/* The error offsets count from the first unit fed into the statistics, so
+ * a stream converted in pieces with the same UTF_STATS gets stream offsets. */
+static inline void
+UTF_stats_init(UTF_STATS *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->first_error = stats->last_error = UTF_STATS_NO_ERROR;
+}
+
+static inline double
+UTF_stats_ascii_ratio(const UTF_STATS *stats)
+{
+	if (!stats->code_points)
+		return 0;
+	return UTF_STATIC_CAST(double, stats->sequences[0]) / UTF_STATIC_CAST(double, stats->code_points);
+}
+
+/* adds src into dest (the error offsets become the earliest and the latest) */
+static inline void
+UTF_stats_merge(UTF_STATS *dest, const UTF_STATS *src)
+{
+	int i;
+	dest->units += src->units;
+	dest->bytes += src->bytes;
+	dest->code_points += src->code_points;
+	for (i = 0; i < 4; ++i)
+		dest->sequences[i] += src->sequences[i];
+	dest->surrogate_pairs += src->surrogate_pairs;
+	dest->errors += src->errors;
+	dest->replacements += src->replacements;
+	if (src->first_error < dest->first_error)
+		dest->first_error = src->first_error;
+	if (src->last_error != UTF_STATS_NO_ERROR &&
+		(dest->last_error == UTF_STATS_NO_ERROR || src->last_error > dest->last_error))
+	{
+		dest->last_error = src->last_error;
+	}
+}
+
+/* internal: a valid code point */
+static inline void
+UTF_stats_cp(UTF_STATS *stats, UTF_UC32 uc32, bool surrogate_pair)
+{
+	++stats->sequences[(uc32 >= 0x80) + (uc32 >= 0x800) + (uc32 >= 0x10000)];
+	stats->surrogate_pairs += surrogate_pair;
+}
+
+/* internal: an ill-formed sequence at offset units from the start of this call */
+static inline void
+UTF_stats_error(UTF_STATS *stats, ptrdiff_t offset, bool replaced)
+{
+	uint64_t pos = stats->units + UTF_STATIC_CAST(uint64_t, offset);
+	++stats->errors;
+	if (stats->first_error == UTF_STATS_NO_ERROR)
+		stats->first_error = pos;
+	stats->last_error = pos;
+	stats->replacements += replaced;
+}
+
+/* internal: the end of a call which consumed units */
+static inline void
+UTF_stats_finish(UTF_STATS *stats, ptrdiff_t units, size_t unit_size)
+{
+	stats->units += UTF_STATIC_CAST(uint64_t, units);
+	stats->bytes += UTF_STATIC_CAST(uint64_t, units) * unit_size;
+	stats->code_points = stats->sequences[0] + stats->sequences[1] +
+						 stats->sequences[2] + stats->sequences[3];
+}
+
+#include "utf_trace.h"
+#include "utf_simd.h"
+
+static inline UTF_CONSTEXPR int
 UTF_uc8_count(UTF_UC8 uc8)
 {
 	if (uc8 < 0x80) return 1;
@@ -100,19 +216,19 @@ UTF_uc8_count(UTF_UC8 uc8)
 	return 0;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc8_is_trail(UTF_UC8 uc8)
 {
 	return 0x80 <= uc8 && uc8 < 0xC0;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc16_is_surrogate_high(UTF_UC16 uc16)
 {
 	return 0xD800 <= uc16 && uc16 < 0xDC00;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc16_is_surrogate_low(UTF_UC16 uc16)
 {
 	return 0xDC00 <= uc16 && uc16 < 0xE000;
@@ -121,27 +237,23 @@ UTF_uc16_is_surrogate_low(UTF_UC16 uc16)
 static inline UTF_SIZE_T
 UTF_uj8_len(const UTF_UC8 *uj8)
 {
-	UTF_SIZE_T len;
-	for (len = 0; *uj8; ++len, ++uj8)
-	{
-	}
-	return len;
+	return strlen(UTF_REINTERPRET_CAST(const char *, uj8));
 }
 
 static inline UTF_SIZE_T
 UTF_j8_len(const UTF_C8 *j8)
 {
-	UTF_SIZE_T len;
-	for (len = 0; *j8; ++len, ++j8)
-	{
-	}
-	return len;
+	return strlen(j8);
 }
 
 static inline UTF_SIZE_T
 UTF_uj16_len(const UTF_UC16 *uj16)
 {
 	UTF_SIZE_T len;
+#if defined(UTF_SIMD_SSE2) || defined(UTF_SIMD_NEON)
+	if (!(UTF_REINTERPRET_CAST(uintptr_t, uj16) % sizeof(UTF_UC16)))
+		return UTF_simd_len(uj16, sizeof(UTF_UC16));
+#endif
 	for (len = 0; *uj16; ++len, ++uj16)
 	{
 	}
@@ -152,137 +264,332 @@ static inline UTF_SIZE_T
 UTF_uj32_len(const UTF_UC32 *uj32)
 {
 	UTF_SIZE_T len;
+#if defined(UTF_SIMD_SSE2) || defined(UTF_SIMD_NEON)
+	if (!(UTF_REINTERPRET_CAST(uintptr_t, uj32) % sizeof(UTF_UC32)))
+		return UTF_simd_len(uj32, sizeof(UTF_UC32));
+#endif
 	for (len = 0; *uj32; ++len, ++uj32)
 	{
 	}
 	return len;
 }
 
-static inline int
-UTF_uj8_cmp(const UTF_UC8 *uj8a, const UTF_UC8 *uj8b)
+/* UTF_uj8_count_cp, UTF_uj16_count_cp --- the number of code points. Trail
+ * bytes and low surrogates are not counted, so a truncated or stray sequence
+ * may count differently than the converters replace it. */
+static inline UTF_SIZE_T
+UTF_uj8_count_cp(const UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	return UTF_simd_count_lead8(uj8, uj8size);
+}
+
+static inline UTF_SIZE_T
+UTF_uj8_count_cp_z(const UTF_UC8 *uj8)
+{
+	return UTF_simd_count_lead8(uj8, UTF_uj8_len(uj8));
+}
+
+static inline UTF_SIZE_T
+UTF_uj16_count_cp(const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_simd_count_lead16(uj16, uj16size);
+}
+
+static inline UTF_SIZE_T
+UTF_uj16_count_cp_z(const UTF_UC16 *uj16)
+{
+	return UTF_simd_count_lead16(uj16, UTF_uj16_len(uj16));
+}
+
+/* UTF_uj8_cp_offset, UTF_uj16_cp_offset --- the offset in units of the code
+ * point at index (from zero), or the size if there are not that many. The
+ * offset never splits a sequence, so UTF_uj8_cp_offset(uj8, uj8size, n) is
+ * the length of the first n code points. */
+static inline UTF_SIZE_T
+UTF_uj8_cp_offset(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_SIZE_T index)
+{
+	UTF_SIZE_T i = 0, count;
+	while (uj8size - i >= 64)
+	{
+		count = UTF_simd_count_lead8(uj8 + i, 64);
+		if (count > index)
+			break;
+		index -= count;
+		i += 64;
+	}
+	for (; i < uj8size; ++i)
+	{
+		if ((uj8[i] & 0xC0) != 0x80)
+		{
+			if (!index)
+				return i;
+			--index;
+		}
+	}
+	return uj8size;
+}
+
+static inline UTF_SIZE_T
+UTF_uj16_cp_offset(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_SIZE_T index)
 {
-	while (*uj8a && *uj8b)
+	UTF_SIZE_T i = 0, count;
+	while (uj16size - i >= 32)
+	{
+		count = UTF_simd_count_lead16(uj16 + i, 32);
+		if (count > index)
+			break;
+		index -= count;
+		i += 32;
+	}
+	for (; i < uj16size; ++i)
 	{
-		if (*uj8a < *uj8b) return -1;
-		if (*uj8a > *uj8b) return 1;
-		++uj8a;
-		++uj8b;
+		if ((uj16[i] & 0xFC00) != 0xDC00)
+		{
+			if (!index)
+				return i;
+			--index;
+		}
 	}
-	if (*uj8a < *uj8b) return -1;
-	if (*uj8a > *uj8b) return 1;
+	return uj16size;
+}
+
+/* The comparisons find the first difference with vector compares. UTF_j8_cmp
+ * and UTF_j8_cmpn compare UTF_C8 values (signed where char is signed). */
+static inline int
+UTF_uj8_cmp(const UTF_UC8 *uj8a, const UTF_UC8 *uj8b)
+{
+	UTF_SIZE_T i = UTF_simd_mismatch(uj8a, uj8b, sizeof(UTF_UC8), ~UTF_STATIC_CAST(UTF_SIZE_T, 0));
+	if (uj8a[i] < uj8b[i]) return -1;
+	if (uj8a[i] > uj8b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_j8_cmp(const UTF_C8 *j8a, const UTF_C8 *j8b)
 {
-	while (*j8a && *j8b)
-	{
-		if (*j8a < *j8b) return -1;
-		if (*j8a > *j8b) return 1;
-		++j8a;
-		++j8b;
-	}
-	if (*j8a < *j8b) return -1;
-	if (*j8a > *j8b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(j8a, j8b, sizeof(UTF_C8), ~UTF_STATIC_CAST(UTF_SIZE_T, 0));
+	if (j8a[i] < j8b[i]) return -1;
+	if (j8a[i] > j8b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_uj16_cmp(const UTF_UC16 *uj16a, const UTF_UC16 *uj16b)
 {
-	while (*uj16a && *uj16b)
-	{
-		if (*uj16a < *uj16b) return -1;
-		if (*uj16a > *uj16b) return 1;
-		++uj16a;
-		++uj16b;
-	}
-	if (*uj16a < *uj16b) return -1;
-	if (*uj16a > *uj16b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(uj16a, uj16b, sizeof(UTF_UC16), ~UTF_STATIC_CAST(UTF_SIZE_T, 0));
+	if (uj16a[i] < uj16b[i]) return -1;
+	if (uj16a[i] > uj16b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_uj32_cmp(const UTF_UC32 *uj32a, const UTF_UC32 *uj32b)
 {
-	while (*uj32a && *uj32b)
-	{
-		if (*uj32a < *uj32b) return -1;
-		if (*uj32a > *uj32b) return 1;
-		++uj32a;
-		++uj32b;
-	}
-	if (*uj32a < *uj32b) return -1;
-	if (*uj32a > *uj32b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(uj32a, uj32b, sizeof(UTF_UC32), ~UTF_STATIC_CAST(UTF_SIZE_T, 0));
+	if (uj32a[i] < uj32b[i]) return -1;
+	if (uj32a[i] > uj32b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_uj8_cmpn(const UTF_UC8 *uj8a, const UTF_UC8 *uj8b, UTF_SIZE_T len)
 {
-	while (*uj8a && *uj8b)
-	{
-		if (len-- == 0) return 0;
-		if (*uj8a < *uj8b) return -1;
-		if (*uj8a > *uj8b) return 1;
-		++uj8a;
-		++uj8b;
-	}
-	if (*uj8a < *uj8b) return -1;
-	if (*uj8a > *uj8b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(uj8a, uj8b, sizeof(UTF_UC8), len);
+	if (i == len) return 0;
+	if (uj8a[i] < uj8b[i]) return -1;
+	if (uj8a[i] > uj8b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_j8_cmpn(const UTF_C8 *j8a, const UTF_C8 *j8b, UTF_SIZE_T len)
 {
-	while (*j8a && *j8b)
-	{
-		if (len-- == 0) return 0;
-		if (*j8a < *j8b) return -1;
-		if (*j8a > *j8b) return 1;
-		++j8a;
-		++j8b;
-	}
-	if (*j8a < *j8b) return -1;
-	if (*j8a > *j8b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(j8a, j8b, sizeof(UTF_C8), len);
+	if (i == len) return 0;
+	if (j8a[i] < j8b[i]) return -1;
+	if (j8a[i] > j8b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_uj16_cmpn(const UTF_UC16 *uj16a, const UTF_UC16 *uj16b, UTF_SIZE_T len)
 {
-	while (*uj16a && *uj16b)
-	{
-		if (len-- == 0) return 0;
-		if (*uj16a < *uj16b) return -1;
-		if (*uj16a > *uj16b) return 1;
-		++uj16a;
-		++uj16b;
-	}
-	if (*uj16a < *uj16b) return -1;
-	if (*uj16a > *uj16b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(uj16a, uj16b, sizeof(UTF_UC16), len);
+	if (i == len) return 0;
+	if (uj16a[i] < uj16b[i]) return -1;
+	if (uj16a[i] > uj16b[i]) return 1;
 	return 0;
 }
 
 static inline int
 UTF_uj32_cmpn(const UTF_UC32 *uj32a, const UTF_UC32 *uj32b, UTF_SIZE_T len)
 {
-	while (*uj32a && *uj32b)
-	{
-		if (len-- == 0) return 0;
-		if (*uj32a < *uj32b) return -1;
-		if (*uj32a > *uj32b) return 1;
-		++uj32a;
-		++uj32b;
-	}
-	if (*uj32a < *uj32b) return -1;
-	if (*uj32a > *uj32b) return 1;
+	UTF_SIZE_T i = UTF_simd_mismatch(uj32a, uj32b, sizeof(UTF_UC32), len);
+	if (i == len) return 0;
+	if (uj32a[i] < uj32b[i]) return -1;
+	if (uj32a[i] > uj32b[i]) return 1;
+	return 0;
+}
+
+/* UTF-16 in code point order, as UTF-8 and UTF-32 sort: U+E000..U+FFFF move
+ * below the surrogates, which only occur in pairs in well-formed text */
+static inline UTF_UC32
+UTF_uc16_cp_order(UTF_UC16 uc16)
+{
+	if (uc16 >= 0xE000)
+		return uc16 - 0x800;
+	if (uc16 >= 0xD800)
+		return uc16 + 0x2000;
+	return uc16;
+}
+
+static inline int
+UTF_uj16_cmp_cp(const UTF_UC16 *uj16a, const UTF_UC16 *uj16b)
+{
+	UTF_SIZE_T i = UTF_simd_mismatch(uj16a, uj16b, sizeof(UTF_UC16), ~UTF_STATIC_CAST(UTF_SIZE_T, 0));
+	UTF_UC32 a = UTF_uc16_cp_order(uj16a[i]), b = UTF_uc16_cp_order(uj16b[i]);
+	if (a < b) return -1;
+	if (a > b) return 1;
+	return 0;
+}
+
+static inline int
+UTF_uj16_cmpn_cp(const UTF_UC16 *uj16a, const UTF_UC16 *uj16b, UTF_SIZE_T len)
+{
+	UTF_SIZE_T i = UTF_simd_mismatch(uj16a, uj16b, sizeof(UTF_UC16), len);
+	UTF_UC32 a, b;
+	if (i == len) return 0;
+	a = UTF_uc16_cp_order(uj16a[i]);
+	b = UTF_uc16_cp_order(uj16b[i]);
+	if (a < b) return -1;
+	if (a > b) return 1;
+	return 0;
+}
+
+/* UTF_uj*_cmp_len, UTF_uj*_equal, UTF_uj*_has_prefix --- the counted
+ * versions, which treat zeros as ordinary units. UTF_uj*_cmp_len stores the
+ * index of the first differing unit (or the shorter size) into *mismatch
+ * unless mismatch is NULL. */
+static inline int
+UTF_uj8_cmp_len(const UTF_UC8 *uj8a, UTF_SIZE_T sizea, const UTF_UC8 *uj8b, UTF_SIZE_T sizeb,
+				UTF_SIZE_T *mismatch)
+{
+	UTF_SIZE_T size = (sizea < sizeb) ? sizea : sizeb;
+	UTF_SIZE_T i = UTF_simd_mismatch_bytes(uj8a, uj8b, size * sizeof(UTF_UC8)) / sizeof(UTF_UC8);
+	if (mismatch)
+		*mismatch = i;
+	if (i < size) return (uj8a[i] < uj8b[i]) ? -1 : 1;
+	if (sizea < sizeb) return -1;
+	if (sizea > sizeb) return 1;
+	return 0;
+}
+
+static inline int
+UTF_j8_cmp_len(const UTF_C8 *j8a, UTF_SIZE_T sizea, const UTF_C8 *j8b, UTF_SIZE_T sizeb,
+			   UTF_SIZE_T *mismatch)
+{
+	UTF_SIZE_T size = (sizea < sizeb) ? sizea : sizeb;
+	UTF_SIZE_T i = UTF_simd_mismatch_bytes(j8a, j8b, size * sizeof(UTF_C8)) / sizeof(UTF_C8);
+	if (mismatch)
+		*mismatch = i;
+	if (i < size) return (j8a[i] < j8b[i]) ? -1 : 1;
+	if (sizea < sizeb) return -1;
+	if (sizea > sizeb) return 1;
+	return 0;
+}
+
+static inline int
+UTF_uj16_cmp_len(const UTF_UC16 *uj16a, UTF_SIZE_T sizea, const UTF_UC16 *uj16b, UTF_SIZE_T sizeb,
+				 UTF_SIZE_T *mismatch)
+{
+	UTF_SIZE_T size = (sizea < sizeb) ? sizea : sizeb;
+	UTF_SIZE_T i = UTF_simd_mismatch_bytes(uj16a, uj16b, size * sizeof(UTF_UC16)) / sizeof(UTF_UC16);
+	if (mismatch)
+		*mismatch = i;
+	if (i < size) return (uj16a[i] < uj16b[i]) ? -1 : 1;
+	if (sizea < sizeb) return -1;
+	if (sizea > sizeb) return 1;
+	return 0;
+}
+
+static inline int
+UTF_uj32_cmp_len(const UTF_UC32 *uj32a, UTF_SIZE_T sizea, const UTF_UC32 *uj32b, UTF_SIZE_T sizeb,
+				 UTF_SIZE_T *mismatch)
+{
+	UTF_SIZE_T size = (sizea < sizeb) ? sizea : sizeb;
+	UTF_SIZE_T i = UTF_simd_mismatch_bytes(uj32a, uj32b, size * sizeof(UTF_UC32)) / sizeof(UTF_UC32);
+	if (mismatch)
+		*mismatch = i;
+	if (i < size) return (uj32a[i] < uj32b[i]) ? -1 : 1;
+	if (sizea < sizeb) return -1;
+	if (sizea > sizeb) return 1;
 	return 0;
 }
 
 static inline bool
+UTF_uj8_equal(const UTF_UC8 *uj8a, UTF_SIZE_T sizea, const UTF_UC8 *uj8b, UTF_SIZE_T sizeb)
+{
+	return sizea == sizeb && memcmp(uj8a, uj8b, sizea * sizeof(UTF_UC8)) == 0;
+}
+
+static inline bool
+UTF_uj8_has_prefix(const UTF_UC8 *uj8, UTF_SIZE_T size, const UTF_UC8 *prefix, UTF_SIZE_T prefix_size)
+{
+	return size >= prefix_size && memcmp(uj8, prefix, prefix_size * sizeof(UTF_UC8)) == 0;
+}
+
+static inline bool
+UTF_j8_equal(const UTF_C8 *j8a, UTF_SIZE_T sizea, const UTF_C8 *j8b, UTF_SIZE_T sizeb)
+{
+	return sizea == sizeb && memcmp(j8a, j8b, sizea * sizeof(UTF_C8)) == 0;
+}
+
+static inline bool
+UTF_j8_has_prefix(const UTF_C8 *j8, UTF_SIZE_T size, const UTF_C8 *prefix, UTF_SIZE_T prefix_size)
+{
+	return size >= prefix_size && memcmp(j8, prefix, prefix_size * sizeof(UTF_C8)) == 0;
+}
+
+static inline bool
+UTF_uj16_equal(const UTF_UC16 *uj16a, UTF_SIZE_T sizea, const UTF_UC16 *uj16b, UTF_SIZE_T sizeb)
+{
+	return sizea == sizeb && memcmp(uj16a, uj16b, sizea * sizeof(UTF_UC16)) == 0;
+}
+
+static inline bool
+UTF_uj16_has_prefix(const UTF_UC16 *uj16, UTF_SIZE_T size, const UTF_UC16 *prefix, UTF_SIZE_T prefix_size)
+{
+	return size >= prefix_size && memcmp(uj16, prefix, prefix_size * sizeof(UTF_UC16)) == 0;
+}
+
+static inline bool
+UTF_uj32_equal(const UTF_UC32 *uj32a, UTF_SIZE_T sizea, const UTF_UC32 *uj32b, UTF_SIZE_T sizeb)
+{
+	return sizea == sizeb && memcmp(uj32a, uj32b, sizea * sizeof(UTF_UC32)) == 0;
+}
+
+static inline bool
+UTF_uj32_has_prefix(const UTF_UC32 *uj32, UTF_SIZE_T size, const UTF_UC32 *prefix, UTF_SIZE_T prefix_size)
+{
+	return size >= prefix_size && memcmp(uj32, prefix, prefix_size * sizeof(UTF_UC32)) == 0;
+}
+
+/* UTF_uc32_count8, UTF_uc32_count16 --- the number of UTF-8 or UTF-16 code
+ * units that UTF_uc32_to_uc8 or UTF_uc32_to_uc16 writes for uc32, without
+ * branches; 0 if uc32 cannot be encoded. */
+static inline UTF_CONSTEXPR int
+UTF_uc32_count8(UTF_UC32 uc32)
+{
+	return (uc32 <= 0x10FFFF) * (1 + (uc32 >= 0x80) + (uc32 >= 0x800) + (uc32 >= 0x10000));
+}
+
+static inline UTF_CONSTEXPR int
+UTF_uc32_count16(UTF_UC32 uc32)
+{
+	return (uc32 <= 0x10FFFF) * (1 + (uc32 >= 0x10000));
+}
+
+static inline UTF_CONSTEXPR bool
 UTF_uc32_to_uc8(UTF_UC32 uc32, UTF_UC8 uc8[4])
 {
 	if (uc32 > 0x10FFFF)
@@ -320,7 +627,7 @@ UTF_uc32_to_uc8(UTF_UC32 uc32, UTF_UC8 uc8[4])
 	return true;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc8_to_uc32(const UTF_UC8 uc8[4], UTF_UC32 *uc32)
 {
 	int count = UTF_uc8_count(uc8[0]);
@@ -380,7 +687,7 @@ UTF_uc8_to_uc32(const UTF_UC8 uc8[4], UTF_UC32 *uc32)
 	return true;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc32_to_uc16(UTF_UC32 uc32, UTF_UC16 uc16[2])
 {
 	if (uc32 > 0x10FFFF)
@@ -400,7 +707,7 @@ UTF_uc32_to_uc16(UTF_UC32 uc32, UTF_UC16 uc16[2])
 	return true;
 }
 
-static inline bool
+static inline UTF_CONSTEXPR bool
 UTF_uc16_to_uc32(const UTF_UC16 uc16[4], UTF_UC32 *uc32)
 {
 	if (UTF_uc16_is_surrogate_high(uc16[0]))
@@ -447,389 +754,1062 @@ UTF_uc16_to_uc8(const UTF_UC16 uc16[2], UTF_UC8 uc8[4])
 	return UTF_uc16_to_uc32(uc16, &uc32) && UTF_uc32_to_uc8(uc32, uc8);
 }
 
-static inline UTF_RET
-UTF_uj8_to_uj16(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+/* UTF_uc32_to_uc8 writes this many bytes */
+static inline int
+UTF_uc32_len8(UTF_UC32 uc32)
 {
-	UTF_UC8 uc8[4];
-	UTF_UC16 uc16[2];
-	int i, count;
-	const UTF_UC8 *uj8end = uj8 + uj8size;
-	UTF_UC16 *uj16end = uj16 + uj16size - 1;
+	return 1 + (uc32 >= 0x80) + (uc32 >= 0x800) + (uc32 >= 0x10000);
+}
 
-	if (!uj16size && uj8size)
-		return UTF_INSUFFICIENT_BUFFER;
+/* UTF_uj8_decode --- decodes the UTF-8 sequence at uj8 (before uj8end) by the
+ * rules of the converters: the lead byte alone decides how many bytes the
+ * sequence takes (as UTF_uc8_count), and the sequence is ill-formed unless
+ * they are trail bytes without an overlong encoding. Returns the number of
+ * bytes taken (at least one, never past uj8end) and sets *bad if ill-formed.
+ * Four-byte sequences may decode above U+10FFFF; the caller checks that.
+ *
+ * A byte class table and a state transition table (a DFA) replace the
+ * branches on the lead byte and the staging copy of UTF_uc8_to_uc32. */
+static inline int
+UTF_uj8_decode(const UTF_UC8 *uj8, const UTF_UC8 *uj8end, UTF_UC32 *uc32, bool *bad)
+{
+	/* sequence length << 4 | byte class: 0 for 00-7F, 1 for 80-8F, 2 for 90-9F,
+	 * 3 for A0-BF, 4 for C0-C1 and F8-FF, 5 for C2-DF, 6 for E0, 7 for E1-EF,
+	 * 8 for F0, 9 for F1-F7 */
+	static const UTF_UC8 s_class[256] =
+	{
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+		0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+		0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+		0x04, 0x04, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25,
+		0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25,
+		0x36, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37,
+		0x48, 0x49, 0x49, 0x49, 0x49, 0x49, 0x49, 0x49, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04
+	};
+	/* the next state by state + class; 0 accepts, 10 rejects */
+	static const UTF_UC8 s_state[70] =
+	{
+		 0, 10, 10, 10, 10, 20, 50, 30, 60, 40, /* accept (lead bytes) */
+		10, 10, 10, 10, 10, 10, 10, 10, 10, 10, /* reject */
+		10,  0,  0,  0, 10, 10, 10, 10, 10, 10, /* one trail byte to go */
+		10, 20, 20, 20, 10, 10, 10, 10, 10, 10, /* two trail bytes to go */
+		10, 30, 30, 30, 10, 10, 10, 10, 10, 10, /* three trail bytes to go */
+		10, 10, 10, 20, 10, 10, 10, 10, 10, 10, /* after E0: A0-BF */
+		10, 10, 30, 30, 10, 10, 10, 10, 10, 10  /* after F0: 90-BF */
+	};
+	static const UTF_UC8 s_lead_mask[5] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+	unsigned info = s_class[uj8[0]], state, next;
+	int i, count = UTF_STATIC_CAST(int, info >> 4);
+	UTF_UC32 cp = uj8[0], cp_next;
+
+	if (count == 1)
+	{
+		*uc32 = cp;
+		*bad = false;
+		return 1;
+	}
+	if (!count || count > uj8end - uj8)
+	{
+		*bad = true;
+		return count ? UTF_STATIC_CAST(int, uj8end - uj8) : 1;
+	}
 
-	for (; uj8 != uj8end; ++uj8)
+	state = s_state[info & 15];
+	cp &= s_lead_mask[count];
+	if (uj8end - uj8 >= 4)
 	{
-		count = UTF_uc8_count(*uj8);
-		if (!count)
+		/* always three steps; those past the sequence change nothing, which
+		 * compiles to conditional moves instead of a branch on the length */
+		for (i = 1; i < 4; ++i)
 		{
-			if (!UTF_DEFAULT_CHAR)
-			{
-				*uj16 = 0;
-				return UTF_INVALID;
-			}
-			if (uj16 == uj16end)
-			{
-				*uj16 = 0;
-				return UTF_INSUFFICIENT_BUFFER;
-			}
-			*uj16++ = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
-			continue;
+			next = s_state[state + (s_class[uj8[i]] & 15)];
+			cp_next = (cp << 6) | (uj8[i] & 0x3F);
+			state = (i < count) ? next : state;
+			cp = (i < count) ? cp_next : cp;
 		}
-
-		uc8[0] = *uj8;
+	}
+	else
+	{
 		for (i = 1; i < count; ++i)
 		{
-			if (++uj8 == uj8end)
-			{
-				if (!UTF_DEFAULT_CHAR)
-				{
-					*uj16 = 0;
-					return UTF_INVALID;
-				}
-				if (uj16 == uj16end)
-				{
-					*uj16 = 0;
-					return UTF_INSUFFICIENT_BUFFER;
-				}
-				*uj16++ = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
-				*uj16 = 0;
-				return UTF_SUCCESS;
-			}
-			uc8[i] = *uj8;
+			state = s_state[state + (s_class[uj8[i]] & 15)];
+			cp = (cp << 6) | (uj8[i] & 0x3F);
 		}
+	}
 
-		if (!UTF_uc8_to_uc16(uc8, uc16))
-		{
-			if (!UTF_DEFAULT_CHAR)
-			{
-				*uj16 = 0;
-				return UTF_INVALID;
-			}
-			uc16[0] = UTF_DEFAULT_CHAR;
-			uc16[1] = 0;
-		}
+	*uc32 = cp;
+	*bad = (state != 0);
+	return count;
+}
 
-		if (uj16 == uj16end)
-		{
-			*uj16 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
-		}
+/* internal: the code point at *puj8 as the converters decode it, or
+ * UTF_DEFAULT_CHAR for an ill-formed sequence; advances *puj8 past it */
+static inline UTF_UC32
+UTF_uj8_next_cp(const UTF_UC8 **puj8, const UTF_UC8 *uj8end)
+{
+	UTF_UC32 uc32 = 0;
+	bool bad;
+	*puj8 += UTF_uj8_decode(*puj8, uj8end, &uc32, &bad);
+	return (bad || uc32 > 0x10FFFF) ? UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR) : uc32;
+}
 
-		*uj16++ = uc16[0];
-		if (uc16[1])
+/* internal: the same for UTF-16 */
+static inline UTF_UC32
+UTF_uj16_next_cp(const UTF_UC16 **puj16, const UTF_UC16 *uj16end)
+{
+	const UTF_UC16 *uj16 = *puj16;
+	UTF_UC16 uc16[2];
+	UTF_UC32 uc32 = 0;
+	int count = 1;
+	bool bad = false;
+	uc16[0] = uj16[0];
+	uc16[1] = 0;
+	if (UTF_uc16_is_surrogate_high(uc16[0]))
+	{
+		if (uj16end - uj16 < 2)
+			bad = true;
+		else
 		{
-			if (uj16 == uj16end)
-			{
-				*uj16 = 0;
-				return UTF_INSUFFICIENT_BUFFER;
-			}
-			*uj16++ = uc16[1];
+			uc16[1] = uj16[1];
+			count = 2;
 		}
 	}
-	*uj16 = 0;
-	return UTF_SUCCESS;
+	if (!bad)
+		bad = !UTF_uc16_to_uc32(uc16, &uc32);
+	*puj16 = uj16 + count;
+	return bad ? UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR) : uc32;
 }
 
-static inline UTF_RET
-UTF_j8_to_uj16(const UTF_C8 *j8, UTF_SIZE_T j8size, UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+/* internal: the same for UTF-32 */
+static inline UTF_UC32
+UTF_uj32_next_cp(const UTF_UC32 **puj32)
 {
-	return UTF_uj8_to_uj16(UTF_REINTERPRET_CAST(const UTF_UC8 *, j8), j8size, uj16, uj16size);
+	UTF_UC32 uc32 = *(*puj32)++;
+	return (uc32 > 0x10FFFF) ? UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR) : uc32;
 }
 
-static inline UTF_RET
-UTF_uj8_to_uj32(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+/* UTF_uj8_cmp_uj16, UTF_uj8_cmp_uj32, UTF_uj16_cmp_uj32 --- compare counted
+ * strings of two encodings in code point order without converting them. An
+ * ill-formed sequence compares as the UTF_DEFAULT_CHAR it converts to. */
+static inline int
+UTF_uj8_cmp_uj16(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
 {
-	UTF_UC8 uc8[4];
-	UTF_UC32 uc32;
-	int i, count;
 	const UTF_UC8 *uj8end = uj8 + uj8size;
-	UTF_UC32 *uj32end = uj32 + uj32size - 1;
-
-	if (!uj32size && uj8size)
-		return UTF_INSUFFICIENT_BUFFER;
-
-	for (; uj8 != uj8end; ++uj8)
+	const UTF_UC16 *uj16end = uj16 + uj16size;
+	UTF_SIZE_T same, scalar = 0;
+	UTF_UC32 uc32a, uc32b;
+	while (uj8 != uj8end && uj16 != uj16end)
 	{
-		count = UTF_uc8_count(*uj8);
-		if (!count)
-		{
-			if (!UTF_DEFAULT_CHAR)
-			{
-				*uj32 = 0;
-				return UTF_INVALID;
-			}
-			uc32 = UTF_DEFAULT_CHAR;
-		}
-		else
+		if (scalar)
 		{
-			uc8[0] = *uj8;
-			for (i = 1; i < count; ++i)
-			{
-				if (++uj8 == uj8end)
-				{
-					if (!UTF_DEFAULT_CHAR)
-					{
-						*uj32 = 0;
-						return UTF_INVALID;
-					}
-					if (uj32 == uj32end)
-					{
-						*uj32 = 0;
-						return UTF_INSUFFICIENT_BUFFER;
-					}
-					*uj32++ = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
-					*uj32 = 0;
-					return UTF_SUCCESS;
-				}
-				uc8[i] = *uj8;
-			}
-
-			if (!UTF_uc8_to_uc32(uc8, &uc32))
-			{
-				*uj32 = 0;
-				return UTF_INVALID;
-			}
+			--scalar;
 		}
-
-		if (uj32 == uj32end)
+		else if (uj8end - uj8 >= 16 && uj16end - uj16 >= 16)
 		{
-			*uj32 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
+			same = UTF_simd_same_8_16(uj8, uj16);
+			uj8 += same;
+			uj16 += same;
+			if (same == 16)
+				continue;
+			/* not plain text here; decode a while before trying again */
+			if (!same)
+				scalar = 16;
 		}
-
-		*uj32++ = uc32;
+		uc32a = UTF_uj8_next_cp(&uj8, uj8end);
+		uc32b = UTF_uj16_next_cp(&uj16, uj16end);
+		if (uc32a != uc32b)
+			return (uc32a < uc32b) ? -1 : 1;
 	}
-	*uj32 = 0;
-	return UTF_SUCCESS;
+	if (uj8 != uj8end) return 1;
+	if (uj16 != uj16end) return -1;
+	return 0;
 }
 
-static inline UTF_RET
-UTF_j8_to_uj32(const UTF_C8 *j8, UTF_SIZE_T j8size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+static inline int
+UTF_uj8_cmp_uj32(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
 {
-	return UTF_uj8_to_uj32(UTF_REINTERPRET_CAST(const UTF_UC8 *, j8), j8size, uj32, uj32size);
+	const UTF_UC8 *uj8end = uj8 + uj8size;
+	const UTF_UC32 *uj32end = uj32 + uj32size;
+	UTF_SIZE_T same, scalar = 0;
+	UTF_UC32 uc32a, uc32b;
+	while (uj8 != uj8end && uj32 != uj32end)
+	{
+		if (scalar)
+		{
+			--scalar;
+		}
+		else if (uj8end - uj8 >= 16 && uj32end - uj32 >= 16)
+		{
+			same = UTF_simd_same_8_32(uj8, uj32);
+			uj8 += same;
+			uj32 += same;
+			if (same == 16)
+				continue;
+			/* not plain text here; decode a while before trying again */
+			if (!same)
+				scalar = 16;
+		}
+		uc32a = UTF_uj8_next_cp(&uj8, uj8end);
+		uc32b = UTF_uj32_next_cp(&uj32);
+		if (uc32a != uc32b)
+			return (uc32a < uc32b) ? -1 : 1;
+	}
+	if (uj8 != uj8end) return 1;
+	if (uj32 != uj32end) return -1;
+	return 0;
 }
 
-static inline UTF_RET
-UTF_uj16_to_uj8(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+static inline int
+UTF_uj16_cmp_uj32(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
 {
-	UTF_UC16 uc16[2];
-	UTF_UC8 uc8[4];
 	const UTF_UC16 *uj16end = uj16 + uj16size;
-	UTF_UC8 *uj8end = uj8 + uj8size - 1;
-
-	if (!uj8size && uj16size)
-		return UTF_INSUFFICIENT_BUFFER;
-
-	for (; uj16 != uj16end; ++uj16)
+	const UTF_UC32 *uj32end = uj32 + uj32size;
+	UTF_SIZE_T same, scalar = 0;
+	UTF_UC32 uc32a, uc32b;
+	while (uj16 != uj16end && uj32 != uj32end)
 	{
-		if (UTF_uc16_is_surrogate_high(*uj16))
+		if (scalar)
 		{
-			uc16[0] = *uj16;
-			if (++uj16 == uj16end)
-			{
-				if (!UTF_DEFAULT_CHAR)
-				{
-					*uj8 = 0;
-					return UTF_INVALID;
-				}
-				if (uj8 == uj8end)
-				{
-					*uj8 = 0;
-					return UTF_INSUFFICIENT_BUFFER;
-				}
-				*uj8++ = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
-				*uj8 = 0;
-				return UTF_SUCCESS;
-			}
-			uc16[1] = *uj16;
+			--scalar;
 		}
-		else
+		else if (uj16end - uj16 >= 8 && uj32end - uj32 >= 8)
 		{
-			uc16[0] = *uj16;
-			uc16[1] = 0;
+			same = UTF_simd_same_16_32(uj16, uj32);
+			uj16 += same;
+			uj32 += same;
+			if (same == 8)
+				continue;
+			/* not plain text here; decode a while before trying again */
+			if (!same)
+				scalar = 8;
 		}
+		uc32a = UTF_uj16_next_cp(&uj16, uj16end);
+		uc32b = UTF_uj32_next_cp(&uj32);
+		if (uc32a != uc32b)
+			return (uc32a < uc32b) ? -1 : 1;
+	}
+	if (uj16 != uj16end) return 1;
+	if (uj32 != uj32end) return -1;
+	return 0;
+}
+
+static inline bool
+UTF_uj8_equal_uj16(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_uj8_cmp_uj16(uj8, uj8size, uj16, uj16size) == 0;
+}
+
+static inline bool
+UTF_uj8_equal_uj32(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_uj8_cmp_uj32(uj8, uj8size, uj32, uj32size) == 0;
+}
+
+static inline bool
+UTF_uj16_equal_uj32(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_uj16_cmp_uj32(uj16, uj16size, uj32, uj32size) == 0;
+}
+
+/* UTF_HASH --- a 64-bit hash of a sequence of code points, so the same text
+ * hashes the same in every encoding. Code points are paired into 64-bit
+ * words which go round four lanes. Not for cryptographic use. */
+typedef struct UTF_HASH
+{
+	uint64_t lanes[4];
+	uint64_t count;		/* code points hashed */
+	UTF_UC32 pending;	/* the first of a pair when count is odd */
+} UTF_HASH;
+
+static inline void
+UTF_hash_init(UTF_HASH *state, uint64_t seed)
+{
+	state->lanes[0] = seed ^ 0x243F6A8885A308D3ULL;
+	state->lanes[1] = seed ^ 0x13198A2E03707344ULL;
+	state->lanes[2] = seed ^ 0xA4093822299F31D0ULL;
+	state->lanes[3] = seed ^ 0x082EFA98EC4E6C89ULL;
+	state->count = 0;
+	state->pending = 0;
+}
+
+/* internal */
+static inline uint64_t
+UTF_hash_mix(uint64_t lane, uint64_t word)
+{
+	lane ^= word;
+	lane = (lane << 29) | (lane >> 35);
+	return lane * 0x9E3779B97F4A7C15ULL;
+}
+
+/* internal */
+static inline uint64_t
+UTF_hash_avalanche(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDULL;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+/* internal: adds one code point */
+static inline void
+UTF_hash_cp(UTF_HASH *state, UTF_UC32 uc32)
+{
+	uint64_t *lane;
+	if (state->count & 1)
+	{
+		lane = &state->lanes[(state->count >> 1) & 3];
+		*lane = UTF_hash_mix(*lane, state->pending | (UTF_STATIC_CAST(uint64_t, uc32) << 32));
+	}
+	else
+	{
+		state->pending = uc32;
+	}
+	++state->count;
+}
 
-		if (!UTF_uc16_to_uc8(uc16, uc8))
+/* internal: adds 8 or 16 code points while count is even */
+static inline void
+UTF_hash_cps(UTF_HASH *state, const uint32_t *cps, int n)
+{
+	int i, base = UTF_STATIC_CAST(int, state->count >> 1);
+	uint64_t lanes[4];
+	for (i = 0; i < 4; ++i)
+		lanes[i] = state->lanes[(base + i) & 3];
+	for (i = 0; i < n; i += 8)
+	{
+		lanes[0] = UTF_hash_mix(lanes[0], cps[i + 0] | (UTF_STATIC_CAST(uint64_t, cps[i + 1]) << 32));
+		lanes[1] = UTF_hash_mix(lanes[1], cps[i + 2] | (UTF_STATIC_CAST(uint64_t, cps[i + 3]) << 32));
+		lanes[2] = UTF_hash_mix(lanes[2], cps[i + 4] | (UTF_STATIC_CAST(uint64_t, cps[i + 5]) << 32));
+		lanes[3] = UTF_hash_mix(lanes[3], cps[i + 6] | (UTF_STATIC_CAST(uint64_t, cps[i + 7]) << 32));
+	}
+	for (i = 0; i < 4; ++i)
+		state->lanes[(base + i) & 3] = lanes[i];
+	state->count += UTF_STATIC_CAST(uint64_t, n);
+}
+
+/* UTF_hash_uj8, UTF_hash_uj16, UTF_hash_uj32 --- add text, which may be fed
+ * in pieces that end on code point boundaries. Ill-formed sequences hash as
+ * UTF_DEFAULT_CHAR, like UTF_uj8_cmp_uj16 and friends compare them. */
+static inline void
+UTF_hash_uj8(UTF_HASH *state, const UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	const UTF_UC8 *uj8end = uj8 + uj8size, *scalar_end = uj8;
+	uint32_t cps[16];
+	UTF_HASH local = *state;  /* keeps the lanes out of memory */
+	while (uj8 != uj8end)
+	{
+		if (uj8 >= scalar_end && !(local.count & 1) && uj8end - uj8 >= 16)
 		{
-			if (!UTF_DEFAULT_CHAR)
+			if (UTF_simd_widen_ascii(uj8, cps))
 			{
-				*uj8 = 0;
-				return UTF_INVALID;
+				UTF_hash_cps(&local, cps, 16);
+				uj8 += 16;
+				continue;
 			}
-			uc16[0] = UTF_DEFAULT_CHAR;
-			uc16[1] = 0;
+			/* not ASCII here; decode these bytes before trying again */
+			scalar_end = uj8 + 16;
 		}
+		UTF_hash_cp(&local, UTF_uj8_next_cp(&uj8, uj8end));
+	}
+	*state = local;
+}
 
-		if (uj8 == uj8end)
+static inline void
+UTF_hash_uj16(UTF_HASH *state, const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	const UTF_UC16 *uj16end = uj16 + uj16size, *scalar_end = uj16;
+	uint32_t cps[8];
+	UTF_HASH local = *state;  /* keeps the lanes out of memory */
+	while (uj16 != uj16end)
+	{
+		if (uj16 >= scalar_end && !(local.count & 1) && uj16end - uj16 >= 8)
 		{
-			*uj8 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
+			if (UTF_simd_widen_bmp(uj16, cps))
+			{
+				UTF_hash_cps(&local, cps, 8);
+				uj16 += 8;
+				continue;
+			}
+			scalar_end = uj16 + 8;
 		}
+		UTF_hash_cp(&local, UTF_uj16_next_cp(&uj16, uj16end));
+	}
+	*state = local;
+}
 
-		*uj8++ = uc8[0];
-		if (uc8[1])
+static inline void
+UTF_hash_uj32(UTF_HASH *state, const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	const UTF_UC32 *uj32end = uj32 + uj32size;
+	uint32_t cps[16];
+	int i;
+	while (uj32 != uj32end)
+	{
+		if (!(state->count & 1) && uj32end - uj32 >= 16)
 		{
-			if (uj8 == uj8end)
-			{
-				*uj8 = 0;
-				return UTF_INSUFFICIENT_BUFFER;
-			}
-			*uj8++ = uc8[1];
-			if (uc8[2])
+			for (i = 0; i < 16 && uj32[i] <= 0x10FFFF; ++i)
+				cps[i] = uj32[i];
+			if (i == 16)
 			{
-				if (uj8 == uj8end)
-				{
-					*uj8 = 0;
-					return UTF_INSUFFICIENT_BUFFER;
-				}
-				*uj8++ = uc8[2];
-				if (uc8[3])
-				{
-					if (uj8 == uj8end)
-					{
-						*uj8 = 0;
-						return UTF_INSUFFICIENT_BUFFER;
-					}
-					*uj8++ = uc8[3];
-				}
+				UTF_hash_cps(state, cps, 16);
+				uj32 += 16;
+				continue;
 			}
 		}
+		UTF_hash_cp(state, UTF_uj32_next_cp(&uj32));
 	}
-	*uj8 = 0;
-	return UTF_SUCCESS;
 }
 
-static inline UTF_RET
-UTF_uj16_to_j8(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_C8 *j8, UTF_SIZE_T c8size)
+static inline uint64_t
+UTF_hash_final(const UTF_HASH *state)
 {
-	return UTF_uj16_to_uj8(uj16, uj16size, UTF_REINTERPRET_CAST(UTF_UC8 *, j8), c8size);
+	uint64_t value = UTF_hash_avalanche(state->count);
+	int i;
+	for (i = 0; i < 4; ++i)
+		value = UTF_hash_avalanche(value ^ state->lanes[i]);
+	if (state->count & 1)
+		value = UTF_hash_avalanche(value ^ state->pending);
+	return value;
 }
 
-static inline UTF_RET
-UTF_uj16_to_uj32(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+/* UTF_uj8_hash, UTF_uj16_hash, UTF_uj32_hash --- one-shot versions */
+static inline uint64_t
+UTF_uj8_hash(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, uint64_t seed)
 {
-	UTF_UC16 uc16[2];
-	UTF_UC32 uc32;
-	const UTF_UC16 *uj16end = uj16 + uj16size;
-	UTF_UC32 *uj32end = uj32 + uj32size - 1;
+	UTF_HASH state;
+	UTF_hash_init(&state, seed);
+	UTF_hash_uj8(&state, uj8, uj8size);
+	return UTF_hash_final(&state);
+}
+
+static inline uint64_t
+UTF_uj16_hash(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, uint64_t seed)
+{
+	UTF_HASH state;
+	UTF_hash_init(&state, seed);
+	UTF_hash_uj16(&state, uj16, uj16size);
+	return UTF_hash_final(&state);
+}
+
+static inline uint64_t
+UTF_uj32_hash(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, uint64_t seed)
+{
+	UTF_HASH state;
+	UTF_hash_init(&state, seed);
+	UTF_hash_uj32(&state, uj32, uj32size);
+	return UTF_hash_final(&state);
+}
+
+static inline UTF_UC16
+UTF16_XE(UTF_UC16 uc16)
+{
+	UTF_UC8 lo = (UTF_UC8)uc16;
+	UTF_UC8 hi = (UTF_UC8)(uc16 >> 8);
+	return (((UTF_UC16)lo) << 8) | hi;
+}
+
+static inline UTF_UC32
+UTF32_XE(UTF_UC32 uc32)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_bswap32(uc32);
+#elif defined(_MSC_VER)
+	return _byteswap_ulong(uc32);
+#else
+	UTF_UC8 lolo = (UTF_UC8)uc32;
+	UTF_UC8 lohi = (UTF_UC8)(uc32 >> 8);
+	UTF_UC8 hilo = (UTF_UC8)(uc32 >> 16);
+	UTF_UC8 hihi = (UTF_UC8)(uc32 >> 24);
+	return ((UTF_UC32)lolo << 24) |
+		   ((UTF_UC32)lohi << 16) |
+		   ((UTF_UC32)hilo << 8) | hihi;
+#endif
+}
+
+/* UTF_ENC --- the encodings of UTF_transcode. UTF_ENC_16 and UTF_ENC_32 are in
+ * the byte order of the machine; the XE ones are byte-swapped, as the
+ * UTF16XE_* and UTF32XE_* readers. */
+typedef enum UTF_ENC
+{
+	UTF_ENC_8,
+	UTF_ENC_16,
+	UTF_ENC_16XE,
+	UTF_ENC_32,
+	UTF_ENC_32XE
+} UTF_ENC;
+
+/* UTF_ENC_16LE, UTF_ENC_16BE, UTF_ENC_32LE, UTF_ENC_32BE --- by byte order */
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) || defined(__BIG_ENDIAN__)
+	#define UTF_ENC_16LE UTF_ENC_16XE
+	#define UTF_ENC_16BE UTF_ENC_16
+	#define UTF_ENC_32LE UTF_ENC_32XE
+	#define UTF_ENC_32BE UTF_ENC_32
+#else
+	#define UTF_ENC_16LE UTF_ENC_16
+	#define UTF_ENC_16BE UTF_ENC_16XE
+	#define UTF_ENC_32LE UTF_ENC_32
+	#define UTF_ENC_32BE UTF_ENC_32XE
+#endif
+
+/* UTF_enc_unit_size --- the bytes of a unit: sizeof(UTF_UC16) is 4 where
+ * UTF_WIDE_IS_UTF16 makes it a 32-bit wchar_t */
+static inline UTF_CONSTEXPR int
+UTF_enc_unit_size(UTF_ENC enc)
+{
+	return (enc == UTF_ENC_8) ? 1 :
+		   (enc == UTF_ENC_16 || enc == UTF_ENC_16XE) ? UTF_STATIC_CAST(int, sizeof(UTF_UC16)) :
+		   UTF_STATIC_CAST(int, sizeof(UTF_UC32));
+}
+
+/* internal: the unit at units[i] in the byte order of the machine */
+static inline UTF_UC32
+UTF_enc_load(UTF_ENC enc, const void *units, UTF_SIZE_T i)
+{
+	switch (enc)
+	{
+	case UTF_ENC_8:
+		return UTF_STATIC_CAST(const UTF_UC8 *, units)[i];
+	case UTF_ENC_16:
+		return UTF_STATIC_CAST(const UTF_UC16 *, units)[i];
+	case UTF_ENC_16XE:
+		return UTF16_XE(UTF_STATIC_CAST(const UTF_UC16 *, units)[i]);
+	case UTF_ENC_32:
+		return UTF_STATIC_CAST(const UTF_UC32 *, units)[i];
+	default:
+		return UTF32_XE(UTF_STATIC_CAST(const UTF_UC32 *, units)[i]);
+	}
+}
+
+static inline void
+UTF_enc_store(UTF_ENC enc, void *units, UTF_SIZE_T i, UTF_UC32 unit)
+{
+	switch (enc)
+	{
+	case UTF_ENC_8:
+		UTF_STATIC_CAST(UTF_UC8 *, units)[i] = UTF_STATIC_CAST(UTF_UC8, unit);
+		break;
+	case UTF_ENC_16:
+		UTF_STATIC_CAST(UTF_UC16 *, units)[i] = UTF_STATIC_CAST(UTF_UC16, unit);
+		break;
+	case UTF_ENC_16XE:
+		UTF_STATIC_CAST(UTF_UC16 *, units)[i] = UTF16_XE(UTF_STATIC_CAST(UTF_UC16, unit));
+		break;
+	case UTF_ENC_32:
+		UTF_STATIC_CAST(UTF_UC32 *, units)[i] = unit;
+		break;
+	default:
+		UTF_STATIC_CAST(UTF_UC32 *, units)[i] = UTF32_XE(unit);
+		break;
+	}
+}
 
-	if (!uj32size && uj16size)
-		return UTF_INSUFFICIENT_BUFFER;
+/* internal: decodes the sequence at src[i] (before src[size]) as the
+ * converters do; returns its length in units and sets *bad if ill-formed.
+ * A UTF-16 high surrogate takes the next unit with it: a low surrogate
+ * makes a pair, NUL leaves the high surrogate alone, anything else is
+ * ill-formed. Lone low surrogates pass. */
+UTF_FORCEINLINE int
+UTF_enc_decode(UTF_ENC enc, const void *src, UTF_SIZE_T i, UTF_SIZE_T size, UTF_UC32 *uc32, bool *bad)
+{
+	UTF_UC32 high, low;
+	switch (enc)
+	{
+	case UTF_ENC_8:
+		return UTF_uj8_decode(UTF_STATIC_CAST(const UTF_UC8 *, src) + i,
+							  UTF_STATIC_CAST(const UTF_UC8 *, src) + size, uc32, bad);
+	case UTF_ENC_16:
+	case UTF_ENC_16XE:
+		high = UTF_enc_load(enc, src, i);
+		*uc32 = high;
+		*bad = false;
+		if (high < 0xD800 || 0xDC00 <= high)
+			return 1;
+		if (size - i < 2)
+		{
+			*bad = true;
+			return 1;
+		}
+		low = UTF_enc_load(enc, src, i + 1);
+		if (0xDC00 <= low && low < 0xE000)
+			*uc32 = 0x10000 + (high - 0xD800) * 0x400 + (low - 0xDC00);
+		else
+			*bad = (low != 0);
+		return 2;
+	default:
+		*uc32 = UTF_enc_load(enc, src, i);
+		*bad = false;
+		return 1;
+	}
+}
 
-	for (; uj16 != uj16end; ++uj16)
+/* UTF_transcode --- converts src_size units of src in src_enc to dst in
+ * dst_enc, which has room for dst_size units including the terminating NUL.
+ * An ill-formed sequence, or a code point above U+10FFFF for a UTF-8 or
+ * UTF-16 destination, becomes default_char, or stops the conversion with
+ * UTF_INVALID if default_char is 0. Returns UTF_INSUFFICIENT_BUFFER when dst
+ * is full. *src_used and *dst_used (either may be NULL) receive the units
+ * consumed and written before the NUL; stats may be NULL as well.
+ *
+ * This is the engine of all the UTF_uj*_to_uj* converters. It is always
+ * inlined, so each converter gets a loop specialized for its encodings. */
+UTF_FORCEINLINE UTF_RET
+UTF_transcode(UTF_ENC src_enc, const void *src, UTF_SIZE_T src_size, UTF_SIZE_T *src_used,
+			  UTF_ENC dst_enc, void *dst, UTF_SIZE_T dst_size, UTF_SIZE_T *dst_used,
+			  UTF_UC32 default_char, UTF_STATS *stats)
+{
+	UTF_SIZE_T s = 0, d = 0, scalar_end = 0, room = dst_size ? dst_size - 1 : 0;
+	UTF_UC32 uc32 = 0;
+	/* below limit, a code point is one unit in both encodings */
+	UTF_UC32 limit = (src_enc == UTF_ENC_8 || dst_enc == UTF_ENC_8) ? 0x80 : 0xD800;
+	uint64_t any;
+	int i, count, len;
+	bool bad;
+	bool pairs = (src_enc == UTF_ENC_16 || src_enc == UTF_ENC_16XE ||
+				  dst_enc == UTF_ENC_16 || dst_enc == UTF_ENC_16XE);
+	UTF_RET ret = UTF_SUCCESS;
+
+	if (!dst_size && src_size)
+		ret = UTF_INSUFFICIENT_BUFFER;
+
+	while (ret == UTF_SUCCESS && s < src_size)
 	{
-		if (UTF_uc16_is_surrogate_high(*uj16))
+		/* a unit below limit is copied as is; next to UTF-8, eight at a time
+		 * where possible, or else the next eight one by one */
+		uc32 = UTF_enc_load(src_enc, src, s);
+		if (uc32 < limit && room != d)
 		{
-			uc16[0] = *uj16;
-			if (++uj16 == uj16end)
+			if (limit == 0x80 && s >= scalar_end && src_size - s >= 8 && room - d >= 8)
 			{
-				if (!UTF_DEFAULT_CHAR)
+				if (src_enc == UTF_ENC_8)
 				{
-					*uj32 = 0;
-					return UTF_INVALID;
+					any = UTF_swar_load64(UTF_STATIC_CAST(const UTF_UC8 *, src) + s) & 0x8080808080808080ULL;
 				}
-				if (uj32 == uj32end)
+				else
 				{
-					*uj32 = 0;
-					return UTF_INSUFFICIENT_BUFFER;
+					any = 0;
+					for (i = 1; i < 8; ++i)
+						any |= (UTF_enc_load(src_enc, src, s + i) >= limit);
+				}
+				if (!any)
+				{
+					for (i = 0; i < 8; ++i)
+						UTF_enc_store(dst_enc, dst, d + i, UTF_enc_load(src_enc, src, s + i));
+					if (stats)
+					{
+						for (i = 0; i < 8; ++i)
+							UTF_stats_cp(stats, UTF_enc_load(src_enc, src, s + i), false);
+					}
+					s += 8;
+					d += 8;
+					continue;
 				}
-				*uj32++ = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
-				*uj32 = 0;
-				return UTF_SUCCESS;
+				scalar_end = s + 8;
+			}
+			UTF_enc_store(dst_enc, dst, d++, uc32);
+			if (stats)
+				UTF_stats_cp(stats, uc32, false);
+			++s;
+			continue;
+		}
+
+		count = UTF_enc_decode(src_enc, src, s, src_size, &uc32, &bad);
+		if (uc32 > 0x10FFFF && dst_enc != UTF_ENC_32 && dst_enc != UTF_ENC_32XE)
+			bad = true;
+
+		if (bad)
+		{
+			if (!default_char)
+			{
+				if (stats)
+					UTF_stats_error(stats, UTF_STATIC_CAST(ptrdiff_t, s), false);
+				ret = UTF_INVALID;
+				break;
 			}
-			uc16[1] = *uj16;
+			uc32 = default_char;
 		}
+
+		if (dst_enc == UTF_ENC_8)
+			len = UTF_uc32_len8(uc32);
+		else if (dst_enc == UTF_ENC_16 || dst_enc == UTF_ENC_16XE)
+			len = 1 + (uc32 >= 0x10000);
 		else
+			len = 1;
+		if (room - d < UTF_STATIC_CAST(UTF_SIZE_T, len))
 		{
-			uc16[0] = *uj16;
-			uc16[1] = 0;
+			ret = UTF_INSUFFICIENT_BUFFER;
+			break;
 		}
 
-		if (!UTF_uc16_to_uc32(uc16, &uc32))
+		if (len == 1)
 		{
-			if (!UTF_DEFAULT_CHAR)
+			UTF_enc_store(dst_enc, dst, d, uc32);
+		}
+		else if (dst_enc == UTF_ENC_8)
+		{
+			/* as UTF_uc32_to_uc8, straight into dst */
+			UTF_enc_store(dst_enc, dst, d + len - 1, 0x80 | (uc32 & 0x3F));
+			if (len == 2)
 			{
-				*uj32 = 0;
-				return UTF_INVALID;
+				UTF_enc_store(dst_enc, dst, d, 0xC0 | (uc32 >> 6));
 			}
-			uc32 = UTF_DEFAULT_CHAR;
+			else
+			{
+				UTF_enc_store(dst_enc, dst, d + len - 2, 0x80 | ((uc32 >> 6) & 0x3F));
+				if (len == 3)
+				{
+					UTF_enc_store(dst_enc, dst, d, 0xE0 | (uc32 >> 12));
+				}
+				else
+				{
+					UTF_enc_store(dst_enc, dst, d + 1, 0x80 | ((uc32 >> 12) & 0x3F));
+					UTF_enc_store(dst_enc, dst, d, 0xF0 | (uc32 >> 18));
+				}
+			}
+		}
+		else
+		{
+			UTF_enc_store(dst_enc, dst, d, 0xD800 + ((uc32 - 0x10000) >> 10));
+			UTF_enc_store(dst_enc, dst, d + 1, 0xDC00 + (uc32 & 0x3FF));
 		}
+		d += len;
 
-		if (uj32 == uj32end)
+		if (stats)
 		{
-			*uj32 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
+			if (bad)
+				UTF_stats_error(stats, UTF_STATIC_CAST(ptrdiff_t, s), true);
+			else
+				UTF_stats_cp(stats, uc32, pairs && uc32 >= 0x10000);
 		}
-		*uj32++ = uc32;
+		s += count;
 	}
-	*uj32 = 0;
-	return UTF_SUCCESS;
+
+	if (dst_size)
+		UTF_enc_store(dst_enc, dst, d, 0);
+	if (stats)
+		UTF_stats_finish(stats, UTF_STATIC_CAST(ptrdiff_t, s), UTF_enc_unit_size(src_enc));
+	if (src_used)
+		*src_used = s;
+	if (dst_used)
+		*dst_used = d;
+	return ret;
 }
 
-static inline UTF_RET
-UTF_uj32_to_uj8(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+/* UTF_transcode_max --- the most units UTF_transcode can write to dst_enc
+ * for src_size units in src_enc, terminating NUL included: each source unit
+ * becomes at most 1, or 3 (UTF-16 to UTF-8), 4 (UTF-32 to UTF-8) or 2
+ * (UTF-32 to UTF-16) units. */
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_transcode_max(UTF_ENC src_enc, UTF_SIZE_T src_size, UTF_ENC dst_enc)
 {
-	UTF_UC8 uc8[4];
-	const UTF_UC32 *uj32end = uj32 + uj32size;
-	UTF_UC8 *uj8end = uj8 + uj8size - 1;
+	/* by encoding, not by unit size, which is the same for UTF-16 and UTF-32
+	 * under a 32-bit UTF_WIDE_IS_UTF16 */
+	int src_16 = (src_enc == UTF_ENC_16 || src_enc == UTF_ENC_16XE);
+	int dst_16 = (dst_enc == UTF_ENC_16 || dst_enc == UTF_ENC_16XE);
+	UTF_SIZE_T growth = 1;
+	if (dst_enc == UTF_ENC_8)
+		growth = (src_enc == UTF_ENC_8) ? 1 : src_16 ? 3 : 4;
+	else if (dst_16 && src_enc != UTF_ENC_8 && !src_16)
+		growth = 2;
+	return src_size * growth + 1;
+}
 
-	if (!uj8size && uj32size)
-		return UTF_INSUFFICIENT_BUFFER;
+/* UTF_transcode_size --- the number of units UTF_transcode needs in dst for
+ * src, including the terminating NUL, or 0 if src is ill-formed and
+ * default_char is 0. Only counts: ASCII is skipped eight bytes at a time and
+ * nothing is stored. */
+UTF_FORCEINLINE UTF_SIZE_T
+UTF_transcode_size(UTF_ENC src_enc, const void *src, UTF_SIZE_T src_size, UTF_ENC dst_enc,
+				   UTF_UC32 default_char)
+{
+	UTF_SIZE_T s = 0, d = 0;
+	UTF_UC32 uc32 = 0;
+	UTF_UC32 limit = (src_enc == UTF_ENC_8 || dst_enc == UTF_ENC_8) ? 0x80 : 0xD800;
+	int count;
+	bool bad;
 
-	for (; uj32 != uj32end; ++uj32)
+	while (s != src_size)
 	{
-		if (!UTF_uc32_to_uc8(*uj32, uc8))
+		if (src_enc == UTF_ENC_8 && src_size - s >= 8 &&
+			!(UTF_swar_load64(UTF_STATIC_CAST(const UTF_UC8 *, src) + s) & 0x8080808080808080ULL))
 		{
-			if (!UTF_DEFAULT_CHAR)
-			{
-				*uj8 = 0;
-				return UTF_INVALID;
-			}
-			uc8[0] = UTF_DEFAULT_CHAR;
-			uc8[1] = 0;
+			s += 8;
+			d += 8;
+			continue;
 		}
 
-		if (uj8 == uj8end)
+		uc32 = UTF_enc_load(src_enc, src, s);
+		if (uc32 < limit)
 		{
-			*uj8 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
+			++s;
+			++d;
+			continue;
 		}
 
-		*uj8++ = uc8[0];
-		if (uc8[1])
+		count = UTF_enc_decode(src_enc, src, s, src_size, &uc32, &bad);
+		if (uc32 > 0x10FFFF && dst_enc != UTF_ENC_32 && dst_enc != UTF_ENC_32XE)
+			bad = true;
+		if (bad)
 		{
-			if (uj8 == uj8end)
-			{
-				*uj8 = 0;
-				return UTF_INSUFFICIENT_BUFFER;
-			}
-
-			*uj8++ = uc8[1];
-			if (uc8[2])
-			{
-				if (uj8 == uj8end)
-				{
-					*uj8 = 0;
-					return UTF_INSUFFICIENT_BUFFER;
-				}
-
-				*uj8++ = uc8[2];
-				if (uc8[3])
-				{
-					if (uj8 == uj8end)
-					{
-						*uj8 = 0;
-						return UTF_INSUFFICIENT_BUFFER;
-					}
-					*uj8++ = uc8[3];
-				}
-			}
+			if (!default_char)
+				return 0;
+			uc32 = default_char;
 		}
+
+		if (dst_enc == UTF_ENC_8)
+			d += UTF_STATIC_CAST(UTF_SIZE_T, UTF_uc32_len8(uc32));
+		else if (dst_enc == UTF_ENC_16 || dst_enc == UTF_ENC_16XE)
+			d += 1 + (uc32 >= 0x10000);
+		else
+			++d;
+		s += count;
 	}
-	*uj8 = 0;
-	return UTF_SUCCESS;
+
+	return d + 1;
+}
+
+/* internal: UTF_transcode with UTF_DEFAULT_CHAR into a buffer from
+ * UTF_MALLOC of exactly the size needed; NULL if src is ill-formed and
+ * UTF_DEFAULT_CHAR is 0, or if out of memory. *dst_used (may be NULL)
+ * receives the units before the NUL. */
+UTF_FORCEINLINE void *
+UTF_transcode_alloc(UTF_ENC src_enc, const void *src, UTF_SIZE_T src_size, UTF_ENC dst_enc,
+					UTF_SIZE_T *dst_used)
+{
+	UTF_UC32 default_char = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
+	void *dst;
+	UTF_SIZE_T size = UTF_transcode_size(src_enc, src, src_size, dst_enc, default_char);
+	if (!size)
+		return NULL;
+
+	dst = UTF_MALLOC(size * UTF_STATIC_CAST(UTF_SIZE_T, UTF_enc_unit_size(dst_enc)));
+	if (!dst)
+		return NULL;
+
+	UTF_transcode(src_enc, src, src_size, NULL, dst_enc, dst, size, NULL, default_char, NULL);
+	if (dst_used)
+		*dst_used = size - 1;
+	return dst;
+}
+
+static inline UTF_RET
+UTF_uj8_to_uj16_ex(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC16 *uj16, UTF_SIZE_T uj16size,
+				   UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj8_to_uj16, uj8size);
+	ret = UTF_transcode(UTF_ENC_8, uj8, uj8size, NULL, UTF_ENC_16, uj16, uj16size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj8_to_uj16, uj8size);
+	return ret;
+}
+
+static inline UTF_RET
+UTF_uj8_to_uj16(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_uj8_to_uj16_ex(uj8, uj8size, uj16, uj16size, NULL);
+}
+
+/* UTF_uj8_to_uj16_size --- the size that UTF_uj8_to_uj16 needs for uj16,
+ * terminating NUL included, or 0 if uj8 is ill-formed and UTF_DEFAULT_CHAR
+ * is 0; likewise the other *_size functions. */
+static inline UTF_SIZE_T
+UTF_uj8_to_uj16_size(const UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	return UTF_transcode_size(UTF_ENC_8, uj8, uj8size, UTF_ENC_16, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+/* UTF_uj8_to_uj16_max --- a size for uj16 that UTF_uj8_to_uj16 never
+ * exceeds for uj8size units, without looking at them; likewise the other
+ * *_max functions. */
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj8_to_uj16_max(UTF_SIZE_T uj8size)
+{
+	return UTF_transcode_max(UTF_ENC_8, uj8size, UTF_ENC_16);
+}
+
+/* UTF_uj8_to_uj16_alloc --- converts into a NUL-terminated buffer from
+ * UTF_MALLOC of exactly the needed size; *uj16size (may be NULL) receives its
+ * length without the NUL. Returns NULL if uj8 is ill-formed and
+ * UTF_DEFAULT_CHAR is 0, or if out of memory. Release the result with
+ * UTF_FREE; likewise the other *_alloc functions. */
+static inline UTF_UC16 *
+UTF_uj8_to_uj16_alloc(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_SIZE_T *uj16size)
+{
+	return UTF_STATIC_CAST(UTF_UC16 *, UTF_transcode_alloc(UTF_ENC_8, uj8, uj8size, UTF_ENC_16, uj16size));
+}
+
+static inline UTF_RET
+UTF_j8_to_uj16(const UTF_C8 *j8, UTF_SIZE_T j8size, UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_uj8_to_uj16(UTF_REINTERPRET_CAST(const UTF_UC8 *, j8), j8size, uj16, uj16size);
+}
+
+static inline UTF_RET
+UTF_uj8_to_uj32_ex(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC32 *uj32, UTF_SIZE_T uj32size,
+				   UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj8_to_uj32, uj8size);
+	ret = UTF_transcode(UTF_ENC_8, uj8, uj8size, NULL, UTF_ENC_32, uj32, uj32size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj8_to_uj32, uj8size);
+	return ret;
+}
+
+static inline UTF_RET
+UTF_uj8_to_uj32(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_uj8_to_uj32_ex(uj8, uj8size, uj32, uj32size, NULL);
+}
+
+static inline UTF_SIZE_T
+UTF_uj8_to_uj32_size(const UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	return UTF_transcode_size(UTF_ENC_8, uj8, uj8size, UTF_ENC_32, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj8_to_uj32_max(UTF_SIZE_T uj8size)
+{
+	return UTF_transcode_max(UTF_ENC_8, uj8size, UTF_ENC_32);
+}
+
+static inline UTF_UC32 *
+UTF_uj8_to_uj32_alloc(const UTF_UC8 *uj8, UTF_SIZE_T uj8size, UTF_SIZE_T *uj32size)
+{
+	return UTF_STATIC_CAST(UTF_UC32 *, UTF_transcode_alloc(UTF_ENC_8, uj8, uj8size, UTF_ENC_32, uj32size));
+}
+
+static inline UTF_RET
+UTF_j8_to_uj32(const UTF_C8 *j8, UTF_SIZE_T j8size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_uj8_to_uj32(UTF_REINTERPRET_CAST(const UTF_UC8 *, j8), j8size, uj32, uj32size);
+}
+
+static inline UTF_RET
+UTF_uj16_to_uj8_ex(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC8 *uj8, UTF_SIZE_T uj8size,
+				   UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj16_to_uj8, uj16size);
+	ret = UTF_transcode(UTF_ENC_16, uj16, uj16size, NULL, UTF_ENC_8, uj8, uj8size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj16_to_uj8, uj16size);
+	return ret;
+}
+
+static inline UTF_RET
+UTF_uj16_to_uj8(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	return UTF_uj16_to_uj8_ex(uj16, uj16size, uj8, uj8size, NULL);
+}
+
+static inline UTF_SIZE_T
+UTF_uj16_to_uj8_size(const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_transcode_size(UTF_ENC_16, uj16, uj16size, UTF_ENC_8, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj16_to_uj8_max(UTF_SIZE_T uj16size)
+{
+	return UTF_transcode_max(UTF_ENC_16, uj16size, UTF_ENC_8);
+}
+
+static inline UTF_UC8 *
+UTF_uj16_to_uj8_alloc(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_SIZE_T *uj8size)
+{
+	return UTF_STATIC_CAST(UTF_UC8 *, UTF_transcode_alloc(UTF_ENC_16, uj16, uj16size, UTF_ENC_8, uj8size));
+}
+
+static inline UTF_RET
+UTF_uj16_to_j8(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_C8 *j8, UTF_SIZE_T c8size)
+{
+	return UTF_uj16_to_uj8(uj16, uj16size, UTF_REINTERPRET_CAST(UTF_UC8 *, j8), c8size);
+}
+
+static inline UTF_RET
+UTF_uj16_to_uj32_ex(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC32 *uj32, UTF_SIZE_T uj32size,
+					UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj16_to_uj32, uj16size);
+	ret = UTF_transcode(UTF_ENC_16, uj16, uj16size, NULL, UTF_ENC_32, uj32, uj32size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj16_to_uj32, uj16size);
+	return ret;
+}
+
+static inline UTF_RET
+UTF_uj16_to_uj32(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_uj16_to_uj32_ex(uj16, uj16size, uj32, uj32size, NULL);
+}
+
+static inline UTF_SIZE_T
+UTF_uj16_to_uj32_size(const UTF_UC16 *uj16, UTF_SIZE_T uj16size)
+{
+	return UTF_transcode_size(UTF_ENC_16, uj16, uj16size, UTF_ENC_32, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj16_to_uj32_max(UTF_SIZE_T uj16size)
+{
+	return UTF_transcode_max(UTF_ENC_16, uj16size, UTF_ENC_32);
+}
+
+static inline UTF_UC32 *
+UTF_uj16_to_uj32_alloc(const UTF_UC16 *uj16, UTF_SIZE_T uj16size, UTF_SIZE_T *uj32size)
+{
+	return UTF_STATIC_CAST(UTF_UC32 *, UTF_transcode_alloc(UTF_ENC_16, uj16, uj16size, UTF_ENC_32, uj32size));
+}
+
+static inline UTF_RET
+UTF_uj32_to_uj8_ex(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_UC8 *uj8, UTF_SIZE_T uj8size,
+				   UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj32_to_uj8, uj32size);
+	ret = UTF_transcode(UTF_ENC_32, uj32, uj32size, NULL, UTF_ENC_8, uj8, uj8size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj32_to_uj8, uj32size);
+	return ret;
+}
+
+static inline UTF_RET
+UTF_uj32_to_uj8(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_UC8 *uj8, UTF_SIZE_T uj8size)
+{
+	return UTF_uj32_to_uj8_ex(uj32, uj32size, uj8, uj8size, NULL);
+}
+
+static inline UTF_SIZE_T
+UTF_uj32_to_uj8_size(const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_transcode_size(UTF_ENC_32, uj32, uj32size, UTF_ENC_8, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj32_to_uj8_max(UTF_SIZE_T uj32size)
+{
+	return UTF_transcode_max(UTF_ENC_32, uj32size, UTF_ENC_8);
+}
+
+static inline UTF_UC8 *
+UTF_uj32_to_uj8_alloc(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_SIZE_T *uj8size)
+{
+	return UTF_STATIC_CAST(UTF_UC8 *, UTF_transcode_alloc(UTF_ENC_32, uj32, uj32size, UTF_ENC_8, uj8size));
 }
 
 static inline UTF_RET
@@ -838,47 +1818,150 @@ UTF_uj32_to_j8(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_C8 *j8, UTF_SIZE_T
 	return UTF_uj32_to_uj8(uj32, uj32size, UTF_REINTERPRET_CAST(UTF_UC8 *, j8), j8size);
 }
 
+static inline UTF_RET
+UTF_uj32_to_uj16_ex(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_UC16 *uj16, UTF_SIZE_T uj16size,
+					UTF_STATS *stats)
+{
+	UTF_RET ret;
+	UTF_TRACE_ENTER(uj32_to_uj16, uj32size);
+	ret = UTF_transcode(UTF_ENC_32, uj32, uj32size, NULL, UTF_ENC_16, uj16, uj16size, NULL,
+						UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR), stats);
+	UTF_TRACE_EXIT(uj32_to_uj16, uj32size);
+	return ret;
+}
+
 static inline UTF_RET
 UTF_uj32_to_uj16(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_UC16 *uj16, UTF_SIZE_T uj16size)
 {
+	return UTF_uj32_to_uj16_ex(uj32, uj32size, uj16, uj16size, NULL);
+}
+
+static inline UTF_SIZE_T
+UTF_uj32_to_uj16_size(const UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	return UTF_transcode_size(UTF_ENC_32, uj32, uj32size, UTF_ENC_16, UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR));
+}
+
+static inline UTF_CONSTEXPR UTF_SIZE_T
+UTF_uj32_to_uj16_max(UTF_SIZE_T uj32size)
+{
+	return UTF_transcode_max(UTF_ENC_32, uj32size, UTF_ENC_16);
+}
+
+static inline UTF_UC16 *
+UTF_uj32_to_uj16_alloc(const UTF_UC32 *uj32, UTF_SIZE_T uj32size, UTF_SIZE_T *uj16size)
+{
+	return UTF_STATIC_CAST(UTF_UC16 *, UTF_transcode_alloc(UTF_ENC_32, uj32, uj32size, UTF_ENC_16, uj16size));
+}
+
+/* UTF_uj32_to_uj16_inplace --- converts the uj32size units at uj32 to UTF-16
+ * in the same buffer, which then holds the UTF-16 units from its start, and
+ * returns their number. A code point above U+10FFFF becomes
+ * UTF_DEFAULT_CHAR; if that is 0, the buffer is left as is and the result is
+ * (UTF_SIZE_T)-1. A NUL follows the result when it is shorter than the
+ * input, which is always unless every code point is supplementary. */
+static inline UTF_SIZE_T
+UTF_uj32_to_uj16_inplace(UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	/* each store ends at or before the unit read last, and goes through
+	 * memcpy so that the UTF_UC32 loads may not be moved across it */
+	UTF_UC8 *out = UTF_REINTERPRET_CAST(UTF_UC8 *, uj32);
+	UTF_SIZE_T i, d = 0;
+	UTF_UC32 uc32;
 	UTF_UC16 uc16[2];
-	const UTF_UC32 *uj32end = uj32 + uj32size;
-	UTF_UC16 *uj16end = uj16 + uj16size - 1;
 
-	if (!uj16size && uj32size)
-		return UTF_INSUFFICIENT_BUFFER;
+	if (!UTF_DEFAULT_CHAR)
+	{
+		for (i = 0; i < uj32size; ++i)
+		{
+			if (uj32[i] > 0x10FFFF)
+				return UTF_STATIC_CAST(UTF_SIZE_T, -1);
+		}
+	}
 
-	for (; uj32 != uj32end; ++uj32)
+	for (i = 0; i < uj32size; ++i)
 	{
-		if (!UTF_uc32_to_uc16(*uj32, uc16))
+		uc32 = uj32[i];
+		if (uc32 > 0x10FFFF)
+			uc32 = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
+
+		if (uc32 < 0x10000)
 		{
-			if (!UTF_DEFAULT_CHAR)
-			{
-				*uj16 = 0;
-				return UTF_INVALID;
-			}
-			uc16[0] = UTF_DEFAULT_CHAR;
-			uc16[1] = 0;
+			uc16[0] = UTF_STATIC_CAST(UTF_UC16, uc32);
+			memcpy(out + d * sizeof(UTF_UC16), uc16, sizeof(UTF_UC16));
+			++d;
+		}
+		else
+		{
+			uc16[0] = UTF_STATIC_CAST(UTF_UC16, 0xD800 + ((uc32 - 0x10000) >> 10));
+			uc16[1] = UTF_STATIC_CAST(UTF_UC16, 0xDC00 + (uc32 & 0x3FF));
+			memcpy(out + d * sizeof(UTF_UC16), uc16, 2 * sizeof(UTF_UC16));
+			d += 2;
+		}
+	}
+
+	if (d < 2 * uj32size)
+	{
+		uc16[0] = 0;
+		memcpy(out + d * sizeof(UTF_UC16), uc16, sizeof(UTF_UC16));
+	}
+	return d;
+}
+
+/* UTF_uj32_to_uj8_inplace --- as UTF_uj32_to_uj16_inplace, to UTF-8; returns
+ * the number of bytes. */
+static inline UTF_SIZE_T
+UTF_uj32_to_uj8_inplace(UTF_UC32 *uj32, UTF_SIZE_T uj32size)
+{
+	/* UTF_UC8 stores may alias the UTF_UC32 loads, so they stay in order */
+	UTF_UC8 *out = UTF_REINTERPRET_CAST(UTF_UC8 *, uj32);
+	UTF_SIZE_T i, d = 0;
+	UTF_UC32 uc32;
+
+	if (!UTF_DEFAULT_CHAR)
+	{
+		for (i = 0; i < uj32size; ++i)
+		{
+			if (uj32[i] > 0x10FFFF)
+				return UTF_STATIC_CAST(UTF_SIZE_T, -1);
 		}
+	}
 
-		if (uj16 == uj16end)
+	for (i = 0; i < uj32size; ++i)
+	{
+		/* the default char is encoded as a code point, as UTF_transcode does;
+		 * it takes at most 2 of the 4 bytes */
+		uc32 = uj32[i];
+		if (uc32 > 0x10FFFF)
+			uc32 = UTF_STATIC_CAST(UTF_UC8, UTF_DEFAULT_CHAR);
+
+		if (uc32 < 0x80)
 		{
-			*uj16 = 0;
-			return UTF_INSUFFICIENT_BUFFER;
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, uc32);
 		}
-		*uj16++ = uc16[0];
-		if (uc16[1])
+		else if (uc32 < 0x800)
 		{
-			if (uj16 == uj16end)
-			{
-				*uj16 = 0;
-				return UTF_INSUFFICIENT_BUFFER;
-			}
-			*uj16++ = uc16[1];
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0xC0 | (uc32 >> 6));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | (uc32 & 0x3F));
+		}
+		else if (uc32 < 0x10000)
+		{
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0xE0 | (uc32 >> 12));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | ((uc32 >> 6) & 0x3F));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | (uc32 & 0x3F));
+		}
+		else
+		{
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0xF0 | (uc32 >> 18));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | ((uc32 >> 12) & 0x3F));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | ((uc32 >> 6) & 0x3F));
+			out[d++] = UTF_STATIC_CAST(UTF_UC8, 0x80 | (uc32 & 0x3F));
 		}
 	}
-	*uj16 = 0;
-	return UTF_SUCCESS;
+
+	if (d < 4 * uj32size)
+		out[d] = 0;
+	return d;
 }
 
 static inline UTF_UC8 *
@@ -989,14 +2072,6 @@ UTF16_fgets(UTF_UC16 *str, int count, FILE *fp)
 	return str[0] ? str : NULL;
 }
 
-static inline UTF_UC16
-UTF16_XE(UTF_UC16 uc16)
-{
-	UTF_UC8 lo = (UTF_UC8)uc16;
-	UTF_UC8 hi = (UTF_UC8)(uc16 >> 8);
-	return (((UTF_UC16)lo) << 8) | hi;
-}
-
 static inline UTF_UC16 *
 UTF16XE_fgets(UTF_UC16 *str, int count, FILE *fp)
 {
@@ -1111,24 +2186,6 @@ UTF32_fgets(UTF_UC32 *str, int count, FILE *fp)
 	return str[0] ? str : NULL;
 }
 
-static inline UTF_UC32
-UTF32_XE(UTF_UC32 uc32)
-{
-#if defined(__GNUC__) || defined(__clang__)
-	return __builtin_bswap32(uc32);
-#elif defined(_MSC_VER)
-	return _byteswap_ulong(uc32);
-#else
-	UTF_UC8 lolo = (UTF_UC8)uc32;
-	UTF_UC8 lohi = (UTF_UC8)(uc32 >> 8);
-	UTF_UC8 hilo = (UTF_UC8)(uc32 >> 16);
-	UTF_UC8 hihi = (UTF_UC8)(uc32 >> 24);
-	return ((UTF_UC32)lolo << 24) |
-		   ((UTF_UC32)lohi << 16) |
-		   ((UTF_UC32)hilo << 8) | hihi;
-#endif
-}
-
 static inline UTF_UC32 *
 UTF32XE_fgets(UTF_UC32 *str, int count, FILE *fp)
 {
@@ -11,6 +11,18 @@
 #endif
 
 #include <string>
+#include <iterator>
+#include <cstddef>
+#include <new>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+	#include <array>
+	#define UTF_LITERALS 1  // UTF_u_literal and UTF_U_literal are available
+#endif
+#if __cplusplus >= 202002L && defined(__has_include)
+	#if __has_include(<ranges>)
+		#include <ranges>
+	#endif
+#endif
 
 /* UTF_US8, UTF_US16, UTF_US32 --- string classes */
 typedef std::string UTF_S8;
@@ -39,351 +51,1429 @@ typedef std::basic_string<UTF_UC8> UTF_US8;
 	#endif
 #endif
 
+// internal: the code unit type of an encoding
+template <UTF_ENC t_enc>
+struct UTF_enc_unit
+{
+	typedef UTF_UC32 type;
+};
+
+template <>
+struct UTF_enc_unit<UTF_ENC_8>
+{
+	typedef UTF_UC8 type;
+};
+
+template <>
+struct UTF_enc_unit<UTF_ENC_16>
+{
+	typedef UTF_UC16 type;
+};
+
+template <>
+struct UTF_enc_unit<UTF_ENC_16XE>
+{
+	typedef UTF_UC16 type;
+};
+
+template <typename T_CHAR, size_t t_size>
+class UTF_small_buffer;
+
+// internal: gives back the capacity that UTF_transcode_append took for the
+// worst case, if it grew dest and the result used little of it; copying the
+// result is cheaper than counting it with UTF_transcode_size beforehand.
+template <typename T_DEST>
+inline void
+UTF_transcode_trim(T_DEST& dest, size_t old_capacity)
+{
+	if (dest.capacity() > old_capacity && dest.capacity() - dest.size() > dest.size() / 4 + 64)
+		dest.shrink_to_fit();
+}
+
+// a small buffer keeps what it took, as it is short-lived
+template <typename T_CHAR, size_t t_size>
+inline void
+UTF_transcode_trim(UTF_small_buffer<T_CHAR, t_size>&, size_t)
+{
+}
+
+// internal: appends src (size units in t_src) to dest in t_dst by the rules
+// of the C converters, with t_default_char for ill-formed sequences. dest
+// keeps its own terminator, which takes the NUL that UTF_transcode writes.
+template <UTF_ENC t_src, UTF_ENC t_dst, char t_default_char, typename T_DEST>
+inline bool
+UTF_transcode_append(const void *src, size_t size, T_DEST& dest)
+{
+	size_t old_size = dest.size(), old_capacity = dest.capacity(), used = 0;
+	size_t room = UTF_transcode_max(t_src, size, t_dst);
+	dest.resize(old_size + room - 1);
+	UTF_RET ret = UTF_transcode(t_src, src, size, NULL, t_dst, &dest[old_size], room, &used,
+								UTF_STATIC_CAST(UTF_UC8, t_default_char), NULL);
+	dest.resize(old_size + used);
+	UTF_transcode_trim(dest, old_capacity);
+	return ret == UTF_SUCCESS;
+}
+
 template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
 inline bool
 UTF_u8_to_u(const UTF_US8& us8, UTF_US16& us16)
 {
-	UTF_UC8 uc8[4];
-	UTF_UC16 uc16[2];
-	UTF_US8::const_iterator it, end = us8.end();
-	for (it = us8.begin(); it != end; ++it)
+	return UTF_transcode_append<UTF_ENC_8, UTF_ENC_16, t_default_char>(us8.data(), us8.size(), us16);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u8_to_u(const UTF_S8& s8, UTF_US16& us16)
+{
+	return UTF_u8_to_u<t_default_char>(reinterpret_cast<const UTF_US8&>(s8), us16);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u8_to_U(const UTF_US8& us8, UTF_US32& us32)
+{
+	return UTF_transcode_append<UTF_ENC_8, UTF_ENC_32, t_default_char>(us8.data(), us8.size(), us32);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u8_to_U(const UTF_S8& s8, UTF_US32& us32)
+{
+	return UTF_u8_to_U<t_default_char>(reinterpret_cast<const UTF_US8&>(s8), us32);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u_to_u8(const UTF_US16& us16, UTF_US8& us8)
+{
+	return UTF_transcode_append<UTF_ENC_16, UTF_ENC_8, t_default_char>(us16.data(), us16.size(), us8);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u_to_u8(const UTF_US16& us16, UTF_S8& s8)
+{
+	return UTF_u_to_u8<t_default_char>(us16, reinterpret_cast<UTF_US8&>(s8));
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u_to_U(const UTF_US16& us16, UTF_US32& us32)
+{
+	return UTF_transcode_append<UTF_ENC_16, UTF_ENC_32, t_default_char>(us16.data(), us16.size(), us32);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_U_to_u8(const UTF_US32& us32, UTF_US8& us8)
+{
+	return UTF_transcode_append<UTF_ENC_32, UTF_ENC_8, t_default_char>(us32.data(), us32.size(), us8);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_U_to_u8(const UTF_US32& us32, UTF_S8& s8)
+{
+	return UTF_U_to_u8<t_default_char>(us32, reinterpret_cast<UTF_US8&>(s8));
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_U_to_u(const UTF_US32& us32, UTF_US16& us16)
+{
+	return UTF_transcode_append<UTF_ENC_32, UTF_ENC_16, t_default_char>(us32.data(), us32.size(), us16);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u8_to_u8(const UTF_US8& src, UTF_US8& dest)
+{
+	dest = src;
+	return true;
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_u_to_u(const UTF_US16& src, UTF_US16& dest)
+{
+	dest = src;
+	return true;
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline bool
+UTF_U_to_U(const UTF_US32& src, UTF_US32& dest)
+{
+	dest = src;
+	return true;
+}
+
+// UTF_small_buffer --- code units in inline storage for up to t_size units
+// (plus a NUL), moved to the heap only when resized beyond that. As the
+// destination of a conversion it allocates nothing unless the input is long
+// enough to possibly need more than t_size units:
+//
+//     UTF_small_buffer<UTF_UC16, 64> label;
+//     UTF_u8_to_u(s8, label);
+//     draw_text(label.c_str(), label.size());
+template <typename T_CHAR, size_t t_size>
+class UTF_small_buffer
+{
+public:
+	typedef T_CHAR value_type;
+	typedef T_CHAR *iterator;
+	typedef const T_CHAR *const_iterator;
+
+	UTF_small_buffer() : m_data(m_inline), m_size(0), m_capacity(t_size)
 	{
-		int count = UTF_uc8_count(*it);
-		if (!count)
+		m_inline[0] = 0;
+	}
+	~UTF_small_buffer()
+	{
+		if (on_heap())
+			UTF_FREE(m_data);
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+	bool on_heap() const
+	{
+		return m_data != m_inline;
+	}
+
+	T_CHAR *data()
+	{
+		return m_data;
+	}
+	const T_CHAR *data() const
+	{
+		return m_data;
+	}
+	const T_CHAR *c_str() const
+	{
+		return m_data;
+	}
+	T_CHAR& operator[](size_t i)
+	{
+		return m_data[i];
+	}
+	const T_CHAR& operator[](size_t i) const
+	{
+		return m_data[i];
+	}
+	iterator begin()
+	{
+		return m_data;
+	}
+	iterator end()
+	{
+		return m_data + m_size;
+	}
+	const_iterator begin() const
+	{
+		return m_data;
+	}
+	const_iterator end() const
+	{
+		return m_data + m_size;
+	}
+	std::basic_string<T_CHAR> str() const
+	{
+		return std::basic_string<T_CHAR>(m_data, m_size);
+	}
+
+	// units added are left uninitialized; data()[size()] is always NUL
+	void resize(size_t size)
+	{
+		if (size > m_capacity)
+			grow(size);
+		m_size = size;
+		m_data[size] = 0;
+	}
+	void clear()
+	{
+		resize(0);
+	}
+
+private:
+	T_CHAR *m_data;
+	size_t m_size;
+	size_t m_capacity;
+	T_CHAR m_inline[t_size + 1];
+
+	void grow(size_t size)
+	{
+		size_t capacity = (size < 2 * m_capacity) ? 2 * m_capacity : size;
+		T_CHAR *data = static_cast<T_CHAR *>(UTF_MALLOC((capacity + 1) * sizeof(T_CHAR)));
+		if (!data)
+			throw std::bad_alloc();
+		std::memcpy(data, m_data, (m_size + 1) * sizeof(T_CHAR));
+		if (on_heap())
+			UTF_FREE(m_data);
+		m_data = data;
+		m_capacity = capacity;
+	}
+
+	UTF_small_buffer(const UTF_small_buffer&);
+	UTF_small_buffer& operator=(const UTF_small_buffer&);
+};
+
+// UTF_convert_to_stack<t_src, t_dst>(src, size, buf) --- replaces buf with
+// size units of src converted from t_src to t_dst as the C converters do;
+// buf spills to the heap only if UTF_transcode_max, less the NUL that goes
+// in its own terminator, exceeds its inline size.
+template <UTF_ENC t_src, UTF_ENC t_dst, char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR),
+		  typename T_CHAR, size_t t_size>
+inline bool
+UTF_convert_to_stack(const typename UTF_enc_unit<t_src>::type *src, size_t size,
+					 UTF_small_buffer<T_CHAR, t_size>& buf)
+{
+	buf.clear();
+	return UTF_transcode_append<t_src, t_dst, t_default_char>(src, size, buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_u8_to_u(const UTF_S8& s8, UTF_small_buffer<UTF_UC16, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_8, UTF_ENC_16, t_default_char>(s8.data(), s8.size(), buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_u8_to_U(const UTF_S8& s8, UTF_small_buffer<UTF_UC32, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_8, UTF_ENC_32, t_default_char>(s8.data(), s8.size(), buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_u_to_u8(const UTF_US16& us16, UTF_small_buffer<char, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_16, UTF_ENC_8, t_default_char>(us16.data(), us16.size(), buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_u_to_U(const UTF_US16& us16, UTF_small_buffer<UTF_UC32, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_16, UTF_ENC_32, t_default_char>(us16.data(), us16.size(), buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_U_to_u8(const UTF_US32& us32, UTF_small_buffer<char, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_32, UTF_ENC_8, t_default_char>(us32.data(), us32.size(), buf);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), size_t t_size>
+inline bool
+UTF_U_to_u(const UTF_US32& us32, UTF_small_buffer<UTF_UC16, t_size>& buf)
+{
+	return UTF_transcode_append<UTF_ENC_32, UTF_ENC_16, t_default_char>(us32.data(), us32.size(), buf);
+}
+
+inline size_t
+UTF_count_cp(const UTF_US8& us8)
+{
+	return UTF_uj8_count_cp(us8.c_str(), us8.size());
+}
+
+inline size_t
+UTF_count_cp(const UTF_S8& s8)
+{
+	return UTF_uj8_count_cp(reinterpret_cast<const UTF_UC8 *>(s8.c_str()), s8.size());
+}
+
+inline size_t
+UTF_count_cp(const UTF_US16& us16)
+{
+	return UTF_uj16_count_cp(us16.c_str(), us16.size());
+}
+
+template <typename T>
+inline int UTF_cmp(const T *a, const T *b)
+{
+	if (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4)
+	{
+		size_t i = UTF_simd_mismatch(a, b, sizeof(T), ~size_t(0));
+		a += i;
+		b += i;
+	}
+	else
+	{
+		while (*a && *a == *b)
 		{
-			if (!t_default_char)
-				return false;
+			++a;
+			++b;
+		}
+	}
+	if (*a < *b) return -1;
+	if (*a > *b) return 1;
+	return 0;
+}
 
-			us16.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
+template <typename T>
+inline int UTF_cmpn(const T *a, const T *b, size_t len)
+{
+	size_t i = 0;
+	if (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4)
+	{
+		i = UTF_simd_mismatch(a, b, sizeof(T), len);
+	}
+	else
+	{
+		while (i < len && a[i] && a[i] == b[i])
+			++i;
+	}
+	if (i == len) return 0;
+	if (a[i] < b[i]) return -1;
+	if (a[i] > b[i]) return 1;
+	return 0;
+}
+
+// counted versions of UTF_cmp: zeros are ordinary units
+template <typename T>
+inline int UTF_cmp_len(const T *a, size_t sizea, const T *b, size_t sizeb, size_t *mismatch = NULL)
+{
+	size_t size = (sizea < sizeb) ? sizea : sizeb;
+	size_t i = UTF_simd_mismatch_bytes(a, b, size * sizeof(T)) / sizeof(T);
+	if (mismatch)
+		*mismatch = i;
+	if (i < size) return (a[i] < b[i]) ? -1 : 1;
+	if (sizea < sizeb) return -1;
+	if (sizea > sizeb) return 1;
+	return 0;
+}
+
+template <typename T>
+inline int UTF_cmp_len(const std::basic_string<T>& a, const std::basic_string<T>& b, size_t *mismatch = NULL)
+{
+	return UTF_cmp_len(a.data(), a.size(), b.data(), b.size(), mismatch);
+}
+
+template <typename T>
+inline bool UTF_equal(const T *a, size_t sizea, const T *b, size_t sizeb)
+{
+	return sizea == sizeb && memcmp(a, b, sizea * sizeof(T)) == 0;
+}
+
+template <typename T>
+inline bool UTF_has_prefix(const T *str, size_t size, const T *prefix, size_t prefix_size)
+{
+	return size >= prefix_size && memcmp(str, prefix, prefix_size * sizeof(T)) == 0;
+}
+
+template <typename T>
+inline bool UTF_has_prefix(const std::basic_string<T>& str, const std::basic_string<T>& prefix)
+{
+	return UTF_has_prefix(str.data(), str.size(), prefix.data(), prefix.size());
+}
+
+// compare two encodings in code point order without converting
+inline int
+UTF_cmp_u8_u16(const UTF_US8& us8, const UTF_US16& us16)
+{
+	return UTF_uj8_cmp_uj16(us8.data(), us8.size(), us16.data(), us16.size());
+}
+
+inline int
+UTF_cmp_u8_u16(const UTF_S8& s8, const UTF_US16& us16)
+{
+	return UTF_uj8_cmp_uj16(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), us16.data(), us16.size());
+}
+
+inline int
+UTF_cmp_u8_u32(const UTF_US8& us8, const UTF_US32& us32)
+{
+	return UTF_uj8_cmp_uj32(us8.data(), us8.size(), us32.data(), us32.size());
+}
+
+inline int
+UTF_cmp_u8_u32(const UTF_S8& s8, const UTF_US32& us32)
+{
+	return UTF_uj8_cmp_uj32(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), us32.data(), us32.size());
+}
+
+inline int
+UTF_cmp_u16_u32(const UTF_US16& us16, const UTF_US32& us32)
+{
+	return UTF_uj16_cmp_uj32(us16.data(), us16.size(), us32.data(), us32.size());
+}
+
+template <typename T_STR8>
+inline bool
+UTF_equal_u8_u16(const T_STR8& str8, const UTF_US16& us16)
+{
+	return UTF_cmp_u8_u16(str8, us16) == 0;
+}
+
+template <typename T_STR8>
+inline bool
+UTF_equal_u8_u32(const T_STR8& str8, const UTF_US32& us32)
+{
+	return UTF_cmp_u8_u32(str8, us32) == 0;
+}
+
+inline bool
+UTF_equal_u16_u32(const UTF_US16& us16, const UTF_US32& us32)
+{
+	return UTF_cmp_u16_u32(us16, us32) == 0;
+}
+
+// UTF_hash, UTF_equal_to --- hash and equality of code point sequences in any
+// of the string types, for unordered containers keyed by one encoding and
+// probed with another (transparent for C++20 heterogeneous lookup)
+struct UTF_hash
+{
+	typedef void is_transparent;
+
+	size_t operator()(const UTF_S8& s8) const
+	{
+		return static_cast<size_t>(UTF_uj8_hash(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), 0));
+	}
+	size_t operator()(const UTF_US8& us8) const
+	{
+		return static_cast<size_t>(UTF_uj8_hash(us8.data(), us8.size(), 0));
+	}
+	size_t operator()(const UTF_US16& us16) const
+	{
+		return static_cast<size_t>(UTF_uj16_hash(us16.data(), us16.size(), 0));
+	}
+	size_t operator()(const UTF_US32& us32) const
+	{
+		return static_cast<size_t>(UTF_uj32_hash(us32.data(), us32.size(), 0));
+	}
+};
+
+struct UTF_equal_to
+{
+	typedef void is_transparent;
+
+	template <typename T>
+	bool operator()(const std::basic_string<T>& a, const std::basic_string<T>& b) const
+	{
+		return a == b;
+	}
+	bool operator()(const UTF_S8& s8, const UTF_US8& us8) const
+	{
+		return UTF_uj8_equal(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), us8.data(), us8.size());
+	}
+	bool operator()(const UTF_US8& us8, const UTF_S8& s8) const
+	{
+		return (*this)(s8, us8);
+	}
+	bool operator()(const UTF_S8& s8, const UTF_US16& us16) const
+	{
+		return UTF_equal_u8_u16(s8, us16);
+	}
+	bool operator()(const UTF_US16& us16, const UTF_S8& s8) const
+	{
+		return UTF_equal_u8_u16(s8, us16);
+	}
+	bool operator()(const UTF_US8& us8, const UTF_US16& us16) const
+	{
+		return UTF_equal_u8_u16(us8, us16);
+	}
+	bool operator()(const UTF_US16& us16, const UTF_US8& us8) const
+	{
+		return UTF_equal_u8_u16(us8, us16);
+	}
+	bool operator()(const UTF_S8& s8, const UTF_US32& us32) const
+	{
+		return UTF_equal_u8_u32(s8, us32);
+	}
+	bool operator()(const UTF_US32& us32, const UTF_S8& s8) const
+	{
+		return UTF_equal_u8_u32(s8, us32);
+	}
+	bool operator()(const UTF_US8& us8, const UTF_US32& us32) const
+	{
+		return UTF_equal_u8_u32(us8, us32);
+	}
+	bool operator()(const UTF_US32& us32, const UTF_US8& us8) const
+	{
+		return UTF_equal_u8_u32(us8, us32);
+	}
+	bool operator()(const UTF_US16& us16, const UTF_US32& us32) const
+	{
+		return UTF_equal_u16_u32(us16, us32);
+	}
+	bool operator()(const UTF_US32& us32, const UTF_US16& us16) const
+	{
+		return UTF_equal_u16_u32(us16, us32);
+	}
+};
+
+// UTF_cp_iterator --- a bidirectional iterator that decodes the code points
+// of UTF-8 (T_UNIT is char or UTF_UC8) or UTF-16 (T_UNIT is UTF_UC16) text on
+// the fly. An ill-formed sequence reads as t_default_char, as in the
+// converters above, but it ends at the first unit that cannot continue it, so
+// that stepping backward resyncs within three trail bytes.
+template <typename T_UNIT, size_t t_size = sizeof(T_UNIT)>
+struct UTF_cp_decoder
+{
+	static const T_UNIT *next(const T_UNIT *ptr, const T_UNIT *end, UTF_UC32 *uc32, bool *valid)
+	{
+		*uc32 = ptr[0];
+		*valid = true;
+		if (!UTF_uc16_is_surrogate_high(ptr[0]))
+			return ptr + 1;  // a lone low surrogate passes through, as in UTF_u_to_U
+		if (ptr + 1 != end && UTF_uc16_is_surrogate_low(ptr[1]))
+		{
+			*uc32 = 0x10000 + (UTF_STATIC_CAST(UTF_UC32, ptr[0]) - 0xD800) * 0x400 +
+					(UTF_STATIC_CAST(UTF_UC32, ptr[1]) - 0xDC00);
+			return ptr + 2;
+		}
+		*valid = false;
+		return ptr + 1;
+	}
+	static const T_UNIT *prev(const T_UNIT *begin, const T_UNIT *ptr)
+	{
+		if (ptr - 1 != begin && UTF_uc16_is_surrogate_low(ptr[-1]) && UTF_uc16_is_surrogate_high(ptr[-2]))
+			return ptr - 2;
+		return ptr - 1;
+	}
+};
+
+template <typename T_UNIT>
+struct UTF_cp_decoder<T_UNIT, 1>
+{
+	static const T_UNIT *next(const T_UNIT *ptr, const T_UNIT *end, UTF_UC32 *uc32, bool *valid)
+	{
+		const UTF_UC8 *uj8 = reinterpret_cast<const UTF_UC8 *>(ptr);
+		*valid = true;
+		if (uj8[0] < 0x80)
+		{
+			*uc32 = uj8[0];
+			return ptr + 1;
+		}
+		int i = 1, count = UTF_uc8_count(uj8[0]);
+		if (count == 2 && end - ptr >= 2 && UTF_uc8_is_trail(uj8[1]))
+		{
+			*uc32 = (UTF_STATIC_CAST(UTF_UC32, uj8[0] & 0x1F) << 6) | (uj8[1] & 0x3F);
+			return ptr + 2;
+		}
+		if (count == 3 && end - ptr >= 3 && UTF_uc8_is_trail(uj8[1]) && UTF_uc8_is_trail(uj8[2]))
+		{
+			*uc32 = (UTF_STATIC_CAST(UTF_UC32, uj8[0] & 0x0F) << 12) |
+					(UTF_STATIC_CAST(UTF_UC32, uj8[1] & 0x3F) << 6) | (uj8[2] & 0x3F);
+			*valid = (*uc32 >= 0x800);
+			return ptr + 3;
+		}
+		if (count == 4 && end - ptr >= 4 && UTF_uc8_is_trail(uj8[1]) && UTF_uc8_is_trail(uj8[2]) &&
+			UTF_uc8_is_trail(uj8[3]))
+		{
+			*uc32 = (UTF_STATIC_CAST(UTF_UC32, uj8[0] & 0x07) << 18) |
+					(UTF_STATIC_CAST(UTF_UC32, uj8[1] & 0x3F) << 12) |
+					(UTF_STATIC_CAST(UTF_UC32, uj8[2] & 0x3F) << 6) | (uj8[3] & 0x3F);
+			*valid = (0x10000 <= *uc32 && *uc32 <= 0x10FFFF);
+			return ptr + 4;
 		}
+		// cut short or not a lead byte at all
+		while (i < count && ptr + i != end && UTF_uc8_is_trail(uj8[i]))
+			++i;
+		*valid = false;
+		return ptr + i;
+	}
+	static const T_UNIT *prev(const T_UNIT *begin, const T_UNIT *ptr)
+	{
+		const T_UNIT *lead = ptr - 1;
+		int trails = 0;
+		while (trails < 3 && lead != begin && UTF_uc8_is_trail(UTF_STATIC_CAST(UTF_UC8, *lead)))
+		{
+			--lead;
+			++trails;
+		}
+		// the lead byte owns the trail bytes only if it takes that many
+		if (trails && UTF_uc8_count(UTF_STATIC_CAST(UTF_UC8, *lead)) > trails)
+			return lead;
+		return ptr - 1;
+	}
+};
+
+template <typename T_UNIT, char t_default_char = UTF_DEFAULT_CHAR>
+class UTF_cp_iterator
+{
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef UTF_UC32 value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const UTF_UC32 *pointer;
+	typedef UTF_UC32 reference;
+
+	UTF_cp_iterator() : m_begin(NULL), m_ptr(NULL), m_end(NULL), m_next(NULL), m_uc32(0), m_valid(true)
+	{
+	}
+	UTF_cp_iterator(const T_UNIT *begin, const T_UNIT *ptr, const T_UNIT *end)
+		: m_begin(begin), m_ptr(ptr), m_end(end)
+	{
+		decode();
+	}
+
+	UTF_UC32 operator*() const
+	{
+		return m_valid ? m_uc32 : UTF_STATIC_CAST(UTF_UC8, t_default_char);
+	}
+	// whether the current sequence is well-formed
+	bool valid() const
+	{
+		return m_valid;
+	}
+	// the position of the current sequence in the code units
+	const T_UNIT *base() const
+	{
+		return m_ptr;
+	}
+
+	UTF_cp_iterator& operator++()
+	{
+		m_ptr = m_next;
+		decode();
+		return *this;
+	}
+	UTF_cp_iterator operator++(int)
+	{
+		UTF_cp_iterator old = *this;
+		++*this;
+		return old;
+	}
+	UTF_cp_iterator& operator--()
+	{
+		m_ptr = UTF_cp_decoder<T_UNIT>::prev(m_begin, m_ptr);
+		decode();
+		return *this;
+	}
+	UTF_cp_iterator operator--(int)
+	{
+		UTF_cp_iterator old = *this;
+		--*this;
+		return old;
+	}
+
+	friend bool operator==(const UTF_cp_iterator& a, const UTF_cp_iterator& b)
+	{
+		return a.m_ptr == b.m_ptr;
+	}
+	friend bool operator!=(const UTF_cp_iterator& a, const UTF_cp_iterator& b)
+	{
+		return a.m_ptr != b.m_ptr;
+	}
+
+private:
+	const T_UNIT *m_begin;
+	const T_UNIT *m_ptr;
+	const T_UNIT *m_end;
+	const T_UNIT *m_next;  // the end of the current sequence
+	UTF_UC32 m_uc32;
+	bool m_valid;
+
+	void decode()
+	{
+		m_uc32 = 0;
+		m_valid = true;
+		m_next = m_ptr;
+		if (m_ptr != m_end)
+			m_next = UTF_cp_decoder<T_UNIT>::next(m_ptr, m_end, &m_uc32, &m_valid);
+	}
+};
+
+// UTF_cp_view --- the code points of code units that outlive the view
+template <typename T_UNIT, char t_default_char = UTF_DEFAULT_CHAR>
+class UTF_cp_view
+{
+public:
+	typedef UTF_cp_iterator<T_UNIT, t_default_char> iterator;
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef UTF_UC32 value_type;
+
+	UTF_cp_view() : m_begin(NULL), m_end(NULL)
+	{
+	}
+	UTF_cp_view(const T_UNIT *ptr, size_t size) : m_begin(ptr), m_end(ptr + size)
+	{
+	}
+	UTF_cp_view(const std::basic_string<T_UNIT>& str)
+		: m_begin(str.data()), m_end(str.data() + str.size())
+	{
+	}
+
+	iterator begin() const
+	{
+		return iterator(m_begin, m_begin, m_end);
+	}
+	iterator end() const
+	{
+		return iterator(m_begin, m_end, m_end);
+	}
+	reverse_iterator rbegin() const
+	{
+		return reverse_iterator(end());
+	}
+	reverse_iterator rend() const
+	{
+		return reverse_iterator(begin());
+	}
+	bool empty() const
+	{
+		return m_begin == m_end;
+	}
+
+private:
+	const T_UNIT *m_begin;
+	const T_UNIT *m_end;
+};
+
+#ifdef __cpp_lib_ranges
+template <typename T_UNIT, char t_default_char>
+inline constexpr bool std::ranges::enable_view<UTF_cp_view<T_UNIT, t_default_char> > = true;
+template <typename T_UNIT, char t_default_char>
+inline constexpr bool std::ranges::enable_borrowed_range<UTF_cp_view<T_UNIT, t_default_char> > = true;
+#endif
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline UTF_cp_view<char, t_default_char>
+UTF_u8_cps(const UTF_S8& s8)
+{
+	return UTF_cp_view<char, t_default_char>(s8);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline UTF_cp_view<UTF_UC8, t_default_char>
+UTF_u8_cps(const UTF_US8& us8)
+{
+	return UTF_cp_view<UTF_UC8, t_default_char>(us8);
+}
+
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+inline UTF_cp_view<UTF_US16::value_type, t_default_char>
+UTF_u_cps(const UTF_US16& us16)
+{
+	return UTF_cp_view<UTF_US16::value_type, t_default_char>(us16);
+}
+
+// UTF_cp_inserter --- an output iterator that takes code points and writes
+// them as UTF-8, UTF-16 or UTF-32 (t_bits) code units to another output
+// iterator. A code point that cannot be encoded is written as t_default_char,
+// or dropped and remembered by failed() if t_default_char is zero.
+template <int t_bits>
+struct UTF_cp_encoder;
+
+template <>
+struct UTF_cp_encoder<8>
+{
+	typedef UTF_UC8 unit_type;
+	static UTF_CONSTEXPR int encode(UTF_UC32 uc32, UTF_UC8 uc8[4])
+	{
+		return UTF_uc32_to_uc8(uc32, uc8) ? UTF_uc32_count8(uc32) : 0;
+	}
+};
+
+template <>
+struct UTF_cp_encoder<16>
+{
+	typedef UTF_UC16 unit_type;
+	static UTF_CONSTEXPR int encode(UTF_UC32 uc32, UTF_UC16 uc16[4])
+	{
+		return UTF_uc32_to_uc16(uc32, uc16) ? UTF_uc32_count16(uc32) : 0;
+	}
+};
+
+template <>
+struct UTF_cp_encoder<32>
+{
+	typedef UTF_UC32 unit_type;
+	static UTF_CONSTEXPR int encode(UTF_UC32 uc32, UTF_UC32 units[4])
+	{
+		units[0] = uc32;
+		return uc32 <= 0x10FFFF;
+	}
+};
+
+template <typename T_OUT, int t_bits, char t_default_char = UTF_DEFAULT_CHAR>
+class UTF_cp_inserter
+{
+public:
+	typedef std::output_iterator_tag iterator_category;
+	typedef void value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef void reference;
+
+	explicit UTF_cp_inserter(T_OUT out) : m_out(out), m_failed(false)
+	{
+	}
 
-		uc8[0] = *it;
-		for (int i = 1; i < count; ++i)
+	UTF_cp_inserter& operator=(UTF_UC32 uc32)
+	{
+		typename UTF_cp_encoder<t_bits>::unit_type units[4];
+		int count = UTF_cp_encoder<t_bits>::encode(uc32, units);
+		if (!count)
 		{
-			++it;
-			if (it == end)
+			if (!t_default_char)
 			{
-				if (!t_default_char)
-					return false;
-
-				us16.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-				return true;
+				m_failed = true;
+				return *this;
 			}
-
-			uc8[i] = *it;
+			units[0] = UTF_STATIC_CAST(UTF_UC8, t_default_char);
+			count = 1;
 		}
-
-		if (!UTF_uc8_to_uc16(uc8, uc16))
+		for (int i = 0; i < count; ++i)
 		{
-			if (!t_default_char)
-				return false;
-
-			us16.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
+			*m_out = units[i];
+			++m_out;
 		}
+		return *this;
+	}
+	UTF_cp_inserter& operator*()
+	{
+		return *this;
+	}
+	UTF_cp_inserter& operator++()
+	{
+		return *this;
+	}
+	UTF_cp_inserter operator++(int)
+	{
+		return *this;
+	}
 
-		us16.push_back(uc16[0]);
-		if (uc16[1])
-			us16.push_back(uc16[1]);
+	// the output iterator past the units written so far
+	T_OUT base() const
+	{
+		return m_out;
 	}
-	return true;
+	// whether a code point was dropped
+	bool failed() const
+	{
+		return m_failed;
+	}
+
+private:
+	T_OUT m_out;
+	bool m_failed;
+};
+
+// UTF_u8_encoder, UTF_u_encoder, UTF_U_encoder --- encode to an output
+// iterator or a raw buffer large enough for the result
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_OUT>
+inline UTF_cp_inserter<T_OUT, 8, t_default_char>
+UTF_u8_encoder(T_OUT out)
+{
+	return UTF_cp_inserter<T_OUT, 8, t_default_char>(out);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u8_to_u(const UTF_S8& s8, UTF_US16& us16)
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_OUT>
+inline UTF_cp_inserter<T_OUT, 16, t_default_char>
+UTF_u_encoder(T_OUT out)
 {
-	return UTF_u8_to_u<t_default_char>(reinterpret_cast<const UTF_US8&>(s8), us16);
+	return UTF_cp_inserter<T_OUT, 16, t_default_char>(out);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u8_to_U(const UTF_US8& us8, UTF_US32& us32)
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_OUT>
+inline UTF_cp_inserter<T_OUT, 32, t_default_char>
+UTF_U_encoder(T_OUT out)
 {
-	UTF_UC8 uc8[4];
-	UTF_UC32 uc32;
-	UTF_US8::const_iterator it, end = us8.end();
-	for (it = us8.begin(); it != end; ++it)
-	{
-		int count = UTF_uc8_count(UTF_STATIC_CAST(UTF_UC8, *it));
-		if (!count)
-		{
-			if (!t_default_char)
-				return false;
+	return UTF_cp_inserter<T_OUT, 32, t_default_char>(out);
+}
 
-			us32.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
-		}
+// UTF_u8_inserter, UTF_u_inserter, UTF_U_inserter --- append to a string or
+// other container with push_back
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_CONTAINER>
+inline UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 8, t_default_char>
+UTF_u8_inserter(T_CONTAINER& container)
+{
+	return UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 8, t_default_char>(std::back_inserter(container));
+}
 
-		uc8[0] = *it;
-		for (int i = 1; i < count; ++i)
-		{
-			++it;
-			if (it == end)
-			{
-				if (!t_default_char)
-					return false;
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_CONTAINER>
+inline UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 16, t_default_char>
+UTF_u_inserter(T_CONTAINER& container)
+{
+	return UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 16, t_default_char>(std::back_inserter(container));
+}
 
-				us32.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-				return true;
-			}
-			uc8[i] = *it;
-		}
+template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR), typename T_CONTAINER>
+inline UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 32, t_default_char>
+UTF_U_inserter(T_CONTAINER& container)
+{
+	return UTF_cp_inserter<std::back_insert_iterator<T_CONTAINER>, 32, t_default_char>(std::back_inserter(container));
+}
 
-		if (!UTF_uc8_to_uc32(uc8, &uc32))
-		{
-			if (!t_default_char)
-				return false;
+// Error policies --- pass one as the template argument instead of
+// t_default_char to choose what the converters do with ill-formed input:
+//
+//     UTF_u8_to_u<UTF_policy_replace>(s8, us16);
+//
+// UTF_policy_fail      return false at the first ill-formed sequence.
+// UTF_policy_replace   write U+FFFD for each maximal subpart of an ill-formed
+//                      UTF-8 sequence (as the WHATWG Encoding Standard and
+//                      Unicode 3.9 recommend), each lone surrogate and each
+//                      UTF-32 value that is not a scalar value.
+// UTF_policy_skip      drop ill-formed sequences.
+// UTF_policy_pass      WTF-8: lone surrogates pass through in every encoding,
+//                      encoded in UTF-8 as three bytes; anything else
+//                      ill-formed becomes U+FFFD.
+// UTF_policy_trusted   the input is known to be well-formed and is not
+//                      checked; ill-formed input gives unspecified output
+//                      (but is never read out of bounds).
+//
+// Every policy instantiates its own conversion loop with the checks it does
+// not need compiled out.
+enum UTF_POLICY_ACTION
+{
+	UTF_POLICY_FAIL,
+	UTF_POLICY_REPLACE,
+	UTF_POLICY_SKIP
+};
 
-			us32.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
-		}
+struct UTF_policy_fail
+{
+	static const int on_error = UTF_POLICY_FAIL;
+	static const bool checked = true;
+	static const bool surrogates = false;
+};
 
-		us32.push_back(uc32);
-	}
-	return true;
-}
+struct UTF_policy_replace
+{
+	static const int on_error = UTF_POLICY_REPLACE;
+	static const bool checked = true;
+	static const bool surrogates = false;
+};
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u8_to_U(const UTF_S8& s8, UTF_US32& us32)
+struct UTF_policy_skip
 {
-	return UTF_u8_to_U<t_default_char>(reinterpret_cast<const UTF_US8&>(s8), us32);
-}
+	static const int on_error = UTF_POLICY_SKIP;
+	static const bool checked = true;
+	static const bool surrogates = false;
+};
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u_to_u8(const UTF_US16& us16, UTF_US8& us8)
+struct UTF_policy_pass
 {
-	UTF_UC16 uc16[2];
-	UTF_UC8 uc8[4];
-	UTF_US16::const_iterator it, end = us16.end();
-	for (it = us16.begin(); it != end; ++it)
-	{
-		if (UTF_uc16_is_surrogate_high(*it))
-		{
-			uc16[0] = *it;
-			++it;
-			if (it == end)
-			{
-				if (!t_default_char)
-					return false;
+	static const int on_error = UTF_POLICY_REPLACE;
+	static const bool checked = true;
+	static const bool surrogates = true;
+};
 
-				us8.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-				return true;
-			}
+struct UTF_policy_trusted
+{
+	static const int on_error = UTF_POLICY_REPLACE;
+	static const bool checked = false;
+	static const bool surrogates = true;
+};
 
-			uc16[1] = *it;
-		}
-		else
-		{
-			uc16[0] = *it;
-			uc16[1] = 0;
-		}
+// internal: reads a code point and advances ptr; returns false (after
+// advancing over the ill-formed sequence) if there is none. The primary
+// template is for UTF-16 and UTF-32 in either byte order.
+template <UTF_ENC t_enc>
+struct UTF_policy_decoder
+{
+	typedef typename UTF_enc_unit<t_enc>::type unit_type;
 
-		if (!UTF_uc16_to_uc8(uc16, uc8))
+	template <typename T_POLICY>
+	static bool next(const unit_type *& ptr, const unit_type *end, UTF_UC32& uc32)
+	{
+		uc32 = UTF_enc_load(t_enc, ptr++, 0);
+		if (sizeof(unit_type) == 4)
 		{
-			if (!t_default_char)
+			if (!T_POLICY::checked)
+				return true;
+			if (uc32 > 0x10FFFF)
 				return false;
-
-			us8.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
+			return T_POLICY::surrogates || uc32 < 0xD800 || 0xE000 <= uc32;
 		}
 
-		us8.push_back(uc8[0]);
-		if (uc8[1])
+		if (uc32 < 0xD800 || 0xE000 <= uc32)
+			return true;
+		if (uc32 < 0xDC00 && ptr != end)
 		{
-			us8.push_back(uc8[1]);
-			if (uc8[2])
+			UTF_UC32 low = UTF_enc_load(t_enc, ptr, 0);
+			if (!T_POLICY::checked || (0xDC00 <= low && low < 0xE000))
 			{
-				us8.push_back(uc8[2]);
-				if (uc8[3])
-				{
-					us8.push_back(uc8[3]);
-				}
+				++ptr;
+				uc32 = 0x10000 + (uc32 - 0xD800) * 0x400 + (low - 0xDC00);
+				return true;
 			}
 		}
+		return T_POLICY::surrogates;
 	}
+};
 
-	return true;
-}
-
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u_to_u8(const UTF_US16& us16, UTF_S8& s8)
+template <>
+struct UTF_policy_decoder<UTF_ENC_8>
 {
-	return UTF_u_to_u8<t_default_char>(us16, reinterpret_cast<UTF_US8&>(s8));
-}
+	typedef UTF_UC8 unit_type;
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
-inline bool
-UTF_u_to_U(const UTF_US16& us16, UTF_US32& us32)
-{
-	UTF_UC16 uc16[2];
-	UTF_UC32 uc32;
-	UTF_US16::const_iterator it, end = us16.end();
-	for (it = us16.begin(); it != end; ++it)
+	template <typename T_POLICY>
+	static bool next(const UTF_UC8 *& ptr, const UTF_UC8 *end, UTF_UC32& uc32)
 	{
-		if (UTF_uc16_is_surrogate_high(*it))
+		UTF_UC8 lead = *ptr++;
+		if (lead < 0x80)
 		{
-			uc16[0] = *it;
-			++it;
-			if (it == end)
-			{
-				if (!t_default_char)
-					return false;
+			uc32 = lead;
+			return true;
+		}
 
-				us32.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
+		if (!T_POLICY::checked)
+		{
+			int count = 1 + (lead >= 0xE0) + (lead >= 0xF0);
+			if (count > end - ptr)
+			{
+				ptr = end;
+				uc32 = 0xFFFD;
 				return true;
 			}
+			if (count == 1)
+			{
+				uc32 = (UTF_STATIC_CAST(UTF_UC32, lead & 0x1F) << 6) | (ptr[0] & 0x3F);
+			}
+			else if (count == 2)
+			{
+				uc32 = (UTF_STATIC_CAST(UTF_UC32, lead & 0x0F) << 12) |
+					   (UTF_STATIC_CAST(UTF_UC32, ptr[0] & 0x3F) << 6) | (ptr[1] & 0x3F);
+			}
+			else
+			{
+				uc32 = (UTF_STATIC_CAST(UTF_UC32, lead & 0x07) << 18) |
+					   (UTF_STATIC_CAST(UTF_UC32, ptr[0] & 0x3F) << 12) |
+					   (UTF_STATIC_CAST(UTF_UC32, ptr[1] & 0x3F) << 6) | (ptr[2] & 0x3F);
+			}
+			ptr += count;
+			return true;
+		}
 
-			uc16[1] = *it;
+		// the trail bytes and the range of the first one, by Table 3-7 of
+		// the Unicode Standard
+		int count;
+		UTF_UC8 lower = 0x80, upper = 0xBF;
+		if (0xC2 <= lead && lead <= 0xDF)
+		{
+			count = 1;
+			uc32 = lead & 0x1F;
+		}
+		else if (0xE0 <= lead && lead <= 0xEF)
+		{
+			count = 2;
+			uc32 = lead & 0x0F;
+			if (lead == 0xE0)
+				lower = 0xA0;
+			else if (lead == 0xED && !T_POLICY::surrogates)
+				upper = 0x9F;
+		}
+		else if (0xF0 <= lead && lead <= 0xF4)
+		{
+			count = 3;
+			uc32 = lead & 0x07;
+			if (lead == 0xF0)
+				lower = 0x90;
+			else if (lead == 0xF4)
+				upper = 0x8F;
 		}
 		else
 		{
-			uc16[0] = *it;
-			uc16[1] = 0;
+			return false;
 		}
 
-		if (!UTF_uc16_to_uc32(uc16, &uc32))
+		// an ill-formed sequence ends before the first byte that cannot
+		// continue it (the maximal subpart)
+		for (int i = 0; i < count; ++i)
 		{
-			if (!t_default_char)
+			if (ptr == end || *ptr < lower || upper < *ptr)
 				return false;
-
-			uc32 = UTF_STATIC_CAST(UTF_UC8, t_default_char);
+			uc32 = (uc32 << 6) | (*ptr++ & 0x3F);
+			lower = 0x80;
+			upper = 0xBF;
 		}
-
-		us32.push_back(uc32);
+		return true;
 	}
+};
 
-	return true;
-}
-
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+// UTF_transcode<t_src, t_dst, T_POLICY>(src, size, dest) --- appends size
+// units of src in the encoding t_src to dest in t_dst, under an error policy.
+// Any UTF_ENC works on either side, including the byte-swapped ones:
+//
+//     UTF_transcode<UTF_ENC_16BE, UTF_ENC_8, UTF_policy_replace>(be16, size, s8);
+//
+// On failure dest keeps what was converted before the ill-formed sequence.
+//
+// This is a second engine beside the C UTF_transcode in utf.h, on purpose:
+// that one implements the legacy rules of the converters (one default char
+// per unit, lone surrogates kept or swallowed as they always were), which
+// the policies do not share, and it decides at run time, where this loop is
+// instantiated per policy with the unused checks compiled out. Both read
+// through UTF_enc_load and UTF_enc_store, and UTF_transcode_size mirrors
+// the C engine only.
+template <UTF_ENC t_src, UTF_ENC t_dst, typename T_POLICY, typename T_DEST>
 inline bool
-UTF_U_to_u8(const UTF_US32& us32, UTF_US8& us8)
+UTF_transcode(const typename UTF_enc_unit<t_src>::type *src, size_t size, T_DEST& dest)
 {
-	UTF_UC8 uc8[4];
-	UTF_US32::const_iterator it, end = us32.end();
-	for (it = us32.begin(); it != end; ++it)
+	typedef typename T_DEST::value_type dest_char;
+	typedef typename UTF_enc_unit<t_src>::type src_unit;
+	typedef typename UTF_enc_unit<t_dst>::type dest_unit;
+	const int src_bits = 8 * sizeof(src_unit), dest_bits = 8 * sizeof(dest_unit);
+
+	// the most units one source unit can become (U+FFFD for a byte)
+	const size_t growth = (dest_bits == 8) ? ((src_bits == 32) ? 4 : 3) :
+						  (dest_bits == 16 && src_bits == 32) ? 2 : 1;
+	const size_t old_size = dest.size(), old_capacity = dest.capacity();
+	dest.resize(old_size + size * growth);
+
+	const src_unit *end = src + size;
+	dest_char *begin = &dest[0], *out = begin + old_size;
+	typename UTF_cp_encoder<8 * sizeof(dest_unit)>::unit_type units[4];
+	bool ok = true;
+	while (src != end)
 	{
-		if (!UTF_uc32_to_uc8(*it, uc8))
+		// eight ASCII bytes at a time
+		if (t_src == UTF_ENC_8 && *src < 0x80 && end - src >= 8 &&
+			!(UTF_swar_load64(src) & 0x8080808080808080ULL))
 		{
-			if (!t_default_char)
-				return false;
-
-			us8.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
+			for (int i = 0; i < 8; ++i)
+				UTF_enc_store(t_dst, out, i, src[i]);
+			src += 8;
+			out += 8;
 			continue;
 		}
 
-		us8.push_back(uc8[0]);
-		if (uc8[1])
+		UTF_UC32 uc32;
+		if (!UTF_policy_decoder<t_src>::template next<T_POLICY>(src, end, uc32))
 		{
-			us8.push_back(uc8[1]);
-			if (uc8[2])
+			if (T_POLICY::on_error == UTF_POLICY_FAIL)
 			{
-				us8.push_back(uc8[2]);
-				if (uc8[3])
-				{
-					us8.push_back(uc8[3]);
-				}
+				ok = false;
+				break;
 			}
+			if (T_POLICY::on_error == UTF_POLICY_SKIP)
+				continue;
+			uc32 = 0xFFFD;
+		}
+
+		if (dest_bits == 32 || uc32 < 0x80)
+		{
+			UTF_enc_store(t_dst, out++, 0, uc32);
+			continue;
 		}
+		int count = UTF_cp_encoder<8 * sizeof(dest_unit)>::encode(uc32, units);
+		for (int i = 0; i < count; ++i)
+			UTF_enc_store(t_dst, out++, 0, units[i]);
 	}
 
-	return true;
+	dest.resize(static_cast<size_t>(out - begin));
+	UTF_transcode_trim(dest, old_capacity);
+	return ok;
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+template <typename T_POLICY>
 inline bool
-UTF_U_to_u8(const UTF_US32& us32, UTF_S8& s8)
+UTF_u8_to_u(const UTF_US8& us8, UTF_US16& us16)
 {
-	return UTF_U_to_u8<t_default_char>(us32, reinterpret_cast<UTF_US8&>(s8));
+	return UTF_transcode<UTF_ENC_8, UTF_ENC_16, T_POLICY>(us8.data(), us8.size(), us16);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+template <typename T_POLICY>
 inline bool
-UTF_U_to_u(const UTF_US32& us32, UTF_US16& us16)
+UTF_u8_to_u(const UTF_S8& s8, UTF_US16& us16)
 {
-	UTF_UC16 uc16[2];
-	UTF_US32::const_iterator it, end = us32.end();
-	for (it = us32.begin(); it != end; ++it)
-	{
-		if (!UTF_uc32_to_uc16(*it, uc16))
-		{
-			if (!t_default_char)
-				return false;
+	return UTF_transcode<UTF_ENC_8, UTF_ENC_16, T_POLICY>(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), us16);
+}
 
-			us16.push_back(UTF_STATIC_CAST(UTF_UC8, t_default_char));
-			continue;
-		}
+template <typename T_POLICY>
+inline bool
+UTF_u8_to_U(const UTF_US8& us8, UTF_US32& us32)
+{
+	return UTF_transcode<UTF_ENC_8, UTF_ENC_32, T_POLICY>(us8.data(), us8.size(), us32);
+}
 
-		us16.push_back(uc16[0]);
-		if (uc16[1])
-		{
-			us16.push_back(uc16[1]);
-		}
-	}
+template <typename T_POLICY>
+inline bool
+UTF_u8_to_U(const UTF_S8& s8, UTF_US32& us32)
+{
+	return UTF_transcode<UTF_ENC_8, UTF_ENC_32, T_POLICY>(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size(), us32);
+}
 
-	return true;
+template <typename T_POLICY>
+inline bool
+UTF_u_to_u8(const UTF_US16& us16, UTF_US8& us8)
+{
+	return UTF_transcode<UTF_ENC_16, UTF_ENC_8, T_POLICY>(us16.data(), us16.size(), us8);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+template <typename T_POLICY>
+inline bool
+UTF_u_to_u8(const UTF_US16& us16, UTF_S8& s8)
+{
+	return UTF_transcode<UTF_ENC_16, UTF_ENC_8, T_POLICY>(us16.data(), us16.size(), s8);
+}
+
+template <typename T_POLICY>
+inline bool
+UTF_u_to_U(const UTF_US16& us16, UTF_US32& us32)
+{
+	return UTF_transcode<UTF_ENC_16, UTF_ENC_32, T_POLICY>(us16.data(), us16.size(), us32);
+}
+
+template <typename T_POLICY>
+inline bool
+UTF_U_to_u8(const UTF_US32& us32, UTF_US8& us8)
+{
+	return UTF_transcode<UTF_ENC_32, UTF_ENC_8, T_POLICY>(us32.data(), us32.size(), us8);
+}
+
+template <typename T_POLICY>
+inline bool
+UTF_U_to_u8(const UTF_US32& us32, UTF_S8& s8)
+{
+	return UTF_transcode<UTF_ENC_32, UTF_ENC_8, T_POLICY>(us32.data(), us32.size(), s8);
+}
+
+template <typename T_POLICY>
+inline bool
+UTF_U_to_u(const UTF_US32& us32, UTF_US16& us16)
+{
+	return UTF_transcode<UTF_ENC_32, UTF_ENC_16, T_POLICY>(us32.data(), us32.size(), us16);
+}
+
+// the same encoding: check or repair; UTF_policy_trusted only copies
+template <typename T_POLICY>
 inline bool
 UTF_u8_to_u8(const UTF_US8& src, UTF_US8& dest)
 {
-	dest = src;
-	return true;
+	if (!T_POLICY::checked)
+	{
+		dest = src;
+		return true;
+	}
+	dest.clear();
+	return UTF_transcode<UTF_ENC_8, UTF_ENC_8, T_POLICY>(src.data(), src.size(), dest);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+template <typename T_POLICY>
 inline bool
 UTF_u_to_u(const UTF_US16& src, UTF_US16& dest)
 {
-	dest = src;
-	return true;
+	if (!T_POLICY::checked)
+	{
+		dest = src;
+		return true;
+	}
+	dest.clear();
+	return UTF_transcode<UTF_ENC_16, UTF_ENC_16, T_POLICY>(src.data(), src.size(), dest);
 }
 
-template <char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+template <typename T_POLICY>
 inline bool
 UTF_U_to_U(const UTF_US32& src, UTF_US32& dest)
 {
-	dest = src;
+	if (!T_POLICY::checked)
+	{
+		dest = src;
+		return true;
+	}
+	dest.clear();
+	return UTF_transcode<UTF_ENC_32, UTF_ENC_32, T_POLICY>(src.data(), src.size(), dest);
+}
+
+#ifdef UTF_LITERALS
+// UTF_u_literal, UTF_U_literal --- convert a string literal to UTF-16 or
+// UTF-32 at compile time, as a std::array of code units ending with a NUL:
+//
+//     static constexpr auto key = UTF_u_literal("\u6c34");  // {0x6c34, 0}
+//
+// A literal that is not well-formed UTF-8 (a stray \x escape, an encoded
+// surrogate) fails to compile with a call to UTF_literal_ill_formed.
+inline void
+UTF_literal_ill_formed()
+{
+}
+
+// internal: decodes the well-formed sequence at str, or returns 0
+template <typename T_CHAR>
+constexpr int
+UTF_literal_decode(const T_CHAR *str, size_t size, UTF_UC32 *uc32)
+{
+	UTF_UC8 uc8[4] = { UTF_STATIC_CAST(UTF_UC8, str[0]), 0, 0, 0 };
+	int count = UTF_uc8_count(uc8[0]);
+	if (!count || size < UTF_STATIC_CAST(size_t, count))
+		return 0;
+	for (int i = 1; i < count; ++i)
+		uc8[i] = UTF_STATIC_CAST(UTF_UC8, str[i]);
+	if (!UTF_uc8_to_uc32(uc8, uc32) || *uc32 > 0x10FFFF || (0xD800 <= *uc32 && *uc32 < 0xE000))
+		return 0;
+	return count;
+}
+
+template <typename T_CHAR, size_t t_size>
+constexpr bool
+UTF_literal_is_valid(const T_CHAR (&str)[t_size])
+{
+	UTF_UC32 uc32 = 0;
+	for (size_t i = 0; i + 1 < t_size; )
+	{
+		int count = UTF_literal_decode(str + i, t_size - 1 - i, &uc32);
+		if (!count)
+			return false;
+		i += count;
+	}
 	return true;
 }
 
-template <typename T>
-inline int UTF_cmp(const T *a, const T *b)
+// the number of code units of t_bits bits for the literal, with the NUL
+template <int t_bits, typename T_CHAR, size_t t_size>
+constexpr size_t
+UTF_literal_units(const T_CHAR (&str)[t_size])
 {
-	while (*a && *b)
+	size_t units = 1;
+	UTF_UC32 uc32 = 0;
+	for (size_t i = 0; i + 1 < t_size; )
 	{
-		if (*a < *b) return -1;
-		if (*a > *b) return 1;
-		++a;
-		++b;
+		int count = UTF_literal_decode(str + i, t_size - 1 - i, &uc32);
+		if (!count)
+		{
+			UTF_literal_ill_formed();
+			return 0;
+		}
+		units += (t_bits == 16) ? UTF_uc32_count16(uc32) : 1;
+		i += count;
 	}
-	if (*a < *b) return -1;
-	if (*a > *b) return 1;
-	return 0;
+	return units;
 }
 
-template <typename T>
-inline int UTF_cmpn(const T *a, const T *b, size_t len)
+template <int t_bits, size_t t_units, typename T_CHAR, size_t t_size>
+constexpr std::array<typename UTF_cp_encoder<t_bits>::unit_type, t_units>
+UTF_literal_convert(const T_CHAR (&str)[t_size])
 {
-	while (*a && *b)
+	std::array<typename UTF_cp_encoder<t_bits>::unit_type, t_units> units = {};
+	typename UTF_cp_encoder<t_bits>::unit_type buf[4] = {};
+	UTF_UC32 uc32 = 0;
+	size_t k = 0;
+	for (size_t i = 0; i + 1 < t_size; )
 	{
-		if (len-- == 0) return 0;
-		if (*a < *b) return -1;
-		if (*a > *b) return 1;
-		++a;
-		++b;
+		i += UTF_literal_decode(str + i, t_size - 1 - i, &uc32);
+		int count = UTF_cp_encoder<t_bits>::encode(uc32, buf);
+		for (int j = 0; j < count; ++j)
+			units[k++] = buf[j];
 	}
-	if (*a < *b) return -1;
-	if (*a > *b) return 1;
-	return 0;
+	return units;
 }
 
+#define UTF_u_literal(str) \
+	UTF_literal_convert<16, UTF_literal_units<16>(UTF_u8(str))>(UTF_u8(str))
+#define UTF_U_literal(str) \
+	UTF_literal_convert<32, UTF_literal_units<32>(UTF_u8(str))>(UTF_u8(str))
+#endif  // def UTF_LITERALS
+
 template <typename UT>
 inline UT *
 UTF_fgets(UT *str, int count, FILE *fp)
@@ -439,6 +1529,89 @@ UTF_fgets(UT *str, int count, FILE *fp)
 	return str[0] ? str : NULL;
 }
 
+#if __cplusplus >= 201103L || _MSC_VER >= 1900 /* C++11 */
+#include <atomic>
+
+/* UTF_atomic_stats --- UTF_STATS shared by threads (relaxed atomics) */
+class UTF_atomic_stats
+{
+public:
+	UTF_atomic_stats()
+	{
+		reset();
+	}
+
+	void add(const UTF_STATS& stats)
+	{
+		m_units.fetch_add(stats.units, std::memory_order_relaxed);
+		m_bytes.fetch_add(stats.bytes, std::memory_order_relaxed);
+		m_code_points.fetch_add(stats.code_points, std::memory_order_relaxed);
+		for (int i = 0; i < 4; ++i)
+			m_sequences[i].fetch_add(stats.sequences[i], std::memory_order_relaxed);
+		m_surrogate_pairs.fetch_add(stats.surrogate_pairs, std::memory_order_relaxed);
+		m_errors.fetch_add(stats.errors, std::memory_order_relaxed);
+		m_replacements.fetch_add(stats.replacements, std::memory_order_relaxed);
+
+		uint64_t value = m_first_error.load(std::memory_order_relaxed);
+		while (stats.first_error < value &&
+			   !m_first_error.compare_exchange_weak(value, stats.first_error, std::memory_order_relaxed))
+		{
+		}
+		if (stats.last_error != UTF_STATS_NO_ERROR)
+		{
+			value = m_last_error.load(std::memory_order_relaxed);
+			while ((value == UTF_STATS_NO_ERROR || value < stats.last_error) &&
+				   !m_last_error.compare_exchange_weak(value, stats.last_error, std::memory_order_relaxed))
+			{
+			}
+		}
+	}
+
+	/* a snapshot; counters added concurrently may be partially included */
+	void load(UTF_STATS& stats) const
+	{
+		stats.units = m_units.load(std::memory_order_relaxed);
+		stats.bytes = m_bytes.load(std::memory_order_relaxed);
+		stats.code_points = m_code_points.load(std::memory_order_relaxed);
+		for (int i = 0; i < 4; ++i)
+			stats.sequences[i] = m_sequences[i].load(std::memory_order_relaxed);
+		stats.surrogate_pairs = m_surrogate_pairs.load(std::memory_order_relaxed);
+		stats.errors = m_errors.load(std::memory_order_relaxed);
+		stats.replacements = m_replacements.load(std::memory_order_relaxed);
+		stats.first_error = m_first_error.load(std::memory_order_relaxed);
+		stats.last_error = m_last_error.load(std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		m_units.store(0, std::memory_order_relaxed);
+		m_bytes.store(0, std::memory_order_relaxed);
+		m_code_points.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < 4; ++i)
+			m_sequences[i].store(0, std::memory_order_relaxed);
+		m_surrogate_pairs.store(0, std::memory_order_relaxed);
+		m_errors.store(0, std::memory_order_relaxed);
+		m_replacements.store(0, std::memory_order_relaxed);
+		m_first_error.store(UTF_STATS_NO_ERROR, std::memory_order_relaxed);
+		m_last_error.store(UTF_STATS_NO_ERROR, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> m_units;
+	std::atomic<uint64_t> m_bytes;
+	std::atomic<uint64_t> m_code_points;
+	std::atomic<uint64_t> m_sequences[4];
+	std::atomic<uint64_t> m_surrogate_pairs;
+	std::atomic<uint64_t> m_errors;
+	std::atomic<uint64_t> m_replacements;
+	std::atomic<uint64_t> m_first_error;
+	std::atomic<uint64_t> m_last_error;
+
+	UTF_atomic_stats(const UTF_atomic_stats&);
+	UTF_atomic_stats& operator=(const UTF_atomic_stats&);
+};
+#endif  /* C++11 */
+
 #ifdef UTF_WIDE_IS_UTF16
 	#define UTF_L_to_U UTF_u_to_U
 	#define UTF_L_to_u UTF_u_to_u
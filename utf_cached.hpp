@@ -0,0 +1,263 @@
+/* utf_cached.hpp --- a string that caches its conversions */
+
+#ifndef UTF_CACHED_HPP_
+#define UTF_CACHED_HPP_
+
+#pragma once
+
+#include "utf.hpp"
+#include <atomic>
+#include <memory>
+
+// UTF_cached_string --- a string kept in the encoding it was made from, whose
+// UTF-8, UTF-16 and UTF-32 forms are converted on first request and cached:
+//
+//     UTF_cached_string name(s8);
+//     send(name.u8());             // the original
+//     call_legacy(name.u());       // converted once
+//     tokenize(name.U().data());   // converted once
+//
+// Copies share the original and the cached forms, which are never modified:
+// a form converted through one copy is there for all of them, and assign()
+// gives the holder new text without touching the other copies. The const
+// members may be called from several threads at once; a form returned by
+// reference lives until the holder is assigned or destroyed, and share_u8(),
+// share_u() and share_U() return it with shared ownership.
+//
+// The first conversion checks that the original is well-formed Unicode (no
+// lone surrogates, nothing above U+10FFFF) and remembers the answer; later
+// conversions of a well-formed original use UTF_policy_trusted. Pass
+// validated = true for text already checked elsewhere. Ill-formed text is
+// converted by the rules of the converters, with UTF_DEFAULT_CHAR.
+class UTF_cached_string
+{
+public:
+	UTF_cached_string()
+	{
+		assign(UTF_S8(), true);
+	}
+	explicit UTF_cached_string(UTF_S8 s8, bool validated = false)
+	{
+		assign(std::move(s8), validated);
+	}
+	explicit UTF_cached_string(UTF_US16 us16, bool validated = false)
+	{
+		assign(std::move(us16), validated);
+	}
+	explicit UTF_cached_string(UTF_US32 us32, bool validated = false)
+	{
+		assign(std::move(us32), validated);
+	}
+
+	UTF_cached_string(const UTF_cached_string& other) : m_state(other.m_state)
+	{
+	}
+	// leaves other empty, as if default-constructed
+	UTF_cached_string(UTF_cached_string&& other)
+	{
+		assign(UTF_S8(), true);
+		swap(other);
+	}
+	UTF_cached_string& operator=(const UTF_cached_string& other)
+	{
+		m_state = other.m_state;
+		return *this;
+	}
+	UTF_cached_string& operator=(UTF_cached_string&& other)
+	{
+		if (this != &other)
+		{
+			UTF_cached_string empty;
+			swap(other);
+			other.swap(empty);
+		}
+		return *this;
+	}
+
+	void assign(UTF_S8 s8, bool validated = false)
+	{
+		std::shared_ptr<state> fresh = std::make_shared<state>(UTF_ENC_8, validated);
+		fresh->s8.store(new UTF_S8(std::move(s8)), std::memory_order_relaxed);
+		m_state.swap(fresh);
+	}
+	void assign(UTF_US16 us16, bool validated = false)
+	{
+		std::shared_ptr<state> fresh = std::make_shared<state>(UTF_ENC_16, validated);
+		fresh->us16.store(new UTF_US16(std::move(us16)), std::memory_order_relaxed);
+		m_state.swap(fresh);
+	}
+	void assign(UTF_US32 us32, bool validated = false)
+	{
+		std::shared_ptr<state> fresh = std::make_shared<state>(UTF_ENC_32, validated);
+		fresh->us32.store(new UTF_US32(std::move(us32)), std::memory_order_relaxed);
+		m_state.swap(fresh);
+	}
+
+	// UTF_ENC_8, UTF_ENC_16 or UTF_ENC_32: the encoding of the original
+	UTF_ENC encoding() const
+	{
+		return m_state->origin;
+	}
+	// whether the original is known to be well-formed, without checking it
+	bool validated() const
+	{
+		return m_state->validity.load(std::memory_order_acquire) > 0;
+	}
+	// whether the original is well-formed, checked once
+	bool well_formed() const
+	{
+		int validity = m_state->validity.load(std::memory_order_acquire);
+		if (!validity)
+		{
+			bool ok;
+			switch (m_state->origin)
+			{
+			case UTF_ENC_8: ok = check<UTF_ENC_8>(*m_state->s8.load(std::memory_order_relaxed)); break;
+			case UTF_ENC_16: ok = check<UTF_ENC_16>(*m_state->us16.load(std::memory_order_relaxed)); break;
+			default: ok = check<UTF_ENC_32>(*m_state->us32.load(std::memory_order_relaxed)); break;
+			}
+			validity = ok ? 1 : -1;
+			m_state->validity.store(validity, std::memory_order_release);
+		}
+		return validity > 0;
+	}
+
+	const UTF_S8& u8() const
+	{
+		return *form<UTF_ENC_8>(m_state->s8);
+	}
+	const UTF_US16& u() const
+	{
+		return *form<UTF_ENC_16>(m_state->us16);
+	}
+	const UTF_US32& U() const
+	{
+		return *form<UTF_ENC_32>(m_state->us32);
+	}
+
+	std::shared_ptr<const UTF_S8> share_u8() const
+	{
+		return std::shared_ptr<const UTF_S8>(m_state, &u8());
+	}
+	std::shared_ptr<const UTF_US16> share_u() const
+	{
+		return std::shared_ptr<const UTF_US16>(m_state, &u());
+	}
+	std::shared_ptr<const UTF_US32> share_U() const
+	{
+		return std::shared_ptr<const UTF_US32>(m_state, &U());
+	}
+
+	// whether the forms are there without converting
+	bool has_u8() const
+	{
+		return m_state->s8.load(std::memory_order_acquire) != NULL;
+	}
+	bool has_u() const
+	{
+		return m_state->us16.load(std::memory_order_acquire) != NULL;
+	}
+	bool has_U() const
+	{
+		return m_state->us32.load(std::memory_order_acquire) != NULL;
+	}
+
+	void swap(UTF_cached_string& other)
+	{
+		m_state.swap(other.m_state);
+	}
+
+private:
+	// the original and the forms, each set once and owned here
+	struct state
+	{
+		UTF_ENC origin;
+		std::atomic<int> validity;   // 1 well-formed, -1 ill-formed, 0 unknown
+		std::atomic<const UTF_S8 *> s8;
+		std::atomic<const UTF_US16 *> us16;
+		std::atomic<const UTF_US32 *> us32;
+
+		state(UTF_ENC enc, bool validated)
+			: origin(enc), validity(validated ? 1 : 0), s8(NULL), us16(NULL), us32(NULL)
+		{
+		}
+		~state()
+		{
+			delete s8.load();
+			delete us16.load();
+			delete us32.load();
+		}
+	};
+	std::shared_ptr<state> m_state;
+
+	static const UTF_UC8 *units(const UTF_S8& s8)
+	{
+		return reinterpret_cast<const UTF_UC8 *>(s8.data());
+	}
+	static const UTF_UC16 *units(const UTF_US16& us16)
+	{
+		return us16.data();
+	}
+	static const UTF_UC32 *units(const UTF_US32& us32)
+	{
+		return us32.data();
+	}
+
+	template <UTF_ENC t_enc, typename T_STRING>
+	static bool check(const T_STRING& str)
+	{
+		typedef typename UTF_enc_unit<t_enc>::type unit_type;
+		const unit_type *ptr = units(str), *end = ptr + str.size();
+		UTF_UC32 uc32;
+		while (ptr != end)
+		{
+			if (!UTF_policy_decoder<t_enc>::template next<UTF_policy_fail>(ptr, end, uc32))
+				return false;
+		}
+		return true;
+	}
+
+	// converts src into the empty dest, checking src on the way if not known
+	template <UTF_ENC t_src, UTF_ENC t_dst, typename T_SRC, typename T_DEST>
+	void convert(const T_SRC& src, T_DEST& dest) const
+	{
+		int validity = m_state->validity.load(std::memory_order_acquire);
+		if (validity > 0)
+		{
+			UTF_transcode<t_src, t_dst, UTF_policy_trusted>(units(src), src.size(), dest);
+			return;
+		}
+		if (!validity)
+		{
+			validity = UTF_transcode<t_src, t_dst, UTF_policy_fail>(units(src), src.size(), dest) ? 1 : -1;
+			m_state->validity.store(validity, std::memory_order_release);
+			if (validity > 0)
+				return;
+			dest.clear();
+		}
+		UTF_transcode_append<t_src, t_dst, UTF_DEFAULT_CHAR>(units(src), src.size(), dest);
+	}
+
+	// the cached form in slot, converted from the original if not yet there;
+	// a thread that loses the race to fill the slot takes the winner's form
+	template <UTF_ENC t_dst, typename T_STRING>
+	const T_STRING *form(std::atomic<const T_STRING *>& slot) const
+	{
+		const T_STRING *cached = slot.load(std::memory_order_acquire);
+		if (cached)
+			return cached;
+
+		std::unique_ptr<T_STRING> fresh(new T_STRING);
+		switch (m_state->origin)
+		{
+		case UTF_ENC_8: convert<UTF_ENC_8, t_dst>(*m_state->s8.load(std::memory_order_relaxed), *fresh); break;
+		case UTF_ENC_16: convert<UTF_ENC_16, t_dst>(*m_state->us16.load(std::memory_order_relaxed), *fresh); break;
+		default: convert<UTF_ENC_32, t_dst>(*m_state->us32.load(std::memory_order_relaxed), *fresh); break;
+		}
+		if (!slot.compare_exchange_strong(cached, fresh.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+			return cached;
+		return fresh.release();
+	}
+};
+
+#endif  /* ndef UTF_CACHED_HPP_ */
@@ -0,0 +1,300 @@
+/* utf_compact.hpp --- a string stored in the narrowest fixed-width encoding */
+
+#ifndef UTF_COMPACT_HPP_
+#define UTF_COMPACT_HPP_
+
+#pragma once
+
+#include "utf.hpp"
+#include <stdexcept>
+
+// internal: converts size units of T_FROM at from to T_TO at to, through
+// memcpy because both sides may be the bytes of a wider array
+template <typename T_FROM, typename T_TO>
+inline void
+UTF_compact_copy(const void *from, void *to, size_t size)
+{
+	const UTF_UC8 *src = static_cast<const UTF_UC8 *>(from);
+	UTF_UC8 *dest = static_cast<UTF_UC8 *>(to);
+	for (size_t i = 0; i < size; ++i)
+	{
+		T_FROM value;
+		std::memcpy(&value, src + i * sizeof(T_FROM), sizeof(T_FROM));
+		T_TO unit = static_cast<T_TO>(value);
+		std::memcpy(dest + i * sizeof(T_TO), &unit, sizeof(T_TO));
+	}
+}
+
+// internal: the same for units of from_width and to_width (1, 2 or 4) bytes
+inline void
+UTF_compact_copy(const void *from, int from_width, void *to, int to_width, size_t size)
+{
+	switch (from_width * 8 + to_width)
+	{
+	case 1 * 8 + 1: std::memcpy(to, from, size); break;
+	case 1 * 8 + 2: UTF_compact_copy<uint8_t, uint16_t>(from, to, size); break;
+	case 1 * 8 + 4: UTF_compact_copy<uint8_t, uint32_t>(from, to, size); break;
+	case 2 * 8 + 1: UTF_compact_copy<uint16_t, uint8_t>(from, to, size); break;
+	case 2 * 8 + 2: std::memcpy(to, from, size * 2); break;
+	case 2 * 8 + 4: UTF_compact_copy<uint16_t, uint32_t>(from, to, size); break;
+	case 4 * 8 + 1: UTF_compact_copy<uint32_t, uint8_t>(from, to, size); break;
+	case 4 * 8 + 2: UTF_compact_copy<uint32_t, uint16_t>(from, to, size); break;
+	default: std::memcpy(to, from, size * 4); break;
+	}
+}
+
+// UTF_compact_string --- text stored as in Python's PEP 393: one code point
+// per unit of 1 (Latin-1), 2 (UCS-2) or 4 (UTF-32) bytes, the narrowest that
+// holds the widest code point, so indexing and slicing by code point are
+// O(1) and most text takes a half or a quarter of a UTF_US32.
+//
+// It is built from UTF-8, UTF-16 or UTF-32 by the rules of the converters,
+// with UTF_DEFAULT_CHAR for ill-formed sequences and code points above
+// U+10FFFF; with UTF_DEFAULT_CHAR 0 the assign_* functions stop there and
+// return false. A SIMD pass over the code points picks the width. UTF-8
+// that is not ASCII and UTF-16 with surrogates are converted to UTF-32 on
+// the way, on the stack when short.
+//
+//     UTF_compact_string text(UTF_S8("na\xC3\xAFve"));  // 1 byte each
+//     UTF_UC32 c = text[2];                           // U+00EF
+//     UTF_US16 tail = text.substr(2).to_u();
+class UTF_compact_string
+{
+public:
+	typedef size_t size_type;
+	typedef UTF_UC32 value_type;
+	static const size_type npos = static_cast<size_type>(-1);
+
+	UTF_compact_string() : m_size(0), m_kind(1)
+	{
+	}
+	explicit UTF_compact_string(const UTF_S8& s8) : m_size(0), m_kind(1)
+	{
+		assign_u8(reinterpret_cast<const UTF_UC8 *>(s8.data()), s8.size());
+	}
+	explicit UTF_compact_string(const UTF_US16& us16) : m_size(0), m_kind(1)
+	{
+		assign_u(us16.data(), us16.size());
+	}
+	explicit UTF_compact_string(const UTF_US32& us32) : m_size(0), m_kind(1)
+	{
+		assign_U(us32.data(), us32.size());
+	}
+
+	bool assign_u8(const UTF_UC8 *uj8, size_t size)
+	{
+		if (UTF_simd_or(uj8, size, 1) < 0x80)
+		{
+			assign_cps(uj8, size, 1, 0);
+			return true;
+		}
+		UTF_small_buffer<UTF_UC32, 128> uj32;
+		bool ok = UTF_convert_to_stack<UTF_ENC_8, UTF_ENC_32, UTF_DEFAULT_CHAR>(uj8, size, uj32);
+		return assign_U(uj32.data(), uj32.size()) && ok;
+	}
+	bool assign_u(const UTF_UC16 *uj16, size_t size)
+	{
+		const int width = static_cast<int>(sizeof(UTF_UC16));
+		UTF_UC32 max = UTF_simd_or(uj16, size, width);
+		bool surrogates = false;
+		for (size_t i = 0; max >= 0xD800 && i < size && !surrogates; ++i)
+			surrogates = (uj16[i] & 0xF800) == 0xD800;
+		if (!surrogates)
+		{
+			assign_cps(uj16, size, width, max);
+			return true;
+		}
+		UTF_small_buffer<UTF_UC32, 128> uj32;
+		bool ok = UTF_convert_to_stack<UTF_ENC_16, UTF_ENC_32, UTF_DEFAULT_CHAR>(uj16, size, uj32);
+		return assign_U(uj32.data(), uj32.size()) && ok;
+	}
+	bool assign_U(const UTF_UC32 *uj32, size_t size)
+	{
+		UTF_UC32 max = UTF_simd_or(uj32, size, 4);
+		size_t i = 0;
+		if (max > 0x10FFFF)
+		{
+			while (i < size && uj32[i] <= 0x10FFFF)
+				++i;
+		}
+		if (i == size || max <= 0x10FFFF)
+		{
+			assign_cps(uj32, size, 4, max);
+			return true;
+		}
+
+		// rare: replace the code points beyond Unicode
+		UTF_US32 valid(uj32, size);
+		for (; i < size; ++i)
+		{
+			if (valid[i] > 0x10FFFF)
+			{
+				if (!UTF_DEFAULT_CHAR)
+				{
+					valid.resize(i);
+					break;
+				}
+				valid[i] = static_cast<UTF_UC32>(static_cast<UTF_UC8>(UTF_DEFAULT_CHAR));
+			}
+		}
+		assign_cps(valid.data(), valid.size(), 4, UTF_simd_or(valid.data(), valid.size(), 4));
+		return valid.size() == size;
+	}
+
+	// the bytes per code point: 1, 2 or 4
+	int kind() const
+	{
+		return m_kind;
+	}
+	size_type size() const
+	{
+		return m_size;
+	}
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+	// the bytes that hold the code points
+	size_t size_in_bytes() const
+	{
+		return m_size * m_kind;
+	}
+
+	UTF_UC32 operator[](size_type i) const
+	{
+		const UTF_UC8 *bytes = reinterpret_cast<const UTF_UC8 *>(m_words.data());
+		uint16_t unit;
+		switch (m_kind)
+		{
+		case 1:
+			return bytes[i];
+		case 2:
+			std::memcpy(&unit, bytes + i * 2, 2);
+			return unit;
+		default:
+			return m_words[i];
+		}
+	}
+	UTF_UC32 at(size_type i) const
+	{
+		if (i >= m_size)
+			throw std::out_of_range("UTF_compact_string::at");
+		return (*this)[i];
+	}
+
+	// the code points [pos, pos + count), in the narrowest width for them
+	UTF_compact_string substr(size_type pos, size_type count = npos) const
+	{
+		if (pos > m_size)
+			throw std::out_of_range("UTF_compact_string::substr");
+		if (count > m_size - pos)
+			count = m_size - pos;
+		const UTF_UC8 *bytes = reinterpret_cast<const UTF_UC8 *>(m_words.data()) + pos * m_kind;
+		UTF_compact_string result;
+		result.assign_cps(bytes, count, m_kind, (m_kind == 1) ? 0 : UTF_simd_or(bytes, count, m_kind));
+		return result;
+	}
+
+	UTF_S8 to_u8() const
+	{
+		UTF_S8 s8;
+		if (m_kind == 4)
+		{
+			UTF_transcode_append<UTF_ENC_32, UTF_ENC_8, UTF_DEFAULT_CHAR>(m_words.data(), m_size, s8);
+			return s8;
+		}
+
+		size_t extra = 0;
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			UTF_UC32 uc32 = (*this)[i];
+			extra += (uc32 >= 0x80) + (uc32 >= 0x800);
+		}
+		s8.resize(m_size + extra);
+		if (!extra)
+		{
+			UTF_compact_copy(m_words.data(), 1, &s8[0], 1, m_size);
+			return s8;
+		}
+		UTF_UC8 *out = reinterpret_cast<UTF_UC8 *>(&s8[0]);
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			UTF_UC32 uc32 = (*this)[i];
+			if (uc32 < 0x80)
+			{
+				*out++ = static_cast<UTF_UC8>(uc32);
+			}
+			else if (uc32 < 0x800)
+			{
+				*out++ = static_cast<UTF_UC8>(0xC0 | (uc32 >> 6));
+				*out++ = static_cast<UTF_UC8>(0x80 | (uc32 & 0x3F));
+			}
+			else
+			{
+				*out++ = static_cast<UTF_UC8>(0xE0 | (uc32 >> 12));
+				*out++ = static_cast<UTF_UC8>(0x80 | ((uc32 >> 6) & 0x3F));
+				*out++ = static_cast<UTF_UC8>(0x80 | (uc32 & 0x3F));
+			}
+		}
+		return s8;
+	}
+	UTF_US16 to_u() const
+	{
+		UTF_US16 us16;
+		if (m_kind == 4)
+		{
+			UTF_transcode_append<UTF_ENC_32, UTF_ENC_16, UTF_DEFAULT_CHAR>(m_words.data(), m_size, us16);
+			return us16;
+		}
+		us16.resize(m_size);
+		if (m_size)
+			UTF_compact_copy(m_words.data(), m_kind, &us16[0], static_cast<int>(sizeof(us16[0])), m_size);
+		return us16;
+	}
+	UTF_US32 to_U() const
+	{
+		UTF_US32 us32;
+		us32.resize(m_size);
+		if (m_size)
+			UTF_compact_copy(m_words.data(), m_kind, &us32[0], 4, m_size);
+		return us32;
+	}
+
+	bool operator==(const UTF_compact_string& other) const
+	{
+		// the width is a function of the text, so equal texts have equal bytes
+		return m_size == other.m_size && m_kind == other.m_kind &&
+			   std::memcmp(m_words.data(), other.m_words.data(), size_in_bytes()) == 0;
+	}
+	bool operator!=(const UTF_compact_string& other) const
+	{
+		return !(*this == other);
+	}
+
+	void swap(UTF_compact_string& other)
+	{
+		m_words.swap(other.m_words);
+		std::swap(m_size, other.m_size);
+		std::swap(m_kind, other.m_kind);
+	}
+
+private:
+	UTF_US32 m_words;   // the units, packed; UTF_UC32 for the alignment
+	size_t m_size;
+	int m_kind;
+
+	// stores size code points of width bytes each, whose bitwise OR is max
+	// (unused for width 1)
+	void assign_cps(const void *cps, size_t size, int width, UTF_UC32 max)
+	{
+		int kind = (width == 1 || max < 0x100) ? 1 : (max < 0x10000) ? 2 : 4;
+		UTF_US32 words((size * kind + 3) / 4, 0);
+		if (size)
+			UTF_compact_copy(cps, width, &words[0], kind, size);
+		m_words.swap(words);
+		m_size = size;
+		m_kind = kind;
+	}
+};
+
+#endif  /* ndef UTF_COMPACT_HPP_ */
@@ -15,9 +15,45 @@
 #define UTF_GETLINE_CHUNK_BYTES 8192U
 #endif
 
+/* UTF_ALLOCATOR --- memory for the *_getline_ex readers, e.g. from an arena
+ * or a pool. reallocate gets the old size so that an arena can copy; it and
+ * allocate return NULL on failure. release is never called with NULL. */
+typedef struct UTF_ALLOCATOR
+{
+	void *(*allocate)(void *user, size_t size);
+	void *(*reallocate)(void *user, void *ptr, size_t old_size, size_t new_size);
+	void (*release)(void *user, void *ptr);
+	void *user;
+} UTF_ALLOCATOR;
+
+/* internal: the allocator, or UTF_MALLOC and friends if it is NULL */
+static inline void *
+utf_allocate(const UTF_ALLOCATOR *alloc, size_t size)
+{
+	return alloc ? alloc->allocate(alloc->user, size) : UTF_MALLOC(size);
+}
+
+static inline void *
+utf_reallocate(const UTF_ALLOCATOR *alloc, void *ptr, size_t old_size, size_t new_size)
+{
+	return alloc ? alloc->reallocate(alloc->user, ptr, old_size, new_size) : UTF_REALLOC(ptr, new_size);
+}
+
+static inline void
+utf_release(const UTF_ALLOCATOR *alloc, void *ptr)
+{
+	if (!ptr)
+		return;
+	if (alloc)
+		alloc->release(alloc->user, ptr);
+	else
+		UTF_FREE(ptr);
+}
+
 /* internal: ensure capacity for element_count elements (not bytes) */
 static inline int
-utf_ensure_capacity(void **pbuf, UTF_SIZE_T *pcap, UTF_SIZE_T needed_elems, size_t elem_size)
+utf_ensure_capacity(const UTF_ALLOCATOR *alloc, void **pbuf, UTF_SIZE_T *pcap, UTF_SIZE_T needed_elems,
+					size_t elem_size)
 {
 	UTF_SIZE_T cap = *pcap;
 	if (cap >= needed_elems)
@@ -44,13 +80,13 @@ utf_ensure_capacity(void **pbuf, UTF_SIZE_T *pcap, UTF_SIZE_T needed_elems, size
 
 	if (*pbuf == NULL)
 	{
-		void *p = malloc(cap * elem_size);
+		void *p = utf_allocate(alloc, cap * elem_size);
 		if (!p) return -1;
 		*pbuf = p;
 	}
 	else
 	{
-		void *p = realloc(*pbuf, cap * elem_size);
+		void *p = utf_reallocate(alloc, *pbuf, *pcap * elem_size, cap * elem_size);
 		if (!p) return -1;
 		*pbuf = p;
 	}
@@ -60,7 +96,7 @@ utf_ensure_capacity(void **pbuf, UTF_SIZE_T *pcap, UTF_SIZE_T needed_elems, size
 
 /* UTF-16 host-endian, chunked reader */
 static inline UTF_UC16 *
-UTF16_getline(FILE *fp)
+utf_utf16_getline(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
 {
 	if (!fp || feof(fp))
 		return NULL;
@@ -72,7 +108,7 @@ UTF16_getline(FILE *fp)
 
 	size_t chunk_elems = UTF_GETLINE_CHUNK_BYTES / sizeof(UTF_UC16);
 	if (chunk_elems == 0) chunk_elems = 1;
-	UTF_UC16 *tmp = (UTF_UC16 *)malloc(chunk_elems * sizeof(UTF_UC16));
+	UTF_UC16 *tmp = (UTF_UC16 *)utf_allocate(scratch, chunk_elems * sizeof(UTF_UC16));
 	if (!tmp)
 		return NULL;
 
@@ -94,10 +130,10 @@ UTF16_getline(FILE *fp)
 		/* append up to i (or all read if no newline) */
 		if (i > 0)
 		{
-			if (utf_ensure_capacity((void **)&result, &cap, len + i + 1, sizeof(UTF_UC16)) != 0)
+			if (utf_ensure_capacity(out, (void **)&result, &cap, len + i + 1, sizeof(UTF_UC16)) != 0)
 			{
-				free(tmp);
-				free(result);
+				utf_release(scratch, tmp);
+				utf_release(out, result);
 				return NULL;
 			}
 			memcpy(result + len, tmp, i * sizeof(UTF_UC16));
@@ -114,10 +150,10 @@ UTF16_getline(FILE *fp)
 			else
 			{
 				/* append newline */
-				if (utf_ensure_capacity((void **)&result, &cap, len + 2, sizeof(UTF_UC16)) != 0)
+				if (utf_ensure_capacity(out, (void **)&result, &cap, len + 2, sizeof(UTF_UC16)) != 0)
 				{
-					free(tmp);
-					free(result);
+					utf_release(scratch, tmp);
+					utf_release(out, result);
 					return NULL;
 				}
 				result[len++] = (UTF_UC16)'\n';
@@ -135,53 +171,61 @@ UTF16_getline(FILE *fp)
 			}
 
 			/* terminate and return */
-			if (utf_ensure_capacity((void **)&result, &cap, len + 1, sizeof(UTF_UC16)) != 0)
+			if (utf_ensure_capacity(out, (void **)&result, &cap, len + 1, sizeof(UTF_UC16)) != 0)
 			{
-				free(tmp);
-				free(result);
+				utf_release(scratch, tmp);
+				utf_release(out, result);
 				return NULL;
 			}
 			result[len] = 0;
-			free(tmp);
+			utf_release(scratch, tmp);
 			return result;
 		}
-		else /* no newline in this chunk: append all */
-		{
-			if (read > 0)
-			{
-				if (utf_ensure_capacity((void **)&result, &cap, len + read + 1, sizeof(UTF_UC16)) != 0)
-				{
-					free(tmp);
-					free(result);
-					return NULL;
-				}
-				memcpy(result + len, tmp, read * sizeof(UTF_UC16));
-				len += read;
-			}
-			/* continue reading */
-		}
 	}
 
 	/* EOF or error */
-	free(tmp);
+	utf_release(scratch, tmp);
 	if (!got_any)
 	{
-		free(result);
+		utf_release(out, result);
 		return NULL;
 	}
 	/* terminate and return partial line */
-	if (utf_ensure_capacity((void **)&result, &cap, len + 1, sizeof(UTF_UC16)) != 0)
+	if (utf_ensure_capacity(out, (void **)&result, &cap, len + 1, sizeof(UTF_UC16)) != 0)
 	{
-		free(result);
+		utf_release(out, result);
 		return NULL;
 	}
 	result[len] = 0;
 	return result;
 }
 
+static inline UTF_UC16 *
+UTF16_getline(FILE *fp)
+{
+	UTF_UC16 *ret;
+	UTF_TRACE_ENTER(UTF16_getline, 0);
+	ret = utf_utf16_getline(fp, NULL, NULL);
+	UTF_TRACE_EXIT(UTF16_getline, ret ? UTF_uj16_len(ret) : 0);
+	return ret;
+}
+
+/* UTF16_getline_ex --- UTF16_getline with the line from out and the
+ * temporary read buffer from scratch; either may be NULL for UTF_MALLOC and
+ * friends. Release the line with out. Likewise the other *_getline_ex. */
+static inline UTF_UC16 *
+UTF16_getline_ex(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
+{
+	UTF_UC16 *ret;
+	UTF_TRACE_ENTER(UTF16_getline, 0);
+	ret = utf_utf16_getline(fp, out, scratch);
+	UTF_TRACE_EXIT(UTF16_getline, ret ? UTF_uj16_len(ret) : 0);
+	return ret;
+}
+
 /* UTF-16 file-endian (raw/byte-swapped) */
 static inline UTF_UC16 *
-UTF16XE_getline(FILE *fp)
+utf_utf16xe_getline(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
 {
 	if (!fp || feof(fp))
 		return NULL;
@@ -193,7 +237,7 @@ UTF16XE_getline(FILE *fp)
 
 	size_t chunk_elems = UTF_GETLINE_CHUNK_BYTES / sizeof(UTF_UC16);
 	if (chunk_elems == 0) chunk_elems = 1;
-	UTF_UC16 *tmp = (UTF_UC16 *)malloc(chunk_elems * sizeof(UTF_UC16));
+	UTF_UC16 *tmp = (UTF_UC16 *)utf_allocate(scratch, chunk_elems * sizeof(UTF_UC16));
 	if (!tmp) return NULL;
 
 	for (;;)
@@ -210,13 +254,13 @@ UTF16XE_getline(FILE *fp)
 				break;
 		}
 
-		/* append up to i */
+		/* append up to i (or all read if no newline) */
 		if (i > 0)
 		{
-			if (utf_ensure_capacity((void **)&rawbuf, &cap, len + i + 1, sizeof(UTF_UC16)) != 0)
+			if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + i + 1, sizeof(UTF_UC16)) != 0)
 			{
-				free(tmp);
-				free(rawbuf);
+				utf_release(scratch, tmp);
+				utf_release(out, rawbuf);
 				return NULL;
 			}
 			memcpy(rawbuf + len, tmp, i * sizeof(UTF_UC16));
@@ -232,10 +276,10 @@ UTF16XE_getline(FILE *fp)
 			}
 			else
 			{
-				if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 2, sizeof(UTF_UC16)) != 0)
+				if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 2, sizeof(UTF_UC16)) != 0)
 				{
-					free(tmp);
-					free(rawbuf);
+					utf_release(scratch, tmp);
+					utf_release(out, rawbuf);
 					return NULL;
 				}
 				rawbuf[len++] = UTF16_XE('\n');
@@ -253,10 +297,10 @@ UTF16XE_getline(FILE *fp)
 			}
 
 			/* terminate raw buffer */
-			if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC16)) != 0)
+			if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC16)) != 0)
 			{
-				free(tmp);
-				free(rawbuf);
+				utf_release(scratch, tmp);
+				utf_release(out, rawbuf);
 				return NULL;
 			}
 			rawbuf[len] = 0;
@@ -268,36 +312,22 @@ UTF16XE_getline(FILE *fp)
 					rawbuf[j] = UTF16_XE(rawbuf[j]);
 			}
 
-			free(tmp);
+			utf_release(scratch, tmp);
 			return rawbuf;
 		}
-		else /* append all raw */
-		{
-			if (read > 0)
-			{
-				if (utf_ensure_capacity((void **)&rawbuf, &cap, len + read + 1, sizeof(UTF_UC16)) != 0)
-				{
-					free(tmp);
-					free(rawbuf);
-					return NULL;
-				}
-				memcpy(rawbuf + len, tmp, read * sizeof(UTF_UC16));
-				len += read;
-			}
-		}
 	}
 
-	free(tmp);
+	utf_release(scratch, tmp);
 	if (!got_any)
 	{
-		free(rawbuf);
+		utf_release(out, rawbuf);
 		return NULL;
 	}
 
 	/* terminate raw and convert */
-	if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC16)) != 0)
+	if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC16)) != 0)
 	{
-		free(rawbuf);
+		utf_release(out, rawbuf);
 		return NULL;
 	}
 	rawbuf[len] = 0;
@@ -309,9 +339,29 @@ UTF16XE_getline(FILE *fp)
 	return rawbuf;
 }
 
+static inline UTF_UC16 *
+UTF16XE_getline(FILE *fp)
+{
+	UTF_UC16 *ret;
+	UTF_TRACE_ENTER(UTF16XE_getline, 0);
+	ret = utf_utf16xe_getline(fp, NULL, NULL);
+	UTF_TRACE_EXIT(UTF16XE_getline, ret ? UTF_uj16_len(ret) : 0);
+	return ret;
+}
+
+static inline UTF_UC16 *
+UTF16XE_getline_ex(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
+{
+	UTF_UC16 *ret;
+	UTF_TRACE_ENTER(UTF16XE_getline, 0);
+	ret = utf_utf16xe_getline(fp, out, scratch);
+	UTF_TRACE_EXIT(UTF16XE_getline, ret ? UTF_uj16_len(ret) : 0);
+	return ret;
+}
+
 /* UTF-32 host-endian, chunked reader */
 static inline UTF_UC32 *
-UTF32_getline(FILE *fp)
+utf_utf32_getline(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
 {
 	if (!fp || feof(fp))
 		return NULL;
@@ -323,7 +373,7 @@ UTF32_getline(FILE *fp)
 
 	size_t chunk_elems = UTF_GETLINE_CHUNK_BYTES / sizeof(UTF_UC32);
 	if (chunk_elems == 0) chunk_elems = 1;
-	UTF_UC32 *tmp = (UTF_UC32 *)malloc(chunk_elems * sizeof(UTF_UC32));
+	UTF_UC32 *tmp = (UTF_UC32 *)utf_allocate(scratch, chunk_elems * sizeof(UTF_UC32));
 	if (!tmp) return NULL;
 
 	for (;;)
@@ -340,10 +390,10 @@ UTF32_getline(FILE *fp)
 
 		if (i > 0)
 		{
-			if (utf_ensure_capacity((void **)&result, &cap, len + i + 1, sizeof(UTF_UC32)) != 0)
+			if (utf_ensure_capacity(out, (void **)&result, &cap, len + i + 1, sizeof(UTF_UC32)) != 0)
 			{
-				free(tmp);
-				free(result);
+				utf_release(scratch, tmp);
+				utf_release(out, result);
 				return NULL;
 			}
 			memcpy(result + len, tmp, i * sizeof(UTF_UC32));
@@ -356,10 +406,10 @@ UTF32_getline(FILE *fp)
 				result[len - 1] = (UTF_UC32)'\n';
 			else
 			{
-				if (utf_ensure_capacity((void **)&result, &cap, len + 2, sizeof(UTF_UC32)) != 0)
+				if (utf_ensure_capacity(out, (void **)&result, &cap, len + 2, sizeof(UTF_UC32)) != 0)
 				{
-					free(tmp);
-					free(result);
+					utf_release(scratch, tmp);
+					utf_release(out, result);
 					return NULL;
 				}
 				result[len++] = (UTF_UC32)'\n';
@@ -372,50 +422,56 @@ UTF32_getline(FILE *fp)
 				if (fseek(fp, diff, SEEK_CUR) != 0) { }
 			}
 
-			if (utf_ensure_capacity((void **)&result, &cap, len + 1, sizeof(UTF_UC32)) != 0)
+			if (utf_ensure_capacity(out, (void **)&result, &cap, len + 1, sizeof(UTF_UC32)) != 0)
 			{
-				free(tmp);
-				free(result);
+				utf_release(scratch, tmp);
+				utf_release(out, result);
 				return NULL;
 			}
 			result[len] = 0;
-			free(tmp);
+			utf_release(scratch, tmp);
 			return result;
 		}
-		else /* append all */
-		{
-			if (read > 0)
-			{
-				if (utf_ensure_capacity((void **)&result, &cap, len + read + 1, sizeof(UTF_UC32)) != 0)
-				{
-					free(tmp);
-					free(result);
-					return NULL;
-				}
-				memcpy(result + len, tmp, read * sizeof(UTF_UC32));
-				len += read;
-			}
-		}
 	}
 
-	free(tmp);
+	utf_release(scratch, tmp);
 	if (!got_any)
 	{
-		free(result);
+		utf_release(out, result);
 		return NULL;
 	}
-	if (utf_ensure_capacity((void **)&result, &cap, len + 1, sizeof(UTF_UC32)) != 0)
+	if (utf_ensure_capacity(out, (void **)&result, &cap, len + 1, sizeof(UTF_UC32)) != 0)
 	{
-		free(result);
+		utf_release(out, result);
 		return NULL;
 	}
 	result[len] = 0;
 	return result;
 }
 
+static inline UTF_UC32 *
+UTF32_getline(FILE *fp)
+{
+	UTF_UC32 *ret;
+	UTF_TRACE_ENTER(UTF32_getline, 0);
+	ret = utf_utf32_getline(fp, NULL, NULL);
+	UTF_TRACE_EXIT(UTF32_getline, ret ? UTF_uj32_len(ret) : 0);
+	return ret;
+}
+
+static inline UTF_UC32 *
+UTF32_getline_ex(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
+{
+	UTF_UC32 *ret;
+	UTF_TRACE_ENTER(UTF32_getline, 0);
+	ret = utf_utf32_getline(fp, out, scratch);
+	UTF_TRACE_EXIT(UTF32_getline, ret ? UTF_uj32_len(ret) : 0);
+	return ret;
+}
+
 /* UTF-32 file-endian (raw/byte-swapped) */
 static inline UTF_UC32 *
-UTF32XE_getline(FILE *fp)
+utf_utf32xe_getline(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
 {
 	if (!fp || feof(fp))
 		return NULL;
@@ -427,7 +483,7 @@ UTF32XE_getline(FILE *fp)
 
 	size_t chunk_elems = UTF_GETLINE_CHUNK_BYTES / sizeof(UTF_UC32);
 	if (chunk_elems == 0) chunk_elems = 1;
-	UTF_UC32 *tmp = (UTF_UC32 *)malloc(chunk_elems * sizeof(UTF_UC32));
+	UTF_UC32 *tmp = (UTF_UC32 *)utf_allocate(scratch, chunk_elems * sizeof(UTF_UC32));
 	if (!tmp) return NULL;
 
 	for (;;)
@@ -444,10 +500,10 @@ UTF32XE_getline(FILE *fp)
 
 		if (i > 0)
 		{
-			if (utf_ensure_capacity((void **)&rawbuf, &cap, len + i + 1, sizeof(UTF_UC32)) != 0)
+			if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + i + 1, sizeof(UTF_UC32)) != 0)
 			{
-				free(tmp);
-				free(rawbuf);
+				utf_release(scratch, tmp);
+				utf_release(out, rawbuf);
 				return NULL;
 			}
 			memcpy(rawbuf + len, tmp, i * sizeof(UTF_UC32));
@@ -460,10 +516,10 @@ UTF32XE_getline(FILE *fp)
 				rawbuf[len - 1] = UTF32_XE('\n');
 			else
 			{
-				if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 2, sizeof(UTF_UC32)) != 0)
+				if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 2, sizeof(UTF_UC32)) != 0)
 				{
-					free(tmp);
-					free(rawbuf);
+					utf_release(scratch, tmp);
+					utf_release(out, rawbuf);
 					return NULL;
 				}
 				rawbuf[len++] = UTF32_XE('\n');
@@ -476,10 +532,10 @@ UTF32XE_getline(FILE *fp)
 				if (fseek(fp, diff, SEEK_CUR) != 0) { }
 			}
 
-			if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC32)) != 0)
+			if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC32)) != 0)
 			{
-				free(tmp);
-				free(rawbuf);
+				utf_release(scratch, tmp);
+				utf_release(out, rawbuf);
 				return NULL;
 			}
 			rawbuf[len] = 0;
@@ -491,35 +547,21 @@ UTF32XE_getline(FILE *fp)
 					rawbuf[j] = UTF32_XE(rawbuf[j]);
 			}
 
-			free(tmp);
+			utf_release(scratch, tmp);
 			return rawbuf;
 		}
-		else /* append all */
-		{
-			if (read > 0)
-			{
-				if (utf_ensure_capacity((void **)&rawbuf, &cap, len + read + 1, sizeof(UTF_UC32)) != 0)
-				{
-					free(tmp);
-					free(rawbuf);
-					return NULL;
-				}
-				memcpy(rawbuf + len, tmp, read * sizeof(UTF_UC32));
-				len += read;
-			}
-		}
 	}
 
-	free(tmp);
+	utf_release(scratch, tmp);
 	if (!got_any)
 	{
-		free(rawbuf);
+		utf_release(out, rawbuf);
 		return NULL;
 	}
 
-	if (utf_ensure_capacity((void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC32)) != 0)
+	if (utf_ensure_capacity(out, (void **)&rawbuf, &cap, len + 1, sizeof(UTF_UC32)) != 0)
 	{
-		free(rawbuf);
+		utf_release(out, rawbuf);
 		return NULL;
 	}
 	rawbuf[len] = 0;
@@ -531,4 +573,24 @@ UTF32XE_getline(FILE *fp)
 	return rawbuf;
 }
 
+static inline UTF_UC32 *
+UTF32XE_getline(FILE *fp)
+{
+	UTF_UC32 *ret;
+	UTF_TRACE_ENTER(UTF32XE_getline, 0);
+	ret = utf_utf32xe_getline(fp, NULL, NULL);
+	UTF_TRACE_EXIT(UTF32XE_getline, ret ? UTF_uj32_len(ret) : 0);
+	return ret;
+}
+
+static inline UTF_UC32 *
+UTF32XE_getline_ex(FILE *fp, const UTF_ALLOCATOR *out, const UTF_ALLOCATOR *scratch)
+{
+	UTF_UC32 *ret;
+	UTF_TRACE_ENTER(UTF32XE_getline, 0);
+	ret = utf_utf32xe_getline(fp, out, scratch);
+	UTF_TRACE_EXIT(UTF32XE_getline, ret ? UTF_uj32_len(ret) : 0);
+	return ret;
+}
+
 #endif /* UTF_GETLINE_H_ */
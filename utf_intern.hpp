@@ -0,0 +1,295 @@
+/* utf_intern.hpp --- a shared cache of converted strings */
+
+#ifndef UTF_INTERN_HPP_
+#define UTF_INTERN_HPP_
+
+#pragma once
+
+#include "utf.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// UTF_INTERN_STATS --- the counters of a UTF_intern_cache, for sizing it
+struct UTF_INTERN_STATS
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t entries;   // cached now
+	size_t bytes;     // charged against max_bytes
+};
+
+// UTF_intern_cache<t_dst> --- converts UTF-8 to t_dst (UTF_ENC_16 or
+// UTF_ENC_32) through a cache keyed by the UTF-8 bytes, for programs that
+// convert the same field names and tags over and over:
+//
+//     static UTF_intern_cache<UTF_ENC_16> s_names(1 << 20);
+//     UTF_intern_cache<UTF_ENC_16>::view name = s_names.get(s8);
+//     legacy_call(name.data(), name.size());
+//
+// A hit costs a hash of the bytes, a probe of one shard and a comparison.
+// The cache is split into shards, each with its own lock, which is held only
+// for the probe and the bookkeeping: conversions run outside it, and the
+// counters are relaxed atomics. Each shard keeps its part of max_bytes (the
+// keys, the results and the bookkeeping of each entry) and evicts by CLOCK: a hit
+// marks an entry, and the hand sweeping for room spares marked entries once.
+//
+// A view holds its entry, so data() stays valid as long as the view or a
+// copy of it exists, even after the entry is evicted or the cache cleared.
+// Strings bigger than a shard are converted but not cached.
+template <UTF_ENC t_dst, char t_default_char UTF_OPT_(UTF_DEFAULT_CHAR)>
+class UTF_intern_cache
+{
+	struct entry;
+
+public:
+	typedef typename UTF_enc_unit<t_dst>::type unit_type;
+	typedef std::basic_string<unit_type> string_type;
+
+	class view
+	{
+	public:
+		view()
+		{
+		}
+
+		// the converted units, NUL-terminated; NULL for an empty view
+		const unit_type *data() const
+		{
+			return m_entry ? m_entry->value.c_str() : NULL;
+		}
+		size_t size() const
+		{
+			return m_entry ? m_entry->value.size() : 0;
+		}
+		bool empty() const
+		{
+			return size() == 0;
+		}
+		// what the converter returned: false if the UTF-8 was ill-formed and
+		// t_default_char is 0
+		bool ok() const
+		{
+			return m_entry && m_entry->ok;
+		}
+		const string_type& str() const
+		{
+			return m_entry->value;
+		}
+
+	private:
+		friend class UTF_intern_cache;
+		std::shared_ptr<const entry> m_entry;
+
+		explicit view(const std::shared_ptr<const entry>& e) : m_entry(e)
+		{
+		}
+	};
+
+	// shards is rounded up to a power of two
+	explicit UTF_intern_cache(size_t max_bytes = 16 << 20, size_t shards = 16)
+		: m_shard_bits(0), m_hits(0), m_misses(0), m_evictions(0)
+	{
+		while ((size_t(1) << m_shard_bits) < shards && m_shard_bits < 16)
+			++m_shard_bits;
+		m_shards.reset(new shard[size_t(1) << m_shard_bits]);
+		m_shard_bytes = max_bytes >> m_shard_bits;
+	}
+
+	view get(const char *s8, size_t size)
+	{
+		const UTF_UC8 *key = reinterpret_cast<const UTF_UC8 *>(s8);
+		uint64_t hash = hash_bytes(key, size);
+		shard& sh = m_shards[(m_shard_bits == 0) ? 0 : size_t(hash >> (64 - m_shard_bits))];
+		{
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			const std::shared_ptr<entry> *found = sh.find(hash, key, size);
+			if (found)
+			{
+				(*found)->referenced = true;
+				m_hits.fetch_add(1, std::memory_order_relaxed);
+				return view(*found);
+			}
+		}
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+
+		std::shared_ptr<entry> fresh = std::make_shared<entry>();
+		fresh->hash = hash;
+		fresh->key.assign(s8, size);
+		fresh->ok = UTF_transcode_append<UTF_ENC_8, t_dst, t_default_char>(key, size, fresh->value);
+		fresh->referenced = false;
+		fresh->cost = sizeof(entry) + 32 + size + fresh->value.size() * sizeof(unit_type);
+		if (fresh->cost > m_shard_bytes)
+			return view(fresh);
+
+		std::lock_guard<std::mutex> lock(sh.mutex);
+		const std::shared_ptr<entry> *found = sh.find(hash, key, size);
+		if (found)
+			return view(*found);   // another thread was first
+		m_evictions.fetch_add(sh.make_room(m_shard_bytes - fresh->cost), std::memory_order_relaxed);
+		sh.insert(fresh);
+		return view(fresh);
+	}
+	view get(const UTF_S8& s8)
+	{
+		return get(s8.data(), s8.size());
+	}
+
+	UTF_INTERN_STATS statistics() const
+	{
+		UTF_INTERN_STATS result;
+		result.hits = m_hits.load(std::memory_order_relaxed);
+		result.misses = m_misses.load(std::memory_order_relaxed);
+		result.evictions = m_evictions.load(std::memory_order_relaxed);
+		result.entries = result.bytes = 0;
+		for (size_t i = 0; i < (size_t(1) << m_shard_bits); ++i)
+		{
+			std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+			result.entries += m_shards[i].index.size();
+			result.bytes += m_shards[i].bytes;
+		}
+		return result;
+	}
+
+	// drops every entry; views keep theirs
+	void clear()
+	{
+		for (size_t i = 0; i < (size_t(1) << m_shard_bits); ++i)
+		{
+			std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+			m_shards[i].clear();
+		}
+	}
+
+private:
+	struct entry
+	{
+		uint64_t hash;
+		UTF_S8 key;
+		string_type value;
+		bool ok;
+		bool referenced;   // hit since the hand last passed; under the shard lock
+		size_t cost;
+		size_t slot;       // in shard::ring
+	};
+
+	struct shard
+	{
+		mutable std::mutex mutex;
+		std::unordered_multimap<uint64_t, std::shared_ptr<entry> > index;
+		std::vector<std::shared_ptr<entry> > ring;   // the CLOCK; NULL where evicted
+		std::vector<size_t> free_slots;
+		size_t hand;
+		size_t bytes;
+
+		shard() : hand(0), bytes(0)
+		{
+		}
+
+		const std::shared_ptr<entry> *find(uint64_t hash, const UTF_UC8 *key, size_t size) const
+		{
+			typedef typename std::unordered_multimap<uint64_t, std::shared_ptr<entry> >::const_iterator iterator;
+			std::pair<iterator, iterator> range = index.equal_range(hash);
+			for (iterator it = range.first; it != range.second; ++it)
+			{
+				const UTF_S8& k = it->second->key;
+				if (k.size() == size && (size == 0 || std::memcmp(k.data(), key, size) == 0))
+					return &it->second;
+			}
+			return NULL;
+		}
+
+		// evicts until at most budget bytes are used; returns the evictions
+		uint64_t make_room(size_t budget)
+		{
+			uint64_t evicted = 0;
+			while (bytes > budget)
+			{
+				if (hand >= ring.size())
+					hand = 0;
+				std::shared_ptr<entry>& e = ring[hand++];
+				if (!e)
+					continue;
+				if (e->referenced)
+				{
+					e->referenced = false;
+					continue;
+				}
+				erase_index(e);
+				bytes -= e->cost;
+				free_slots.push_back(e->slot);
+				e.reset();
+				++evicted;
+			}
+			return evicted;
+		}
+
+		void insert(const std::shared_ptr<entry>& e)
+		{
+			if (free_slots.empty())
+			{
+				e->slot = ring.size();
+				ring.push_back(e);
+			}
+			else
+			{
+				e->slot = free_slots.back();
+				free_slots.pop_back();
+				ring[e->slot] = e;
+			}
+			index.insert(std::make_pair(e->hash, e));
+			bytes += e->cost;
+		}
+
+		void erase_index(const std::shared_ptr<entry>& e)
+		{
+			typedef typename std::unordered_multimap<uint64_t, std::shared_ptr<entry> >::iterator iterator;
+			std::pair<iterator, iterator> range = index.equal_range(e->hash);
+			for (iterator it = range.first; it != range.second; ++it)
+			{
+				if (it->second == e)
+				{
+					index.erase(it);
+					return;
+				}
+			}
+		}
+
+		void clear()
+		{
+			index.clear();
+			ring.clear();
+			free_slots.clear();
+			hand = bytes = 0;
+		}
+	};
+
+	std::unique_ptr<shard[]> m_shards;
+	int m_shard_bits;
+	size_t m_shard_bytes;
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+	std::atomic<uint64_t> m_evictions;
+
+	// the bytes eight at a time through the mixer of UTF_HASH; the top bits
+	// pick the shard and the whole value keys the index
+	static uint64_t hash_bytes(const UTF_UC8 *bytes, size_t size)
+	{
+		uint64_t lane = 0x243F6A8885A308D3ULL ^ size;
+		size_t i = 0;
+		for (; size - i >= 8; i += 8)
+			lane = UTF_hash_mix(lane, UTF_swar_load64(bytes + i));
+		if (i != size)
+		{
+			uint64_t tail = 0;
+			std::memcpy(&tail, bytes + i, size - i);
+			lane = UTF_hash_mix(lane, tail);
+		}
+		return UTF_hash_avalanche(lane);
+	}
+};
+
+#endif  /* ndef UTF_INTERN_HPP_ */
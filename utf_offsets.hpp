@@ -0,0 +1,235 @@
+/* utf_offsets.hpp --- positions in UTF-8 text as UTF-16 offsets and code points */
+
+#ifndef UTF_OFFSETS_HPP_
+#define UTF_OFFSETS_HPP_
+
+#pragma once
+
+#include "utf.hpp"
+#include <vector>
+
+// UTF_offset_index --- translates positions in a UTF-8 buffer between byte
+// offsets, UTF-16 unit offsets (as editor protocols and JavaScript count)
+// and code point indices:
+//
+//     UTF_offset_index index(text.data(), text.size());
+//     size_t character = index.u8_to_u16(byte) - index.u8_to_u16(line_start);
+//
+// The buffer is cut into blocks of about stride bytes whose code points and
+// UTF-16 units are counted with SIMD. A query finds its block by binary
+// search over the block starts and counts or scans less than two blocks,
+// which is O(log n) plus a short scan. After an edit, update() recounts only
+// the blocks that the edit touched.
+//
+// The index does not copy the text: the buffer passed to build() or update()
+// must stay alive and unchanged until the next call. Code points and units
+// are counted as UTF_uj8_count_cp does (bytes other than 10xxxxxx start a
+// code point; 11110xxx and above start two UTF-16 units). An offset inside
+// a sequence, or inside a surrogate pair, is taken as the start of that
+// code point, and offsets past the end as the end.
+class UTF_offset_index
+{
+public:
+	explicit UTF_offset_index(size_t stride = 1024)
+		: m_text(NULL), m_size(0), m_stride(stride < 16 ? 16 : stride)
+	{
+		build(NULL, 0);
+	}
+	UTF_offset_index(const char *s8, size_t size, size_t stride = 1024)
+		: m_text(NULL), m_size(0), m_stride(stride < 16 ? 16 : stride)
+	{
+		build(s8, size);
+	}
+
+	void build(const char *s8, size_t size)
+	{
+		m_text = reinterpret_cast<const UTF_UC8 *>(s8);
+		m_size = size;
+		m_blocks.clear();
+		m_starts.assign(1, position());
+		recount(0, 0, 0, size);
+	}
+
+	// s8 is the buffer after the bytes [pos, pos + removed) of the previous
+	// one were replaced by inserted bytes
+	void update(const char *s8, size_t size, size_t pos, size_t removed, size_t inserted)
+	{
+		if (pos > m_size || removed > m_size - pos || size != m_size - removed + inserted ||
+			m_blocks.empty())
+		{
+			build(s8, size);
+			return;
+		}
+
+		// the blocks holding the old [pos, pos + removed)
+		size_t first = find_block(&position::u8, pos), last = first + 1;
+		if (removed)
+			last = find_block(&position::u8, pos + removed - 1) + 1;
+		size_t from = m_starts[first].u8, to = m_starts[last].u8 - removed + inserted;
+		// keep blocks from shrinking edit after edit
+		if (to - from < m_stride)
+		{
+			if (last < m_blocks.size())
+				to += m_blocks[last++].bytes;
+			else if (first > 0)
+				from = m_starts[--first].u8;
+		}
+
+		m_text = reinterpret_cast<const UTF_UC8 *>(s8);
+		m_size = size;
+		recount(first, last, from, to);
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+	size_t size_u16() const
+	{
+		return m_starts.back().u16;
+	}
+	size_t size_cp() const
+	{
+		return m_starts.back().cp;
+	}
+
+	size_t u8_to_u16(size_t offset) const
+	{
+		return at_u8(offset).u16;
+	}
+	size_t u8_to_cp(size_t offset) const
+	{
+		return at_u8(offset).cp;
+	}
+	size_t u16_to_u8(size_t offset) const
+	{
+		return to_u8(&position::u16, offset);
+	}
+	size_t cp_to_u8(size_t index) const
+	{
+		return to_u8(&position::cp, index);
+	}
+	size_t u16_to_cp(size_t offset) const
+	{
+		return u8_to_cp(u16_to_u8(offset));
+	}
+	size_t cp_to_u16(size_t index) const
+	{
+		return u8_to_u16(cp_to_u8(index));
+	}
+
+private:
+	struct block
+	{
+		size_t bytes, cp, u16;
+	};
+	struct position
+	{
+		size_t u8, cp, u16;
+
+		position() : u8(0), cp(0), u16(0)
+		{
+		}
+	};
+
+	const UTF_UC8 *m_text;
+	size_t m_size;
+	size_t m_stride;
+	std::vector<block> m_blocks;
+	std::vector<position> m_starts;   // of each block, then of the end
+
+	// replaces the blocks [first, last) by new ones for the bytes [from, to)
+	void recount(size_t first, size_t last, size_t from, size_t to)
+	{
+		size_t length = to - from, count = length / m_stride;
+		if (!count && length)
+			count = 1;
+		std::vector<block> fresh(count);
+		for (size_t k = 0; k < count; ++k)
+		{
+			block& b = fresh[k];
+			b.bytes = length / count + (k < length % count);
+			b.cp = UTF_simd_count_lead8(m_text + from, b.bytes);
+			b.u16 = b.cp + UTF_simd_count_lead8_4(m_text + from, b.bytes);
+			from += b.bytes;
+		}
+		m_blocks.erase(m_blocks.begin() + first, m_blocks.begin() + last);
+		m_blocks.insert(m_blocks.begin() + first, fresh.begin(), fresh.end());
+
+		m_starts.resize(m_blocks.size() + 1);
+		for (size_t i = first; i < m_blocks.size(); ++i)
+		{
+			m_starts[i + 1].u8 = m_starts[i].u8 + m_blocks[i].bytes;
+			m_starts[i + 1].cp = m_starts[i].cp + m_blocks[i].cp;
+			m_starts[i + 1].u16 = m_starts[i].u16 + m_blocks[i].u16;
+		}
+	}
+
+	// the last block starting at or before value in field; there is one
+	size_t find_block(size_t position::*field, size_t value) const
+	{
+		size_t lo = 0, hi = m_blocks.size();
+		while (hi - lo > 1)
+		{
+			size_t mid = lo + (hi - lo) / 2;
+			if (m_starts[mid].*field <= value)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	position at_u8(size_t offset) const
+	{
+		if (offset >= m_size)
+			return m_starts.back();
+		// back to the start of the sequence, if there is one
+		size_t lead = offset;
+		for (int i = 0; i < 3 && lead > 0 && (m_text[lead] & 0xC0) == 0x80; ++i)
+			--lead;
+		if (m_text[lead] >= 0xC0)
+			offset = lead;
+
+		position pos = m_starts[find_block(&position::u8, offset)];
+		size_t cp = UTF_simd_count_lead8(m_text + pos.u8, offset - pos.u8);
+		pos.u16 += cp + UTF_simd_count_lead8_4(m_text + pos.u8, offset - pos.u8);
+		pos.cp += cp;
+		pos.u8 = offset;
+		return pos;
+	}
+
+	size_t to_u8(size_t position::*field, size_t target) const
+	{
+		if (target >= m_starts.back().*field)
+			return m_size;
+		const bool u16 = (field == &position::u16);
+		const position& start = m_starts[find_block(field, target)];
+		size_t p = start.u8, count = start.*field;
+
+		// skip 16 bytes while the next code point after them is not beyond
+		while (m_size - p >= 16)
+		{
+			size_t next = count + UTF_simd_count_lead8(m_text + p, 16);
+			if (u16)
+				next += UTF_simd_count_lead8_4(m_text + p, 16);
+			if (next > target)
+				break;
+			count = next;
+			p += 16;
+		}
+		for (; p < m_size; ++p)
+		{
+			UTF_UC8 byte = m_text[p];
+			if ((byte & 0xC0) == 0x80)
+				continue;
+			size_t width = (u16 && byte >= 0xF0) ? 2 : 1;
+			if (count + width > target)
+				return p;
+			count += width;
+		}
+		return m_size;
+	}
+};
+
+#endif  /* ndef UTF_OFFSETS_HPP_ */
@@ -0,0 +1,684 @@
+/* utf_simd.h --- vector primitives used by utf.h */
+
+#ifndef UTF_SIMD_H_
+#define UTF_SIMD_H_
+
+#pragma once
+
+#include "utf.h"
+
+/*
+ * UTF_SIMD_SSE2 or UTF_SIMD_NEON is defined when the compiler targets it;
+ * otherwise the functions work on 64-bit words (SWAR). Define UTF_NO_SIMD
+ * before including utf.h to force the portable code.
+ */
+#ifndef UTF_NO_SIMD
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define UTF_SIMD_SSE2
+		#include <emmintrin.h>
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+		#define UTF_SIMD_NEON
+		#include <arm_neon.h>
+	#endif
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+/* The NUL scan reads whole aligned 16-byte blocks around the string, which
+ * never crosses into another page but is out of bounds for AddressSanitizer. */
+#if defined(__SANITIZE_ADDRESS__)
+	#define UTF_SIMD_NO_ASAN __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer)
+		#define UTF_SIMD_NO_ASAN __attribute__((no_sanitize_address))
+	#endif
+#endif
+#ifndef UTF_SIMD_NO_ASAN
+	#define UTF_SIMD_NO_ASAN
+#endif
+
+/* an unaligned 64-bit load */
+static inline uint64_t
+UTF_swar_load64(const void *ptr)
+{
+	uint64_t word;
+	memcpy(&word, ptr, sizeof(word));
+	return word;
+}
+
+/* the number of bytes of word with the top bit set, if only top bits may be set */
+static inline UTF_SIZE_T
+UTF_swar_count80(uint64_t word)
+{
+	return UTF_STATIC_CAST(UTF_SIZE_T, ((word >> 7) * 0x0101010101010101ULL) >> 56);
+}
+
+/* the number of bytes in uj8[0 .. size) which are not trail bytes (10xxxxxx) */
+static inline UTF_SIZE_T
+UTF_simd_count_lead8(const UTF_UC8 *uj8, UTF_SIZE_T size)
+{
+	UTF_SIZE_T count = 0, i = 0;
+	uint64_t word;
+
+#if defined(UTF_SIMD_SSE2)
+	/* as signed bytes, the trail bytes are -128 .. -65 */
+	const __m128i limit = _mm_set1_epi8(-65);
+	__m128i acc;
+	UTF_SIZE_T k, blocks;
+	while (size - i >= 16)
+	{
+		/* up to 255 blocks before the byte counters overflow */
+		blocks = (size - i) / 16;
+		if (blocks > 255)
+			blocks = 255;
+		acc = _mm_setzero_si128();
+		for (k = 0; k < blocks; ++k, i += 16)
+		{
+			__m128i v = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, uj8 + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, limit));
+		}
+		acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+		count += UTF_STATIC_CAST(UTF_SIZE_T, _mm_cvtsi128_si32(acc));
+		count += UTF_STATIC_CAST(UTF_SIZE_T, _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+	}
+#elif defined(UTF_SIMD_NEON)
+	const int8x16_t limit = vdupq_n_s8(-65);
+	uint8x16_t acc;
+	uint64x2_t sum;
+	UTF_SIZE_T k, blocks;
+	while (size - i >= 16)
+	{
+		blocks = (size - i) / 16;
+		if (blocks > 255)
+			blocks = 255;
+		acc = vdupq_n_u8(0);
+		for (k = 0; k < blocks; ++k, i += 16)
+		{
+			int8x16_t v = vld1q_s8(UTF_REINTERPRET_CAST(const int8_t *, uj8 + i));
+			acc = vsubq_u8(acc, vcgtq_s8(v, limit));
+		}
+		sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+		count += UTF_STATIC_CAST(UTF_SIZE_T, vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+	}
+#endif
+
+	for (; size - i >= 8; i += 8)
+	{
+		/* a trail byte has bit 7 set and bit 6 clear */
+		word = UTF_swar_load64(uj8 + i);
+		count += 8 - UTF_swar_count80(word & ~(word << 1) & 0x8080808080808080ULL);
+	}
+	for (; i < size; ++i)
+	{
+		count += ((uj8[i] & 0xC0) != 0x80);
+	}
+	return count;
+}
+
+/* the number of bytes in uj8[0 .. size) which lead four-byte sequences
+ * (11110xxx or above), each of which is two UTF-16 units */
+static inline UTF_SIZE_T
+UTF_simd_count_lead8_4(const UTF_UC8 *uj8, UTF_SIZE_T size)
+{
+	UTF_SIZE_T count = 0, i = 0;
+	uint64_t word;
+
+#if defined(UTF_SIMD_SSE2)
+	const __m128i top = _mm_set1_epi8(UTF_STATIC_CAST(char, 0xF0));
+	__m128i acc;
+	UTF_SIZE_T k, blocks;
+	while (size - i >= 16)
+	{
+		blocks = (size - i) / 16;
+		if (blocks > 255)
+			blocks = 255;
+		acc = _mm_setzero_si128();
+		for (k = 0; k < blocks; ++k, i += 16)
+		{
+			__m128i v = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, uj8 + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_and_si128(v, top), top));
+		}
+		acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+		count += UTF_STATIC_CAST(UTF_SIZE_T, _mm_cvtsi128_si32(acc));
+		count += UTF_STATIC_CAST(UTF_SIZE_T, _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+	}
+#elif defined(UTF_SIMD_NEON)
+	const uint8x16_t top = vdupq_n_u8(0xF0);
+	uint8x16_t acc;
+	uint64x2_t sum;
+	UTF_SIZE_T k, blocks;
+	while (size - i >= 16)
+	{
+		blocks = (size - i) / 16;
+		if (blocks > 255)
+			blocks = 255;
+		acc = vdupq_n_u8(0);
+		for (k = 0; k < blocks; ++k, i += 16)
+		{
+			uint8x16_t v = vld1q_u8(uj8 + i);
+			acc = vsubq_u8(acc, vceqq_u8(vandq_u8(v, top), top));
+		}
+		sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+		count += UTF_STATIC_CAST(UTF_SIZE_T, vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+	}
+#endif
+
+	for (; size - i >= 8; i += 8)
+	{
+		/* the top four bits of the byte are set */
+		word = UTF_swar_load64(uj8 + i);
+		count += UTF_swar_count80(word & (word << 1) & (word << 2) & (word << 3) & 0x8080808080808080ULL);
+	}
+	for (; i < size; ++i)
+	{
+		count += (uj8[i] >= 0xF0);
+	}
+	return count;
+}
+
+/* the number of units in uj16[0 .. size) which are not low surrogates */
+static inline UTF_SIZE_T
+UTF_simd_count_lead16(const UTF_UC16 *uj16, UTF_SIZE_T size)
+{
+	UTF_SIZE_T count = size, i = 0;
+	uint64_t word;
+
+	if (sizeof(UTF_UC16) == 2)
+	{
+#if defined(UTF_SIMD_SSE2)
+		const __m128i mask = _mm_set1_epi16(UTF_STATIC_CAST(short, 0xFC00));
+		const __m128i low = _mm_set1_epi16(UTF_STATIC_CAST(short, 0xDC00));
+		__m128i acc;
+		UTF_SIZE_T k, blocks;
+		while (size - i >= 8)
+		{
+			/* the 16-bit counters stay positive for _mm_madd_epi16 */
+			blocks = (size - i) / 8;
+			if (blocks > 32767)
+				blocks = 32767;
+			acc = _mm_setzero_si128();
+			for (k = 0; k < blocks; ++k, i += 8)
+			{
+				__m128i v = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, uj16 + i));
+				acc = _mm_sub_epi16(acc, _mm_cmpeq_epi16(_mm_and_si128(v, mask), low));
+			}
+			acc = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+			count -= UTF_STATIC_CAST(UTF_SIZE_T, _mm_cvtsi128_si32(acc));
+		}
+#elif defined(UTF_SIMD_NEON)
+		const uint16x8_t mask = vdupq_n_u16(0xFC00);
+		const uint16x8_t low = vdupq_n_u16(0xDC00);
+		uint16x8_t acc;
+		uint64x2_t sum;
+		UTF_SIZE_T k, blocks;
+		while (size - i >= 8)
+		{
+			blocks = (size - i) / 8;
+			if (blocks > 65535)
+				blocks = 65535;
+			acc = vdupq_n_u16(0);
+			for (k = 0; k < blocks; ++k, i += 8)
+			{
+				uint16x8_t v = vld1q_u16(UTF_REINTERPRET_CAST(const uint16_t *, uj16 + i));
+				acc = vsubq_u16(acc, vceqq_u16(vandq_u16(v, mask), low));
+			}
+			sum = vpaddlq_u32(vpaddlq_u16(acc));
+			count -= UTF_STATIC_CAST(UTF_SIZE_T, vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+		}
+#endif
+
+		for (; size - i >= 4; i += 4)
+		{
+			/* a lane of word >> 10 is zero for a low surrogate; adding 0x7FFF
+			 * sets bit 15 of every other lane without carrying over */
+			word = UTF_swar_load64(uj16 + i);
+			word = ((word ^ 0xDC00DC00DC00DC00ULL) & 0xFC00FC00FC00FC00ULL) >> 10;
+			word = (word + 0x7FFF7FFF7FFF7FFFULL) & 0x8000800080008000ULL;
+			count -= 4 - UTF_STATIC_CAST(UTF_SIZE_T, ((word >> 15) * 0x0001000100010001ULL) >> 48);
+		}
+	}
+
+	for (; i < size; ++i)
+	{
+		count -= ((uj16[i] & 0xFC00) == 0xDC00);
+	}
+	return count;
+}
+
+/* the number of trailing zero bits; value must not be zero */
+static inline int
+UTF_simd_ctz64(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(value);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return UTF_STATIC_CAST(int, index);
+#else
+	int count = 0;
+	while (!(value & 1))
+	{
+		value >>= 1;
+		++count;
+	}
+	return count;
+#endif
+}
+
+#if defined(UTF_SIMD_SSE2) || defined(UTF_SIMD_NEON)
+
+#if defined(UTF_SIMD_SSE2)
+	#define UTF_SIMD_MASK_BITS 1
+#else
+	#define UTF_SIMD_MASK_BITS 4
+#endif
+
+/* UTF_SIMD_MASK_BITS bits per byte of the aligned 16-byte block, set for the
+ * bytes of the zero units of unit_size (2 or 4) bytes */
+static inline UTF_SIMD_NO_ASAN uint64_t
+UTF_simd_nul_mask(const UTF_UC8 *block, UTF_SIZE_T unit_size)
+{
+#if defined(UTF_SIMD_SSE2)
+	__m128i v = _mm_load_si128(UTF_REINTERPRET_CAST(const __m128i *, block));
+	if (unit_size == 2)
+		v = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+	else
+		v = _mm_cmpeq_epi32(v, _mm_setzero_si128());
+	return UTF_STATIC_CAST(uint64_t, UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(v)));
+#else
+	uint8x16_t v = vld1q_u8(block);
+	if (unit_size == 2)
+		v = vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(v), vdupq_n_u16(0)));
+	else
+		v = vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(v), vdupq_n_u32(0)));
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+#endif
+}
+
+/* the number of units before the zero unit; str must be aligned to unit_size */
+static inline UTF_SIZE_T
+UTF_simd_len(const void *str, UTF_SIZE_T unit_size)
+{
+	uintptr_t addr = UTF_REINTERPRET_CAST(uintptr_t, str);
+	const UTF_UC8 *block = UTF_REINTERPRET_CAST(const UTF_UC8 *, addr & ~UTF_STATIC_CAST(uintptr_t, 15));
+	uint64_t mask = UTF_simd_nul_mask(block, unit_size);
+	mask &= ~UTF_STATIC_CAST(uint64_t, 0) << ((addr & 15) * UTF_SIMD_MASK_BITS);
+	while (!mask)
+	{
+		block += 16;
+		mask = UTF_simd_nul_mask(block, unit_size);
+	}
+	addr = UTF_REINTERPRET_CAST(uintptr_t, block) + UTF_simd_ctz64(mask) / UTF_SIMD_MASK_BITS - addr;
+	return UTF_STATIC_CAST(UTF_SIZE_T, addr / unit_size);
+}
+
+#endif  /* SSE2 or NEON */
+
+/* unit_size bytes at ptr as an integer */
+static inline uint32_t
+UTF_simd_unit(const UTF_UC8 *ptr, UTF_SIZE_T unit_size)
+{
+	uint16_t u16;
+	uint32_t u32;
+	if (unit_size == 1)
+		return *ptr;
+	if (unit_size == 2)
+	{
+		memcpy(&u16, ptr, sizeof(u16));
+		return u16;
+	}
+	memcpy(&u32, ptr, sizeof(u32));
+	return u32;
+}
+
+#if defined(UTF_SIMD_SSE2) || defined(UTF_SIMD_NEON)
+
+/* whether 16 bytes from ptr lie in one page */
+static inline bool
+UTF_simd_page_safe(const UTF_UC8 *ptr)
+{
+	return (UTF_REINTERPRET_CAST(uintptr_t, ptr) & 4095) <= 4096 - 16;
+}
+
+/* UTF_SIMD_MASK_BITS bits per byte of 16 bytes, set for the bytes of the
+ * units in which a and b differ or a is zero */
+static inline UTF_SIMD_NO_ASAN uint64_t
+UTF_simd_mismatch_mask(const UTF_UC8 *a, const UTF_UC8 *b, UTF_SIZE_T unit_size)
+{
+#if defined(UTF_SIMD_SSE2)
+	__m128i va = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, a));
+	__m128i vb = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, b));
+	__m128i eq, nul;
+	if (unit_size == 1)
+	{
+		eq = _mm_cmpeq_epi8(va, vb);
+		nul = _mm_cmpeq_epi8(va, _mm_setzero_si128());
+	}
+	else if (unit_size == 2)
+	{
+		eq = _mm_cmpeq_epi16(va, vb);
+		nul = _mm_cmpeq_epi16(va, _mm_setzero_si128());
+	}
+	else
+	{
+		eq = _mm_cmpeq_epi32(va, vb);
+		nul = _mm_cmpeq_epi32(va, _mm_setzero_si128());
+	}
+	return UTF_STATIC_CAST(uint64_t, UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(_mm_andnot_si128(nul, eq))) ^ 0xFFFF);
+#else
+	uint8x16_t va = vld1q_u8(a), vb = vld1q_u8(b), eq, nul;
+	if (unit_size == 1)
+	{
+		eq = vceqq_u8(va, vb);
+		nul = vceqq_u8(va, vdupq_n_u8(0));
+	}
+	else if (unit_size == 2)
+	{
+		eq = vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(va), vreinterpretq_u16_u8(vb)));
+		nul = vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(va), vdupq_n_u16(0)));
+	}
+	else
+	{
+		eq = vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(va), vreinterpretq_u32_u8(vb)));
+		nul = vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(va), vdupq_n_u32(0)));
+	}
+	eq = vbicq_u8(eq, nul);
+	return ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+#endif
+}
+
+#endif  /* SSE2 or NEON */
+
+/* The index of the first unit below limit at which the strings a and b of
+ * unit_size (1, 2 or 4) bytes differ or a has a zero, or limit. Reads past
+ * the zero stay in its page. */
+static inline UTF_SIZE_T
+UTF_simd_mismatch(const void *a, const void *b, UTF_SIZE_T unit_size, UTF_SIZE_T limit)
+{
+	const UTF_UC8 *pa = UTF_STATIC_CAST(const UTF_UC8 *, a);
+	const UTF_UC8 *pb = UTF_STATIC_CAST(const UTF_UC8 *, b);
+	UTF_SIZE_T i = 0;
+	uint32_t ua;
+#if defined(UTF_SIMD_SSE2) || defined(UTF_SIMD_NEON)
+	const UTF_SIZE_T step = 16 / unit_size;
+	uint64_t mask;
+	while (limit - i >= step)
+	{
+		if (UTF_simd_page_safe(pa) && UTF_simd_page_safe(pb))
+		{
+			mask = UTF_simd_mismatch_mask(pa, pb, unit_size);
+			if (mask)
+				return i + UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask)) / UTF_SIMD_MASK_BITS / unit_size;
+			i += step;
+			pa += 16;
+			pb += 16;
+			continue;
+		}
+		/* a unit at a time up to the page end */
+		ua = UTF_simd_unit(pa, unit_size);
+		if (!ua || ua != UTF_simd_unit(pb, unit_size))
+			return i;
+		++i;
+		pa += unit_size;
+		pb += unit_size;
+	}
+#endif
+	for (; i < limit; ++i, pa += unit_size, pb += unit_size)
+	{
+		ua = UTF_simd_unit(pa, unit_size);
+		if (!ua || ua != UTF_simd_unit(pb, unit_size))
+			return i;
+	}
+	return limit;
+}
+
+/* the index of the first byte below size at which a and b differ, or size */
+static inline UTF_SIZE_T
+UTF_simd_mismatch_bytes(const void *a, const void *b, UTF_SIZE_T size)
+{
+	const UTF_UC8 *pa = UTF_STATIC_CAST(const UTF_UC8 *, a);
+	const UTF_UC8 *pb = UTF_STATIC_CAST(const UTF_UC8 *, b);
+	UTF_SIZE_T i = 0;
+#if defined(UTF_SIMD_SSE2)
+	unsigned mask;
+	for (; size - i >= 16; i += 16)
+	{
+		__m128i va = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, pa + i));
+		__m128i vb = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, pb + i));
+		mask = UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))) ^ 0xFFFF;
+		if (mask)
+			return i + UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask));
+	}
+#elif defined(UTF_SIMD_NEON)
+	uint64_t mask;
+	for (; size - i >= 16; i += 16)
+	{
+		uint8x16_t eq = vceqq_u8(vld1q_u8(pa + i), vld1q_u8(pb + i));
+		mask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (mask)
+			return i + UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask)) / 4;
+	}
+#endif
+	for (; size - i >= 8; i += 8)
+	{
+		if (UTF_swar_load64(pa + i) != UTF_swar_load64(pb + i))
+			break;
+	}
+	for (; i < size; ++i)
+	{
+		if (pa[i] != pb[i])
+			break;
+	}
+	return i;
+}
+
+/* The number (up to 16, or 8 for UTF_simd_same_16_32) of leading units of
+ * a and b that are the same code point and for which that is obvious: ASCII
+ * for UTF-8, anything but a surrogate for UTF-16. Reads a whole window. */
+static inline UTF_SIZE_T
+UTF_simd_same_8_16(const UTF_UC8 *a, const UTF_UC16 *b)
+{
+	UTF_SIZE_T i;
+	if (sizeof(UTF_UC16) == 2)
+	{
+#if defined(UTF_SIMD_SSE2)
+		__m128i va = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, a));
+		__m128i vb0 = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, b));
+		__m128i vb1 = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, b + 8));
+		__m128i e0 = _mm_cmpeq_epi16(_mm_unpacklo_epi8(va, _mm_setzero_si128()), vb0);
+		__m128i e1 = _mm_cmpeq_epi16(_mm_unpackhi_epi8(va, _mm_setzero_si128()), vb1);
+		unsigned good = UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(_mm_packs_epi16(e0, e1)));
+		good &= ~UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(va)) & 0xFFFF;
+		return (good == 0xFFFF) ? 16 : UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(~good));
+#elif defined(UTF_SIMD_NEON)
+		uint8x16_t va = vld1q_u8(a), good;
+		uint16x8_t e0 = vceqq_u16(vmovl_u8(vget_low_u8(va)), vld1q_u16(UTF_REINTERPRET_CAST(const uint16_t *, b)));
+		uint16x8_t e1 = vceqq_u16(vmovl_u8(vget_high_u8(va)), vld1q_u16(UTF_REINTERPRET_CAST(const uint16_t *, b + 8)));
+		uint64_t mask;
+		good = vandq_u8(vcombine_u8(vmovn_u16(e0), vmovn_u16(e1)), vcltq_u8(va, vdupq_n_u8(0x80)));
+		mask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(good), 4)), 0);
+		return mask ? UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask)) / 4 : 16;
+#endif
+	}
+	for (i = 0; i < 16 && a[i] < 0x80 && a[i] == b[i]; ++i)
+	{
+	}
+	return i;
+}
+
+static inline UTF_SIZE_T
+UTF_simd_same_8_32(const UTF_UC8 *a, const UTF_UC32 *b)
+{
+#if defined(UTF_SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i *pb = UTF_REINTERPRET_CAST(const __m128i *, b);
+	__m128i va = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, a));
+	__m128i lo = _mm_unpacklo_epi8(va, zero), hi = _mm_unpackhi_epi8(va, zero);
+	__m128i e0 = _mm_cmpeq_epi32(_mm_unpacklo_epi16(lo, zero), _mm_loadu_si128(pb));
+	__m128i e1 = _mm_cmpeq_epi32(_mm_unpackhi_epi16(lo, zero), _mm_loadu_si128(pb + 1));
+	__m128i e2 = _mm_cmpeq_epi32(_mm_unpacklo_epi16(hi, zero), _mm_loadu_si128(pb + 2));
+	__m128i e3 = _mm_cmpeq_epi32(_mm_unpackhi_epi16(hi, zero), _mm_loadu_si128(pb + 3));
+	__m128i eq = _mm_packs_epi16(_mm_packs_epi32(e0, e1), _mm_packs_epi32(e2, e3));
+	unsigned good = UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(eq));
+	good &= ~UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(va)) & 0xFFFF;
+	return (good == 0xFFFF) ? 16 : UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(~good));
+#elif defined(UTF_SIMD_NEON)
+	const uint32_t *pb = UTF_REINTERPRET_CAST(const uint32_t *, b);
+	uint8x16_t va = vld1q_u8(a), good;
+	uint16x8_t lo = vmovl_u8(vget_low_u8(va)), hi = vmovl_u8(vget_high_u8(va));
+	uint32x4_t e0 = vceqq_u32(vmovl_u16(vget_low_u16(lo)), vld1q_u32(pb));
+	uint32x4_t e1 = vceqq_u32(vmovl_u16(vget_high_u16(lo)), vld1q_u32(pb + 4));
+	uint32x4_t e2 = vceqq_u32(vmovl_u16(vget_low_u16(hi)), vld1q_u32(pb + 8));
+	uint32x4_t e3 = vceqq_u32(vmovl_u16(vget_high_u16(hi)), vld1q_u32(pb + 12));
+	uint64_t mask;
+	good = vcombine_u8(vmovn_u16(vcombine_u16(vmovn_u32(e0), vmovn_u32(e1))),
+					   vmovn_u16(vcombine_u16(vmovn_u32(e2), vmovn_u32(e3))));
+	good = vandq_u8(good, vcltq_u8(va, vdupq_n_u8(0x80)));
+	mask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(good), 4)), 0);
+	return mask ? UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask)) / 4 : 16;
+#else
+	UTF_SIZE_T i;
+	for (i = 0; i < 16 && a[i] < 0x80 && a[i] == b[i]; ++i)
+	{
+	}
+	return i;
+#endif
+}
+
+static inline UTF_SIZE_T
+UTF_simd_same_16_32(const UTF_UC16 *a, const UTF_UC32 *b)
+{
+	UTF_SIZE_T i;
+	if (sizeof(UTF_UC16) == 2)
+	{
+#if defined(UTF_SIMD_SSE2)
+		const __m128i *pb = UTF_REINTERPRET_CAST(const __m128i *, b);
+		__m128i va = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, a));
+		__m128i e0 = _mm_cmpeq_epi32(_mm_unpacklo_epi16(va, _mm_setzero_si128()), _mm_loadu_si128(pb));
+		__m128i e1 = _mm_cmpeq_epi32(_mm_unpackhi_epi16(va, _mm_setzero_si128()), _mm_loadu_si128(pb + 1));
+		__m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(va, _mm_set1_epi16(UTF_STATIC_CAST(short, 0xF800))),
+											_mm_set1_epi16(UTF_STATIC_CAST(short, 0xD800)));
+		unsigned good = UTF_STATIC_CAST(unsigned, _mm_movemask_epi8(_mm_andnot_si128(surrogate, _mm_packs_epi32(e0, e1))));
+		return (good == 0xFFFF) ? 8 : UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(~good)) / 2;
+#elif defined(UTF_SIMD_NEON)
+		const uint32_t *pb = UTF_REINTERPRET_CAST(const uint32_t *, b);
+		uint16x8_t va = vld1q_u16(UTF_REINTERPRET_CAST(const uint16_t *, a));
+		uint32x4_t e0 = vceqq_u32(vmovl_u16(vget_low_u16(va)), vld1q_u32(pb));
+		uint32x4_t e1 = vceqq_u32(vmovl_u16(vget_high_u16(va)), vld1q_u32(pb + 4));
+		uint16x8_t surrogate = vceqq_u16(vandq_u16(va, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800));
+		uint16x8_t good = vbicq_u16(vcombine_u16(vmovn_u32(e0), vmovn_u32(e1)), surrogate);
+		uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(good)), 0);
+		return mask ? UTF_STATIC_CAST(UTF_SIZE_T, UTF_simd_ctz64(mask)) / 8 : 8;
+#endif
+	}
+	for (i = 0; i < 8 && (a[i] & 0xF800) != 0xD800 && a[i] == b[i]; ++i)
+	{
+	}
+	return i;
+}
+
+/* widens 16 ASCII bytes to out and returns true, or returns false */
+static inline bool
+UTF_simd_widen_ascii(const UTF_UC8 *uj8, uint32_t out[16])
+{
+	int i;
+#if defined(UTF_SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, uj8)), lo, hi;
+	__m128i *pout = UTF_REINTERPRET_CAST(__m128i *, out);
+	if (_mm_movemask_epi8(v))
+		return false;
+	lo = _mm_unpacklo_epi8(v, zero);
+	hi = _mm_unpackhi_epi8(v, zero);
+	_mm_storeu_si128(pout, _mm_unpacklo_epi16(lo, zero));
+	_mm_storeu_si128(pout + 1, _mm_unpackhi_epi16(lo, zero));
+	_mm_storeu_si128(pout + 2, _mm_unpacklo_epi16(hi, zero));
+	_mm_storeu_si128(pout + 3, _mm_unpackhi_epi16(hi, zero));
+	(void)i;
+	return true;
+#else
+	uint64_t word = UTF_swar_load64(uj8) | UTF_swar_load64(uj8 + 8);
+	if (word & 0x8080808080808080ULL)
+		return false;
+	for (i = 0; i < 16; ++i)
+		out[i] = uj8[i];
+	return true;
+#endif
+}
+
+/* widens 8 UTF-16 units without surrogates to out and returns true, or
+ * returns false */
+static inline bool
+UTF_simd_widen_bmp(const UTF_UC16 *uj16, uint32_t out[8])
+{
+	int i;
+#if defined(UTF_SIMD_SSE2)
+	if (sizeof(UTF_UC16) == 2)
+	{
+		__m128i v = _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, uj16));
+		__m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(UTF_STATIC_CAST(short, 0xF800))),
+											_mm_set1_epi16(UTF_STATIC_CAST(short, 0xD800)));
+		__m128i *pout = UTF_REINTERPRET_CAST(__m128i *, out);
+		if (_mm_movemask_epi8(surrogate))
+			return false;
+		_mm_storeu_si128(pout, _mm_unpacklo_epi16(v, _mm_setzero_si128()));
+		_mm_storeu_si128(pout + 1, _mm_unpackhi_epi16(v, _mm_setzero_si128()));
+		return true;
+	}
+#endif
+	for (i = 0; i < 8; ++i)
+	{
+		if ((uj16[i] & 0xF800) == 0xD800)
+			return false;
+		out[i] = uj16[i];
+	}
+	return true;
+}
+
+/* the bitwise OR of the size units of unit_size (1, 2 or 4) bytes at units:
+ * every unit is below a power of two exactly when the result is */
+static inline UTF_UC32
+UTF_simd_or(const void *units, UTF_SIZE_T size, UTF_SIZE_T unit_size)
+{
+	const UTF_UC8 *ptr = UTF_STATIC_CAST(const UTF_UC8 *, units);
+	UTF_SIZE_T bytes = size * unit_size, i = 0;
+	uint64_t word = 0, tail = 0;
+
+#if defined(UTF_SIMD_SSE2)
+	uint64_t lanes[2];
+	__m128i acc = _mm_setzero_si128();
+	for (; bytes - i >= 16; i += 16)
+		acc = _mm_or_si128(acc, _mm_loadu_si128(UTF_REINTERPRET_CAST(const __m128i *, ptr + i)));
+	_mm_storeu_si128(UTF_REINTERPRET_CAST(__m128i *, lanes), acc);
+	word = lanes[0] | lanes[1];
+#elif defined(UTF_SIMD_NEON)
+	uint8x16_t acc = vdupq_n_u8(0);
+	for (; bytes - i >= 16; i += 16)
+		acc = vorrq_u8(acc, vld1q_u8(ptr + i));
+	word = vgetq_lane_u64(vreinterpretq_u64_u8(acc), 0) | vgetq_lane_u64(vreinterpretq_u64_u8(acc), 1);
+#endif
+
+	for (; bytes - i >= 8; i += 8)
+		word |= UTF_swar_load64(ptr + i);
+	/* the rest are whole units; copied to the start of a word they keep
+	 * their lanes in either byte order */
+	if (i != bytes)
+	{
+		memcpy(&tail, ptr + i, bytes - i);
+		word |= tail;
+	}
+
+	word |= word >> 32;
+	if (unit_size < 4)
+		word |= word >> 16;
+	if (unit_size < 2)
+		word |= word >> 8;
+	return UTF_STATIC_CAST(UTF_UC32, word & (~UTF_STATIC_CAST(uint64_t, 0) >> (64 - 8 * unit_size)));
+}
+
+#endif  /* ndef UTF_SIMD_H_ */
@@ -0,0 +1,276 @@
+/* utf_trace.h --- optional instrumentation of the converters and readers */
+
+#ifndef UTF_TRACE_H_
+#define UTF_TRACE_H_
+
+#pragma once
+
+#include "utf.h"
+
+/*
+ * Everything here is off by default and then costs nothing. Define before
+ * including utf.h:
+ *
+ *   UTF_TRACE_USDT       Linux USDT probes "utf:<name>_entry(size)" and
+ *                        "utf:<name>_return(size)" (needs <sys/sdt.h>).
+ *   UTF_TRACE_HISTOGRAM  latency histograms keyed by function and input size.
+ *                        Define UTF_TRACE_DEFINE_HISTOGRAM as well in exactly
+ *                        one source file to define their storage.
+ *   UTF_TRACE_HOOK_ENTER(id, size), UTF_TRACE_HOOK_EXIT(id, size)
+ *                        your own hooks; id is a UTF_TRACE_ID.
+ *
+ * The size is the source length in units for the converters and the line
+ * length in units for the *_getline readers.
+ */
+
+typedef enum UTF_TRACE_ID
+{
+	UTF_TRACE_ID_uj8_to_uj16,
+	UTF_TRACE_ID_uj8_to_uj32,
+	UTF_TRACE_ID_uj16_to_uj8,
+	UTF_TRACE_ID_uj16_to_uj32,
+	UTF_TRACE_ID_uj32_to_uj8,
+	UTF_TRACE_ID_uj32_to_uj16,
+	UTF_TRACE_ID_UTF16_getline,
+	UTF_TRACE_ID_UTF16XE_getline,
+	UTF_TRACE_ID_UTF32_getline,
+	UTF_TRACE_ID_UTF32XE_getline,
+	UTF_TRACE_ID_COUNT
+} UTF_TRACE_ID;
+
+static inline const char *
+UTF_trace_name(int id)
+{
+	static const char *const s_names[UTF_TRACE_ID_COUNT] =
+	{
+		"UTF_uj8_to_uj16", "UTF_uj8_to_uj32", "UTF_uj16_to_uj8",
+		"UTF_uj16_to_uj32", "UTF_uj32_to_uj8", "UTF_uj32_to_uj16",
+		"UTF16_getline", "UTF16XE_getline", "UTF32_getline", "UTF32XE_getline"
+	};
+	return (0 <= id && id < UTF_TRACE_ID_COUNT) ? s_names[id] : NULL;
+}
+
+/* USDT probes */
+#ifdef UTF_TRACE_USDT
+	#include <sys/sdt.h>
+	#define UTF_TRACE_USDT_ENTER_(name, size) DTRACE_PROBE1(utf, name##_entry, size);
+	#define UTF_TRACE_USDT_EXIT_(name, size) DTRACE_PROBE1(utf, name##_return, size);
+#else
+	#define UTF_TRACE_USDT_ENTER_(name, size)
+	#define UTF_TRACE_USDT_EXIT_(name, size)
+#endif
+
+/* user hooks */
+#ifdef UTF_TRACE_HOOK_ENTER
+	#define UTF_TRACE_HOOK_ENTER_(name, size) UTF_TRACE_HOOK_ENTER(UTF_TRACE_ID_##name, size);
+#else
+	#define UTF_TRACE_HOOK_ENTER_(name, size)
+#endif
+#ifdef UTF_TRACE_HOOK_EXIT
+	#define UTF_TRACE_HOOK_EXIT_(name, size) UTF_TRACE_HOOK_EXIT(UTF_TRACE_ID_##name, size);
+#else
+	#define UTF_TRACE_HOOK_EXIT_(name, size)
+#endif
+
+/* latency histograms */
+#ifdef UTF_TRACE_HISTOGRAM
+
+/* input sizes by powers of four: 0, 1-3, 4-15, ..., 4**14 and more */
+#define UTF_TRACE_SIZE_BUCKETS 16
+/* latencies in nanoseconds, HDR-style: 4 linear sub-buckets per power of two */
+#define UTF_TRACE_LATENCY_BUCKETS 160
+
+typedef struct UTF_TRACE_HIST
+{
+	uint64_t counts[UTF_TRACE_ID_COUNT][UTF_TRACE_SIZE_BUCKETS][UTF_TRACE_LATENCY_BUCKETS];
+} UTF_TRACE_HIST;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern UTF_TRACE_HIST UTF_trace_hist;
+#ifdef __cplusplus
+}
+#endif
+#ifdef UTF_TRACE_DEFINE_HISTOGRAM
+UTF_TRACE_HIST UTF_trace_hist;
+#endif
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+static inline uint64_t
+UTF_trace_now(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER s_freq;
+	LARGE_INTEGER count;
+	if (!s_freq.QuadPart)
+		QueryPerformanceFrequency(&s_freq);
+	QueryPerformanceCounter(&count);
+	return UTF_STATIC_CAST(uint64_t, count.QuadPart / s_freq.QuadPart * 1000000000 +
+								   count.QuadPart % s_freq.QuadPart * 1000000000 / s_freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return UTF_STATIC_CAST(uint64_t, ts.tv_sec) * 1000000000 + UTF_STATIC_CAST(uint64_t, ts.tv_nsec);
+#else
+	/* strict ISO C without POSIX: processor time only */
+	return UTF_STATIC_CAST(uint64_t, clock()) * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+/* index of the most significant bit; value must not be zero */
+static inline int
+UTF_trace_msb(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(value);
+#else
+	int msb = 0;
+	while (value >>= 1)
+		++msb;
+	return msb;
+#endif
+}
+
+static inline int
+UTF_trace_size_bucket(uint64_t size)
+{
+	int bucket;
+	if (!size)
+		return 0;
+	bucket = 1 + UTF_trace_msb(size) / 2;
+	return (bucket < UTF_TRACE_SIZE_BUCKETS) ? bucket : UTF_TRACE_SIZE_BUCKETS - 1;
+}
+
+static inline int
+UTF_trace_latency_bucket(uint64_t ns)
+{
+	int msb, bucket;
+	if (ns < 4)
+		return UTF_STATIC_CAST(int, ns);
+	msb = UTF_trace_msb(ns);
+	bucket = (msb - 1) * 4 + UTF_STATIC_CAST(int, (ns >> (msb - 2)) & 3);
+	return (bucket < UTF_TRACE_LATENCY_BUCKETS) ? bucket : UTF_TRACE_LATENCY_BUCKETS - 1;
+}
+
+/* the smallest latency in nanoseconds counted in the bucket */
+static inline uint64_t
+UTF_trace_latency_lower(int bucket)
+{
+	if (bucket < 4)
+		return UTF_STATIC_CAST(uint64_t, bucket);
+	return UTF_STATIC_CAST(uint64_t, 4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+/* The counters are updated atomically with the GCC builtins, the Interlocked
+ * functions of Windows (32-bit too) or C11 <stdatomic.h>. Elsewhere they are
+ * plain increments, and the histogram may only be used from one thread. */
+#if defined(__GNUC__) || defined(__clang__)
+	#define UTF_TRACE_ATOMIC_GNU
+#elif defined(_WIN32)
+	#define UTF_TRACE_ATOMIC_WIN32
+#elif !defined(__cplusplus) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+	  !defined(__STDC_NO_ATOMICS__)
+	#define UTF_TRACE_ATOMIC_C11
+	#include <stdatomic.h>
+#endif
+
+static inline void
+UTF_trace_record(int id, uint64_t size, uint64_t ns)
+{
+	uint64_t *count;
+	count = &UTF_trace_hist.counts[id][UTF_trace_size_bucket(size)][UTF_trace_latency_bucket(ns)];
+#if defined(UTF_TRACE_ATOMIC_GNU)
+	__atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+#elif defined(UTF_TRACE_ATOMIC_WIN32)
+	InterlockedIncrement64(UTF_REINTERPRET_CAST(volatile LONG64 *, count));
+#elif defined(UTF_TRACE_ATOMIC_C11)
+	/* the counters are not declared _Atomic so that C++ can share them */
+	atomic_fetch_add_explicit((_Atomic uint64_t *)count, 1, memory_order_relaxed);
+#else
+	++*count;
+#endif
+}
+
+static inline uint64_t
+UTF_trace_count(int id, int size_bucket, int latency_bucket)
+{
+	uint64_t *count = &UTF_trace_hist.counts[id][size_bucket][latency_bucket];
+#if defined(UTF_TRACE_ATOMIC_GNU)
+	return __atomic_load_n(count, __ATOMIC_RELAXED);
+#elif defined(UTF_TRACE_ATOMIC_WIN32)
+	/* a 64-bit read may tear on 32-bit Windows */
+	return UTF_STATIC_CAST(uint64_t, InterlockedCompareExchange64(UTF_REINTERPRET_CAST(volatile LONG64 *, count), 0, 0));
+#elif defined(UTF_TRACE_ATOMIC_C11)
+	return atomic_load_explicit((_Atomic uint64_t *)count, memory_order_relaxed);
+#else
+	return *count;
+#endif
+}
+
+/* The latency in nanoseconds below which the given fraction (0 to 1) of the
+ * calls finished, as the upper bound of a bucket. A negative size_bucket
+ * means all sizes. Returns 0 if nothing was recorded. */
+static inline uint64_t
+UTF_trace_percentile(int id, int size_bucket, double fraction)
+{
+	uint64_t total = 0, sum = 0, threshold;
+	int s, l, s0 = size_bucket, s1 = size_bucket + 1;
+	if (size_bucket < 0)
+	{
+		s0 = 0;
+		s1 = UTF_TRACE_SIZE_BUCKETS;
+	}
+
+	for (s = s0; s < s1; ++s)
+	{
+		for (l = 0; l < UTF_TRACE_LATENCY_BUCKETS; ++l)
+			total += UTF_trace_count(id, s, l);
+	}
+	if (!total)
+		return 0;
+
+	threshold = UTF_STATIC_CAST(uint64_t, fraction * UTF_STATIC_CAST(double, total));
+	if (threshold < 1)
+		threshold = 1;
+	for (l = 0; l < UTF_TRACE_LATENCY_BUCKETS; ++l)
+	{
+		for (s = s0; s < s1; ++s)
+			sum += UTF_trace_count(id, s, l);
+		if (sum >= threshold)
+			break;
+	}
+	if (l >= UTF_TRACE_LATENCY_BUCKETS - 1)
+		return ~UTF_STATIC_CAST(uint64_t, 0);
+	return UTF_trace_latency_lower(l + 1);
+}
+
+static inline void
+UTF_trace_reset(void)
+{
+	memset(&UTF_trace_hist, 0, sizeof(UTF_trace_hist));
+}
+
+	#define UTF_TRACE_HIST_ENTER_ uint64_t utf_trace_start = UTF_trace_now();
+	#define UTF_TRACE_HIST_EXIT_(name, size) \
+		UTF_trace_record(UTF_TRACE_ID_##name, size, UTF_trace_now() - utf_trace_start);
+#else
+	#define UTF_TRACE_HIST_ENTER_
+	#define UTF_TRACE_HIST_EXIT_(name, size)
+#endif  /* def UTF_TRACE_HISTOGRAM */
+
+/* UTF_TRACE_ENTER declares a variable; use it where a declaration may appear. */
+#define UTF_TRACE_ENTER(name, size) \
+	UTF_TRACE_HIST_ENTER_ UTF_TRACE_USDT_ENTER_(name, size) UTF_TRACE_HOOK_ENTER_(name, size)
+#define UTF_TRACE_EXIT(name, size) \
+	UTF_TRACE_HIST_EXIT_(name, size) UTF_TRACE_USDT_EXIT_(name, size) UTF_TRACE_HOOK_EXIT_(name, size)
+
+#endif  /* ndef UTF_TRACE_H_ */